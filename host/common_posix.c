@@ -0,0 +1,467 @@
+#include "common.h"
+#include <string.h>
+#include "esp_timer.h"
+#include "host.h"
+
+// What cycleCount() counts at
+#define HOST_CPU_MHZ 240
+#define MAX_TIMERS 32
+// Interval timer alarms are never set closer than this ahead of the count, as in common.c
+#define INTERVAL_TIMER_MIN_US 10
+
+typedef struct HostTimer {
+	TimerCallback callback;
+	void *arg;
+	const char *name;
+	int64_t dueNanos;
+	int64_t periodNanos;
+	bool armed;
+} HostTimer;
+
+typedef struct HostPin {
+	bool output;
+	uint8_t driven;
+	HostEdge script[HOST_MAX_EDGES];
+	size_t scriptLength;
+	InterruptHandler handler;
+	void *handlerArg;
+	size_t nextInterrupt; // first edge of the script the handler hasn't had
+	HostPinListener listener;
+	void *listenerArg;
+} HostPin;
+
+typedef enum HostEvent {
+	EVENT_NONE,
+	EVENT_INTERRUPT,
+	EVENT_INTERVAL,
+	EVENT_TIMER
+} HostEvent;
+
+// Virtual time, in nanoseconds so that reads can cost less than a microsecond
+static int64_t nowNanos = 0;
+static uint32_t readCostNanos = 250;
+static int criticalDepth = 0;
+static bool dispatching = false;
+
+static HostPin pins[NUM_PINS];
+static HostTimer timers[MAX_TIMERS];
+static size_t timerCount = 0;
+
+static IntervalCallback intervalCallback;
+static void *intervalArg;
+static bool intervalArmed = false;
+static int64_t intervalDueNanos;
+static uint32_t intervalProgrammed = 0;
+
+static HostPortSink portSink;
+static bool pwmReady[PWM_CHANNELS];
+static uint8_t pwmPins[PWM_CHANNELS];
+static int cpuHolds = 0;
+
+static int64_t _edgeNanos(const HostEdge *edge) {
+	return edge->micros * 1000;
+}
+
+// The first edge of the pin's script after now
+static size_t _firstEdgeAfterNow(const HostPin *pin) {
+	size_t edge = 0;
+	while (edge < pin->scriptLength && _edgeNanos(&pin->script[edge]) <= nowNanos) {
+		edge++;
+	}
+	return edge;
+}
+
+static uint8_t _scriptLevel(const HostPin *pin, size_t edges) {
+	return edges > 0 ? pin->script[edges - 1].level : HIGH;
+}
+
+static uint8_t _level(uint8_t pin) {
+	const HostPin *hostPin = &pins[pin];
+	if (hostPin->output) {
+		return hostPin->driven;
+	}
+	return _scriptLevel(hostPin, _firstEdgeAfterNow(hostPin));
+}
+
+static void _notify(uint8_t pin) {
+	HostPin *hostPin = &pins[pin];
+	if (hostPin->listener != NULL) {
+		hostPin->listener(pin, hostPin->output, hostPin->driven, hostPin->listenerArg);
+	}
+}
+
+/*
+ * The earliest timer, interval alarm or interrupt due by 'limit'. Interrupts win a tie, then the
+ * interval timer's.
+ */
+static HostEvent _nextEvent(int64_t limit, int64_t *due, size_t *index) {
+	HostEvent event = EVENT_NONE;
+	*due = INT64_MAX;
+	for (size_t pin = 0; pin < NUM_PINS; pin++) {
+		const HostPin *hostPin = &pins[pin];
+		if (hostPin->handler == NULL || hostPin->nextInterrupt == hostPin->scriptLength) {
+			continue;
+		}
+		int64_t edge = _edgeNanos(&hostPin->script[hostPin->nextInterrupt]);
+		if (edge <= limit && edge < *due) {
+			event = EVENT_INTERRUPT;
+			*due = edge;
+			*index = pin;
+		}
+	}
+	if (intervalArmed && intervalDueNanos <= limit && intervalDueNanos < *due) {
+		event = EVENT_INTERVAL;
+		*due = intervalDueNanos;
+	}
+	for (size_t i = 0; i < timerCount; i++) {
+		if (timers[i].armed && timers[i].dueNanos <= limit && timers[i].dueNanos < *due) {
+			event = EVENT_TIMER;
+			*due = timers[i].dueNanos;
+			*index = i;
+		}
+	}
+	return event;
+}
+
+static void _interrupt(uint8_t pin) {
+	HostPin *hostPin = &pins[pin];
+	size_t edge = hostPin->nextInterrupt++;
+	// An output's input buffer follows what it drives, and repeating a level isn't an edge
+	if (hostPin->output || hostPin->script[edge].level == _scriptLevel(hostPin, edge)) {
+		return;
+	}
+	hostPin->handler(hostPin->handlerArg);
+}
+
+static void _intervalAlarm(int64_t due) {
+	intervalArmed = false;
+	uint32_t next = intervalCallback(intervalArg);
+	if (next == 0) {
+		return;
+	}
+	// The counter restarted at the alarm, and whole µs of it have gone by during the callback
+	uint32_t elapsed = (uint32_t) ((nowNanos - due) / 1000);
+	if (next < elapsed + INTERVAL_TIMER_MIN_US) {
+		next = elapsed + INTERVAL_TIMER_MIN_US;
+	}
+	intervalDueNanos = due + (int64_t) next * 1000;
+	intervalProgrammed = next;
+	intervalArmed = true;
+}
+
+static void _timer(HostTimer *timer) {
+	if (timer->periodNanos > 0) {
+		timer->dueNanos += timer->periodNanos;
+	} else {
+		timer->armed = false;
+	}
+	timer->callback(timer->arg);
+}
+
+/*
+ * Moves the clock to 'target', running everything that falls due on the way unless that has to wait
+ * (a critical section, or something else already running).
+ */
+static void _runUntil(int64_t target) {
+	if (dispatching || criticalDepth > 0) {
+		if (target > nowNanos) {
+			nowNanos = target;
+		}
+		return;
+	}
+
+	dispatching = true;
+	int64_t due;
+	size_t index;
+	for (HostEvent event = _nextEvent(target, &due, &index); event != EVENT_NONE; event = _nextEvent(target, &due, &index)) {
+		if (due > nowNanos) {
+			nowNanos = due;
+		}
+		switch (event) {
+		case EVENT_INTERRUPT:
+			_interrupt(index);
+			break;
+		case EVENT_INTERVAL:
+			_intervalAlarm(due);
+			break;
+		default:
+			_timer(&timers[index]);
+			break;
+		}
+	}
+	if (target > nowNanos) {
+		nowNanos = target;
+	}
+	dispatching = false;
+}
+
+static void _readCost() {
+	_runUntil(nowNanos + readCostNanos);
+}
+
+esp_err_t initCommon() {
+	return ESP_OK;
+}
+
+esp_err_t initInterrupts() {
+	return ESP_OK;
+}
+
+void pinModeOutput(uint8_t pin) {
+	pins[pin].output = true;
+	_notify(pin);
+}
+
+void pinModeInput(uint8_t pin) {
+	pins[pin].output = false;
+	_notify(pin);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	pins[pin].driven = val ? HIGH : LOW;
+	_notify(pin);
+}
+
+int digitalRead(uint8_t pin) {
+	int level = pin < NUM_PINS ? _level(pin) : 0;
+	_readCost();
+	return level;
+}
+
+uint64_t readInputs() {
+	uint64_t levels = 0;
+	for (uint8_t pin = 0; pin < NUM_PINS; pin++) {
+		levels |= (uint64_t) _level(pin) << pin;
+	}
+	_readCost();
+	return levels;
+}
+
+void writePort(const PortMasks *masks) {
+	for (uint8_t pin = 0; pin < NUM_PINS; pin++) {
+		uint32_t set = pin < 32 ? masks->setLow : masks->setHigh;
+		uint32_t clear = pin < 32 ? masks->clearLow : masks->clearHigh;
+		uint32_t bit = (uint32_t) 1 << (pin & 31);
+		if (set & bit) {
+			pins[pin].driven = HIGH;
+			_notify(pin);
+		} else if (clear & bit) {
+			pins[pin].driven = LOW;
+			_notify(pin);
+		}
+	}
+	if (portSink.writePort != NULL) {
+		portSink.writePort(masks, host_micros(), portSink.arg);
+	}
+}
+
+esp_err_t initPwm(uint8_t channel, uint8_t pin) {
+	if (channel >= PWM_CHANNELS || pin >= NUM_PINS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	pwmReady[channel] = true;
+	pwmPins[channel] = pin;
+	pins[pin].output = true;
+	return ESP_OK;
+}
+
+void setPwmDuty(uint8_t channel, uint8_t duty) {
+	if (portSink.setPwmDuty != NULL && channel < PWM_CHANNELS && pwmReady[channel]) {
+		portSink.setPwmDuty(channel, duty, host_micros(), portSink.arg);
+	}
+}
+
+esp_err_t stopPwm(uint8_t channel, uint8_t pin) {
+	if (channel >= PWM_CHANNELS || pin >= NUM_PINS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (pwmReady[channel] && pwmPins[channel] == pin) {
+		pwmReady[channel] = false;
+	}
+	return ESP_OK;
+}
+
+esp_err_t attachInterrupt(uint8_t pin, InterruptHandler handler, void *arg) {
+	if (pin >= NUM_PINS) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	pins[pin].nextInterrupt = _firstEdgeAfterNow(&pins[pin]);
+	pins[pin].handlerArg = arg;
+	pins[pin].handler = handler;
+	return ESP_OK;
+}
+
+void detachInterrupt(uint8_t pin) {
+	pins[pin].handler = NULL;
+}
+
+#if CONFIG_TIME_WRAP_SOAK
+// A minute short of 2^32 ms, which is also a whole number of 2^32 µs, so both short counters wrap a minute after boot
+#define TIME_OFFSET_MICROS (1000LL * 0x100000000LL - 60 * 1000000LL)
+#else
+#define TIME_OFFSET_MICROS 0
+#endif
+
+int64_t micros64() {
+	return esp_timer_get_time() + TIME_OFFSET_MICROS;
+}
+
+int64_t millis64() {
+	return micros64() / 1000;
+}
+
+uint32_t millis() {
+	return (uint32_t) millis64();
+}
+
+uint32_t micros() {
+	return (uint32_t) micros64();
+}
+
+void delayMicroseconds(uint32_t us) {
+	_runUntil(nowNanos + (int64_t) us * 1000);
+}
+
+void delay(uint32_t ms) {
+	_runUntil(nowNanos + (int64_t) ms * 1000000);
+}
+
+uint32_t cycleCount() {
+	return (uint32_t) (nowNanos * HOST_CPU_MHZ / 1000);
+}
+
+esp_err_t createTimer(Timer *timer, TimerCallback callback, void *arg, const char *name) {
+	if (timerCount == MAX_TIMERS) {
+		return ESP_ERR_NO_MEM;
+	}
+	HostTimer *hostTimer = &timers[timerCount++];
+	hostTimer->callback = callback;
+	hostTimer->arg = arg;
+	hostTimer->name = name;
+	*timer = hostTimer;
+	return ESP_OK;
+}
+
+// Like esp_timer, starting a timer that's already running fails
+static esp_err_t _startTimer(Timer timer, uint64_t us, bool periodic) {
+	HostTimer *hostTimer = timer;
+	if (hostTimer->armed) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	hostTimer->dueNanos = nowNanos + (int64_t) us * 1000;
+	hostTimer->periodNanos = periodic ? (int64_t) us * 1000 : 0;
+	hostTimer->armed = true;
+	return ESP_OK;
+}
+
+esp_err_t startTimer(Timer timer, uint64_t us) {
+	return _startTimer(timer, us, false);
+}
+
+esp_err_t startPeriodicTimer(Timer timer, uint64_t us) {
+	return _startTimer(timer, us, true);
+}
+
+esp_err_t stopTimer(Timer timer) {
+	HostTimer *hostTimer = timer;
+	if (!hostTimer->armed) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	hostTimer->armed = false;
+	return ESP_OK;
+}
+
+esp_err_t initIntervalTimer(IntervalCallback callback, void *arg) {
+	intervalCallback = callback;
+	intervalArg = arg;
+	return ESP_OK;
+}
+
+void startIntervalTimer(uint32_t us) {
+	intervalDueNanos = nowNanos + (int64_t) us * 1000;
+	intervalProgrammed = us;
+	intervalArmed = true;
+}
+
+void stopIntervalTimer() {
+	intervalArmed = false;
+}
+
+uint32_t intervalTimerLast() {
+	return intervalProgrammed;
+}
+
+void holdMaxCpuFrequency() {
+	cpuHolds++;
+}
+
+void releaseMaxCpuFrequency() {
+	cpuHolds--;
+}
+
+int64_t host_micros() {
+	return nowNanos / 1000;
+}
+
+/*
+ * Lets 'us' pass, as if the test's task had blocked that long.
+ */
+void host_advance(uint64_t us) {
+	_runUntil(nowNanos + (int64_t) us * 1000);
+}
+
+// How long each digitalRead() and readInputs() takes
+void host_set_read_cost(uint32_t nanos) {
+	readCostNanos = nanos;
+}
+
+/*
+ * Replaces what 'pin' reads as an input with 'edges', which must be in time order. Edges already in
+ * the past don't raise an interrupt.
+ */
+void host_script_pin(uint8_t pin, const HostEdge edges[], size_t count) {
+	HostPin *hostPin = &pins[pin];
+	if (count > HOST_MAX_EDGES) {
+		count = HOST_MAX_EDGES;
+	}
+	memcpy(hostPin->script, edges, count * sizeof(HostEdge));
+	hostPin->scriptLength = count;
+	hostPin->nextInterrupt = _firstEdgeAfterNow(hostPin);
+}
+
+void host_listen_pin(uint8_t pin, HostPinListener listener, void *arg) {
+	pins[pin].listenerArg = arg;
+	pins[pin].listener = listener;
+}
+
+bool host_pin_output(uint8_t pin) {
+	return pins[pin].output;
+}
+
+// The pin PWM 'channel' drives, or -1 if it isn't running
+int host_pwm_pin(uint8_t channel) {
+	return pwmReady[channel] ? pwmPins[channel] : -1;
+}
+
+// Holds of the maximum CPU frequency that haven't been released
+int host_cpu_holds() {
+	return cpuHolds;
+}
+
+void host_set_port_sink(const HostPortSink *sink) {
+	if (sink == NULL) {
+		memset(&portSink, 0, sizeof(portSink));
+		return;
+	}
+	portSink = *sink;
+}
+
+void host_enter_critical() {
+	criticalDepth++;
+}
+
+void host_exit_critical() {
+	if (--criticalDepth == 0) {
+		_runUntil(nowNanos);
+	}
+}
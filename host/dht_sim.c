@@ -0,0 +1,92 @@
+#include "dht_sim.h"
+#include <stddef.h>
+#include "host.h"
+
+#define ACK_US 80
+#define BIT_LOW_US 50
+
+/*
+ * The 5 bytes of a frame: humidity, then temperature as sign and magnitude, then the checksum.
+ */
+void dht_sim_encode(int16_t humidityTenths, int16_t temperatureTenths, uint8_t bits[5]) {
+	uint16_t temperature = temperatureTenths < 0 ? 0x8000 | -temperatureTenths : temperatureTenths;
+	bits[0] = (uint16_t) humidityTenths >> 8;
+	bits[1] = humidityTenths;
+	bits[2] = temperature >> 8;
+	bits[3] = temperature;
+	bits[4] = bits[0] + bits[1] + bits[2] + bits[3];
+}
+
+static void _addEdge(HostEdge edges[], size_t *count, int64_t micros, uint8_t level) {
+	edges[*count].micros = micros;
+	edges[*count].level = level;
+	(*count)++;
+}
+
+static void _sendFrame(DhtSimSensor *sensor, int64_t released) {
+	HostEdge edges[HOST_MAX_EDGES];
+	size_t count = 0;
+	uint8_t bits[5];
+
+	dht_sim_encode(sensor->humidityTenths, sensor->temperatureTenths, bits);
+	if (sensor->badChecksum) {
+		bits[4] ^= 0x01;
+	}
+
+	int64_t at = released + sensor->responseMicros;
+	_addEdge(edges, &count, at, LOW);
+	at += ACK_US;
+	_addEdge(edges, &count, at, HIGH);
+	at += ACK_US;
+	for (int bit = 0; bit < 40; bit++) {
+		_addEdge(edges, &count, at, LOW);
+		if (bit == sensor->stopAfterBits) {
+			// The pull-up takes the line back once the sensor lets go of it
+			_addEdge(edges, &count, at + BIT_LOW_US, HIGH);
+			host_script_pin(sensor->pin, edges, count);
+			sensor->frames++;
+			return;
+		}
+		at += BIT_LOW_US;
+		_addEdge(edges, &count, at, HIGH);
+		at += (bits[bit / 8] & (128 >> (bit % 8))) ? sensor->oneMicros : sensor->zeroMicros;
+	}
+	_addEdge(edges, &count, at, LOW);
+	_addEdge(edges, &count, at + BIT_LOW_US, HIGH);
+	host_script_pin(sensor->pin, edges, count);
+	sensor->frames++;
+}
+
+static void _lineChanged(uint8_t pin, bool output, uint8_t level, void *arg) {
+	DhtSimSensor *sensor = arg;
+	if (output && level == LOW) {
+		if (!sensor->waking) {
+			sensor->waking = true;
+			sensor->wakeMicros = host_micros();
+		}
+		return;
+	}
+	if (!sensor->waking) {
+		return;
+	}
+	sensor->waking = false;
+	if (!sensor->silent && host_micros() - sensor->wakeMicros >= DHT_SIM_MIN_WAKE_US) {
+		_sendFrame(sensor, host_micros());
+	}
+}
+
+/*
+ * Puts a sensor reporting the given tenths on 'pin', with nominal timing.
+ */
+void dht_sim_init(DhtSimSensor *sensor, uint8_t pin, int16_t humidityTenths, int16_t temperatureTenths) {
+	*sensor = (DhtSimSensor) {
+		.pin = pin,
+		.humidityTenths = humidityTenths,
+		.temperatureTenths = temperatureTenths,
+		.responseMicros = 30,
+		.zeroMicros = 27,
+		.oneMicros = 70,
+		.stopAfterBits = -1
+	};
+	host_listen_pin(pin, _lineChanged, sensor);
+}
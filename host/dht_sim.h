@@ -0,0 +1,40 @@
+#ifndef dht_sim_h
+#define dht_sim_h
+
+/*
+ * A simulated DHT22 on a host build pin. Once the firmware has held the line low for at least
+ * DHT_SIM_MIN_WAKE_US and lets go, the sensor answers with a whole frame on the pin's script: pulls
+ * the line low after responseMicros, an 80us low and 80us high acknowledgement, then 40 bits of a 50us
+ * low and a zeroMicros or oneMicros high, and a last 50us low before releasing the line.
+ *
+ * The values can be changed between frames, and a sensor can be made to misbehave: stay silent, stop
+ * partway through, or send a bad checksum. A sensor is owned by the test and must outlive its use.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DHT_SIM_MIN_WAKE_US 1000
+
+typedef struct DhtSimSensor {
+	uint8_t pin;
+	int16_t humidityTenths;
+	int16_t temperatureTenths;
+	uint8_t responseMicros;    // from the release to the sensor pulling the line low, 20-40us
+	uint8_t zeroMicros;        // high pulse of a 0 bit, nominally 26-28us
+	uint8_t oneMicros;         // high pulse of a 1 bit, nominally 70us
+	bool silent;               // doesn't answer at all
+	int8_t stopAfterBits;      // lets go of the line for good after this many bits, or -1
+	bool badChecksum;
+
+	bool waking;
+	int64_t wakeMicros;
+	uint32_t frames;           // frames sent, including broken ones
+} DhtSimSensor;
+
+void dht_sim_init(DhtSimSensor *sensor, uint8_t pin, int16_t humidityTenths, int16_t temperatureTenths);
+void dht_sim_encode(int16_t humidityTenths, int16_t temperatureTenths, uint8_t bits[5]);
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,89 @@
+#ifndef host_h
+#define host_h
+
+/*
+ * Controls for the board the host build runs the firmware on (common_posix.c). It is simulated on the
+ * test's thread, in virtual time:
+ *
+ *  - The clock starts at 0 and only moves when the firmware waits (delay(), delayMicroseconds(),
+ *    vTaskDelay()), reads a pin (host_set_read_cost() each) or the test calls host_advance().
+ *  - Timers, the interval timer and interrupts on scripted pins run as the clock passes their time,
+ *    in order. Inside a critical section they're held back and run as soon as it's left, late, like a
+ *    masked interrupt; the same goes for anything falling due while one of them is running.
+ *  - An input pin reads its script, or HIGH (the pull-up) outside of it. An output pin reads what was
+ *    last written to it.
+ *  - writePort() and setPwmDuty() are handed to the port sink with the time they happened, the
+ *    latter only while the channel runs (initPwm() to stopPwm()).
+ *  - The MQTT client only connects, and its publishes are only acknowledged, when the test says so.
+ *    What it publishes is kept, up to HOST_MQTT_MESSAGES of them, until host_mqtt_clear().
+ *  - The system clock reads esp_timer's time, i.e. long before any valid epoch, until the test sets
+ *    it with host_set_epoch().
+ *
+ * Not thread safe; everything but code that never touches common.h runs on one thread.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Edges in a pin's script; a DHT22 frame is 83
+#define HOST_MAX_EDGES 96
+
+typedef struct HostEdge {
+	int64_t micros;
+	uint8_t level;
+} HostEdge;
+
+/*
+ * Told whenever the firmware changes how it drives 'pin': as an output at 'level', or released as an
+ * input. Runs on the firmware's call, so it must not call back into common.h.
+ */
+typedef void (*HostPinListener)(uint8_t pin, bool output, uint8_t level, void *arg);
+
+// What the MQTT client keeps of each message it publishes
+#define HOST_MQTT_MESSAGES 64
+#define HOST_MQTT_BODY_SIZE 4096
+
+typedef struct HostMqttMessage {
+	char topic[128];
+	char body[HOST_MQTT_BODY_SIZE]; // NUL-terminated after 'length' bytes
+	int length;
+	bool retained;
+	int msgId;
+} HostMqttMessage;
+
+typedef struct HostPortSink {
+	void (*writePort)(const PortMasks *masks, int64_t micros, void *arg);
+	void (*setPwmDuty)(uint8_t channel, uint8_t duty, int64_t micros, void *arg);
+	void *arg;
+} HostPortSink;
+
+int64_t host_micros();
+void host_advance(uint64_t us);
+void host_set_read_cost(uint32_t nanos);
+
+void host_script_pin(uint8_t pin, const HostEdge edges[], size_t count);
+void host_listen_pin(uint8_t pin, HostPinListener listener, void *arg);
+bool host_pin_output(uint8_t pin);
+int host_pwm_pin(uint8_t channel);
+int host_cpu_holds();
+void host_set_port_sink(const HostPortSink *sink);
+
+void host_enter_critical();
+void host_exit_critical();
+
+void host_nvs_fail_writes(bool fail);
+void host_nvs_erase_all();
+
+void host_mqtt_connect(bool connected);
+void host_mqtt_ack_all();
+size_t host_mqtt_count();
+const HostMqttMessage *host_mqtt_message(size_t index);
+void host_mqtt_clear();
+
+void host_set_epoch(int64_t epochMillis);
+
+#endif
+
+// END OF FILE
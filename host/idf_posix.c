@@ -0,0 +1,436 @@
+/*
+ * The ESP-IDF and FreeRTOS calls the firmware makes outside of common.h, for the host build: logging,
+ * esp_timer's clock, task delays, queues, NVS, the MQTT client and the system clock SNTP would set.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "common.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "lwip/apps/sntp.h"
+#include "mqtt_client.h"
+#include "nvs.h"
+
+#define MAX_LOG_TAGS 32
+
+#define NVS_ENTRIES 64
+#define NVS_HANDLES 8
+// The longest key or namespace NVS takes, plus the NUL
+#define NVS_NAME_SIZE 16
+// Enough for a store-and-forward spill chunk of the largest ring
+#define NVS_VALUE_SIZE 4096
+
+static struct {
+	const char *tag;
+	esp_log_level_t level;
+} logLevels[MAX_LOG_TAGS];
+static size_t logTagCount = 0;
+static esp_log_level_t defaultLogLevel = CONFIG_LOG_DEFAULT_LEVEL;
+
+typedef struct NvsEntry {
+	bool used;
+	bool string;
+	char space[NVS_NAME_SIZE];
+	char key[NVS_NAME_SIZE];
+	size_t length;
+	uint8_t value[NVS_VALUE_SIZE];
+} NvsEntry;
+
+static NvsEntry nvsEntries[NVS_ENTRIES];
+static struct {
+	bool open;
+	bool writable;
+	char space[NVS_NAME_SIZE];
+} nvsHandles[NVS_HANDLES];
+static bool nvsFailWrites = false;
+
+struct esp_mqtt_client {
+	esp_mqtt_client_config_t config;
+	bool started;
+	bool connected;
+	int nextMsgId;
+	int ackedMsgId;
+};
+
+static struct esp_mqtt_client mqttClient;
+static HostMqttMessage mqttMessages[HOST_MQTT_MESSAGES];
+static size_t mqttMessageCount = 0;
+
+static bool sntpEnabled = false;
+// Epoch microseconds at esp_timer 0, once the test has set the clock
+static int64_t epochOffsetMicros = 0;
+
+/*
+ * "*" sets the level of every tag without one of its own.
+ */
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+	if (strcmp(tag, "*") == 0) {
+		defaultLogLevel = level;
+		return;
+	}
+	for (size_t i = 0; i < logTagCount; i++) {
+		if (strcmp(logLevels[i].tag, tag) == 0) {
+			logLevels[i].level = level;
+			return;
+		}
+	}
+	if (logTagCount < MAX_LOG_TAGS) {
+		logLevels[logTagCount].tag = tag;
+		logLevels[logTagCount++].level = level;
+	}
+}
+
+static esp_log_level_t _logLevel(const char *tag) {
+	for (size_t i = 0; i < logTagCount; i++) {
+		if (strcmp(logLevels[i].tag, tag) == 0) {
+			return logLevels[i].level;
+		}
+	}
+	return defaultLogLevel;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+	static const char letters[] = "NEWIDV";
+	if (level > _logLevel(tag)) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long) (esp_timer_get_time() / 1000), tag);
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+	va_end(args);
+}
+
+int64_t esp_timer_get_time() {
+	return host_micros();
+}
+
+uint32_t esp_get_free_heap_size() {
+	return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+	return 0;
+}
+
+void vTaskDelay(const TickType_t ticks) {
+	delay(ticks * portTICK_PERIOD_MS);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+	StaticQueue_t *queue = malloc(sizeof(StaticQueue_t));
+	uint8_t *storage = malloc(length * itemSize);
+	if (queue == NULL || storage == NULL) {
+		free(queue);
+		free(storage);
+		return NULL;
+	}
+	return xQueueCreateStatic(length, itemSize, storage, queue);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer) {
+	buffer->storage = storage;
+	buffer->length = length;
+	buffer->itemSize = itemSize;
+	buffer->head = 0;
+	buffer->count = 0;
+	return buffer;
+}
+
+/*
+ * Never waits: nothing else could take an item off meanwhile.
+ */
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+	if (queue->count == queue->length) {
+		return pdFAIL;
+	}
+	UBaseType_t tail = (queue->head + queue->count++) % queue->length;
+	memcpy(&queue->storage[tail * queue->itemSize], item, queue->itemSize);
+	return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait) {
+	for (TickType_t waited = 0; queue->count == 0; waited++) {
+		if (waited == ticksToWait) {
+			return pdFALSE;
+		}
+		vTaskDelay(1);
+	}
+	memcpy(item, &queue->storage[queue->head * queue->itemSize], queue->itemSize);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	return pdTRUE;
+}
+
+static NvsEntry *_nvsFind(const char *space, const char *key) {
+	for (size_t i = 0; i < NVS_ENTRIES; i++) {
+		NvsEntry *entry = &nvsEntries[i];
+		if (entry->used && strcmp(entry->space, space) == 0 && (key == NULL || strcmp(entry->key, key) == 0)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static bool _nvsValidHandle(nvs_handle handle) {
+	return handle >= 1 && handle <= NVS_HANDLES && nvsHandles[handle - 1].open;
+}
+
+/*
+ * As on the device, a namespace can only be opened read-only once something has been written to it.
+ */
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+	if (strlen(name) >= NVS_NAME_SIZE) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (open_mode == NVS_READONLY && _nvsFind(name, NULL) == NULL) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	for (nvs_handle i = 0; i < NVS_HANDLES; i++) {
+		if (!nvsHandles[i].open) {
+			nvsHandles[i].open = true;
+			nvsHandles[i].writable = open_mode == NVS_READWRITE;
+			strcpy(nvsHandles[i].space, name);
+			*out_handle = i + 1;
+			return ESP_OK;
+		}
+	}
+	return ESP_ERR_NO_MEM;
+}
+
+static esp_err_t _nvsSet(nvs_handle handle, const char *key, const void *value, size_t length, bool string) {
+	if (!_nvsValidHandle(handle)) {
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	if (!nvsHandles[handle - 1].writable) {
+		return ESP_ERR_NVS_READ_ONLY;
+	}
+	if (strlen(key) >= NVS_NAME_SIZE) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (nvsFailWrites || length > NVS_VALUE_SIZE) {
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+
+	const char *space = nvsHandles[handle - 1].space;
+	NvsEntry *entry = _nvsFind(space, key);
+	for (size_t i = 0; entry == NULL && i < NVS_ENTRIES; i++) {
+		if (!nvsEntries[i].used) {
+			entry = &nvsEntries[i];
+		}
+	}
+	if (entry == NULL) {
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+	entry->used = true;
+	entry->string = string;
+	strcpy(entry->space, space);
+	strcpy(entry->key, key);
+	memcpy(entry->value, value, length);
+	entry->length = length;
+	return ESP_OK;
+}
+
+static esp_err_t _nvsGet(nvs_handle handle, const char *key, void *out_value, size_t *length, bool string) {
+	if (!_nvsValidHandle(handle)) {
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	const NvsEntry *entry = _nvsFind(nvsHandles[handle - 1].space, key);
+	if (entry == NULL || entry->string != string) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if (out_value == NULL) {
+		*length = entry->length;
+		return ESP_OK;
+	}
+	if (*length < entry->length) {
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	}
+	memcpy(out_value, entry->value, entry->length);
+	*length = entry->length;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle handle, const char *key, const char *value) {
+	return _nvsSet(handle, key, value, strlen(value) + 1, true);
+}
+
+esp_err_t nvs_get_str(nvs_handle handle, const char *key, char *out_value, size_t *length) {
+	return _nvsGet(handle, key, out_value, length, true);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+	return _nvsSet(handle, key, value, length, false);
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length) {
+	return _nvsGet(handle, key, out_value, length, false);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key) {
+	if (!_nvsValidHandle(handle)) {
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	if (!nvsHandles[handle - 1].writable) {
+		return ESP_ERR_NVS_READ_ONLY;
+	}
+	NvsEntry *entry = _nvsFind(nvsHandles[handle - 1].space, key);
+	if (entry == NULL) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	entry->used = false;
+	return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+	return _nvsValidHandle(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle handle) {
+	if (_nvsValidHandle(handle)) {
+		nvsHandles[handle - 1].open = false;
+	}
+}
+
+/*
+ * Makes every NVS write fail as if the partition were full, until called again with false.
+ */
+void host_nvs_fail_writes(bool fail) {
+	nvsFailWrites = fail;
+}
+
+void host_nvs_erase_all() {
+	memset(nvsEntries, 0, sizeof(nvsEntries));
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+	memset(&mqttClient, 0, sizeof(mqttClient));
+	mqttClient.config = *config;
+	return &mqttClient;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+	client->started = true;
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+	client->started = false;
+	client->connected = false;
+	return ESP_OK;
+}
+
+/*
+ * Like the real client's, refuses with -1 while it isn't connected. The message ids count up from 1.
+ */
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+		int retain) {
+	if (!client->connected) {
+		return -1;
+	}
+	if (len == 0) {
+		len = strlen(data);
+	}
+	int msgId = ++client->nextMsgId;
+	if (mqttMessageCount < HOST_MQTT_MESSAGES && len < HOST_MQTT_BODY_SIZE) {
+		HostMqttMessage *message = &mqttMessages[mqttMessageCount++];
+		snprintf(message->topic, sizeof(message->topic), "%s", topic);
+		memcpy(message->body, data, len);
+		message->body[len] = '\0';
+		message->length = len;
+		message->retained = retain;
+		message->msgId = msgId;
+	}
+	return msgId;
+}
+
+static void _mqttEvent(esp_mqtt_event_id_t id, int msgId) {
+	esp_mqtt_event_t event = {
+		.event_id = id,
+		.client = &mqttClient,
+		.user_context = mqttClient.config.user_context,
+		.msg_id = msgId
+	};
+	if (mqttClient.config.event_handle != NULL) {
+		mqttClient.config.event_handle(&event);
+	}
+}
+
+/*
+ * Connects or disconnects a started client, and tells its event handler.
+ */
+void host_mqtt_connect(bool connected) {
+	if (!mqttClient.started || mqttClient.connected == connected) {
+		return;
+	}
+	mqttClient.connected = connected;
+	_mqttEvent(connected ? MQTT_EVENT_CONNECTED : MQTT_EVENT_DISCONNECTED, 0);
+}
+
+/*
+ * The broker's PUBACK for everything published so far, in order.
+ */
+void host_mqtt_ack_all() {
+	while (mqttClient.ackedMsgId < mqttClient.nextMsgId) {
+		_mqttEvent(MQTT_EVENT_PUBLISHED, ++mqttClient.ackedMsgId);
+	}
+}
+
+size_t host_mqtt_count() {
+	return mqttMessageCount;
+}
+
+const HostMqttMessage *host_mqtt_message(size_t index) {
+	return index < mqttMessageCount ? &mqttMessages[index] : NULL;
+}
+
+void host_mqtt_clear() {
+	mqttMessageCount = 0;
+}
+
+void sntp_setoperatingmode(unsigned char operating_mode) {
+}
+
+void sntp_setservername(unsigned char idx, const char *server) {
+}
+
+void sntp_init() {
+	sntpEnabled = true;
+}
+
+void sntp_stop() {
+	sntpEnabled = false;
+}
+
+unsigned char sntp_enabled() {
+	return sntpEnabled;
+}
+
+/*
+ * Replaces the C library's for the whole process, so the firmware's system clock runs on virtual time.
+ */
+int gettimeofday(struct timeval *restrict now, void *restrict zone) {
+	int64_t micros = epochOffsetMicros + esp_timer_get_time();
+	now->tv_sec = micros / 1000000;
+	now->tv_usec = micros % 1000000;
+	return 0;
+}
+
+/*
+ * Sets the system clock to 'epochMillis' now, as SNTP would; it carries on with virtual time from there.
+ */
+void host_set_epoch(int64_t epochMillis) {
+	epochOffsetMicros = epochMillis * 1000 - esp_timer_get_time();
+}
@@ -0,0 +1,18 @@
+#ifndef gpio_h
+#define gpio_h
+
+/*
+ * Host build: which pins an ESP32 has. Everything else GPIO goes through common.h.
+ */
+
+#include "esp_err.h"
+
+#define GPIO_NUM_MAX 40
+
+// 20, 24 and 28-31 aren't bonded out, and 34-39 are inputs only
+#define GPIO_IS_VALID_GPIO(pin) ((pin) >= 0 && (pin) < GPIO_NUM_MAX && (pin) != 20 && (pin) != 24 && ((pin) < 28 || (pin) > 31))
+#define GPIO_IS_VALID_OUTPUT_GPIO(pin) (GPIO_IS_VALID_GPIO(pin) && (pin) < 34)
+
+#endif
+
+// END OF FILE
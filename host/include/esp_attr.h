@@ -0,0 +1,17 @@
+#ifndef esp_attr_h
+#define esp_attr_h
+
+/*
+ * Host build: there's only one kind of memory, so the placement attributes go away.
+ */
+
+#include "sdkconfig.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
+
+// END OF FILE
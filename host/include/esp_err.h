@@ -0,0 +1,25 @@
+#ifndef esp_err_h
+#define esp_err_h
+
+/*
+ * Host build: the error codes the firmware uses, with ESP-IDF's values.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_FOUND       0x105
+#define ESP_ERR_TIMEOUT         0x107
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,16 @@
+#ifndef esp_system_h
+#define esp_system_h
+
+/*
+ * Host build: the heap figures are the C library's, which has no fixed heap, so they're always 0.
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+
+uint32_t esp_get_free_heap_size();
+uint32_t esp_get_minimum_free_heap_size();
+
+#endif
+
+// END OF FILE
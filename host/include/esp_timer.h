@@ -0,0 +1,14 @@
+#ifndef esp_timer_h
+#define esp_timer_h
+
+/*
+ * Host build: microseconds of virtual time since "boot" (see host.h).
+ */
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif
+
+// END OF FILE
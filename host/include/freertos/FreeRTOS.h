@@ -0,0 +1,28 @@
+#ifndef FreeRTOS_h
+#define FreeRTOS_h
+
+/*
+ * Host build: just the types and constants the firmware uses. There is one task, the test's, so
+ * nothing here schedules anything.
+ */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "freertos/portmacro.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+
+#endif
+
+// END OF FILE
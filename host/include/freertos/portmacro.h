@@ -0,0 +1,26 @@
+#ifndef portmacro_h
+#define portmacro_h
+
+/*
+ * Host build: a critical section holds back the simulated timers and interrupts until it's left, the
+ * way masking interrupts would (see host.h). The mutex itself isn't needed on one thread.
+ */
+
+typedef struct {
+	int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portNUM_PROCESSORS 2
+
+void host_enter_critical();
+void host_exit_critical();
+
+#define portENTER_CRITICAL(mux) ((void) (mux), host_enter_critical())
+#define portEXIT_CRITICAL(mux) ((void) (mux), host_exit_critical())
+#define portENTER_CRITICAL_ISR(mux) ((void) (mux), host_enter_critical())
+#define portEXIT_CRITICAL_ISR(mux) ((void) (mux), host_exit_critical())
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,30 @@
+#ifndef queue_h
+#define queue_h
+
+/*
+ * Host build: a queue is a ring of copied items, as on the device. With one task there is nobody to
+ * wait for, so a receive that has to wait lets virtual time pass a tick at a time, running whatever
+ * falls due (a timer callback sending to the queue, say), until an item comes in or it times out.
+ */
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct StaticQueue_t {
+	uint8_t *storage;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	UBaseType_t head;
+	UBaseType_t count;
+} StaticQueue_t;
+
+typedef StaticQueue_t *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,14 @@
+#ifndef task_h
+#define task_h
+
+/*
+ * Host build: a task delay lets virtual time pass, running whatever falls due meanwhile.
+ */
+
+#include "freertos/FreeRTOS.h"
+
+void vTaskDelay(const TickType_t ticks);
+
+#endif
+
+// END OF FILE
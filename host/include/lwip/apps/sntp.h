@@ -0,0 +1,19 @@
+#ifndef sntp_h
+#define sntp_h
+
+/*
+ * Host build: SNTP never reaches a server. The system clock reads as esp_timer's since boot, well
+ * before any valid epoch, until the test sets it (host_set_epoch() in host.h).
+ */
+
+#define SNTP_OPMODE_POLL 0
+
+void sntp_setoperatingmode(unsigned char operating_mode);
+void sntp_setservername(unsigned char idx, const char *server);
+void sntp_init();
+void sntp_stop();
+unsigned char sntp_enabled();
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,52 @@
+#ifndef mqtt_client_h
+#define mqtt_client_h
+
+/*
+ * Host build: one MQTT client with the ESP-IDF client's calls, that keeps what it's given to publish
+ * instead of sending it. The test connects it, acknowledges its publishes and reads them back through
+ * host.h; the event handler runs on the test's call, the way the client's own task would run it.
+ */
+
+#include "esp_err.h"
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum {
+	MQTT_EVENT_ERROR = 0,
+	MQTT_EVENT_CONNECTED,
+	MQTT_EVENT_DISCONNECTED,
+	MQTT_EVENT_SUBSCRIBED,
+	MQTT_EVENT_UNSUBSCRIBED,
+	MQTT_EVENT_PUBLISHED,
+	MQTT_EVENT_DATA,
+} esp_mqtt_event_id_t;
+
+typedef struct esp_mqtt_event_t {
+	esp_mqtt_event_id_t event_id;
+	esp_mqtt_client_handle_t client;
+	void *user_context;
+	char *data;
+	int data_len;
+	char *topic;
+	int topic_len;
+	int msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef esp_err_t (*mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+
+typedef struct esp_mqtt_client_config_t {
+	const char *uri;
+	mqtt_event_callback_t event_handle;
+	void *user_context;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+		int retain);
+
+#endif
+
+// END OF FILE
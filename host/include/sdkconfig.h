@@ -0,0 +1,94 @@
+#ifndef sdkconfig_h
+#define sdkconfig_h
+
+/*
+ * Host build: the configuration the firmware is built with off-device. Kconfig defaults, except that
+ * the optional features with tests of their own are turned on. Any of these can be overridden with a
+ * compile definition (0 turns a bool off), which is how a test builds another variant.
+ */
+
+#ifndef CONFIG_LOG_DEFAULT_LEVEL
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#endif
+
+#ifndef CONFIG_BROKER_URL
+#define CONFIG_BROKER_URL "mqtt://iot.eclipse.org"
+#endif
+
+#ifndef CONFIG_SENSOR_TABLE
+#define CONFIG_SENSOR_TABLE "26 27 25 33"
+#endif
+#ifndef CONFIG_SENSORS_MAX
+#define CONFIG_SENSORS_MAX 16
+#endif
+#ifndef CONFIG_SENSOR_ZONES_MAX
+#define CONFIG_SENSOR_ZONES_MAX 4
+#endif
+#ifndef CONFIG_SENSOR_QUARANTINE_FAILURES
+#define CONFIG_SENSOR_QUARANTINE_FAILURES 3
+#endif
+#ifndef CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF
+#define CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF 64
+#endif
+
+#ifndef CONFIG_READING_FORMAT_BENCHMARK
+#define CONFIG_READING_FORMAT_BENCHMARK 1
+#endif
+
+#ifndef CONFIG_READING_QUEUE_CAPACITY
+#define CONFIG_READING_QUEUE_CAPACITY 32
+#endif
+#if !CONFIG_READING_QUEUE_DROP_NEWEST
+#define CONFIG_READING_QUEUE_DROP_OLDEST 1
+#endif
+
+#ifndef CONFIG_FILTER_READINGS
+#define CONFIG_FILTER_READINGS 1
+#endif
+#ifndef CONFIG_FILTER_MEDIAN_WINDOW
+#define CONFIG_FILTER_MEDIAN_WINDOW 3
+#endif
+#ifndef CONFIG_FILTER_EWMA_PERCENT
+#define CONFIG_FILTER_EWMA_PERCENT 50
+#endif
+#ifndef CONFIG_FILTER_HUMIDITY_DEADBAND
+#define CONFIG_FILTER_HUMIDITY_DEADBAND 5
+#endif
+#ifndef CONFIG_FILTER_TEMPERATURE_DEADBAND
+#define CONFIG_FILTER_TEMPERATURE_DEADBAND 2
+#endif
+#ifndef CONFIG_FILTER_HEARTBEAT_SEC
+#define CONFIG_FILTER_HEARTBEAT_SEC 300
+#endif
+
+#ifndef CONFIG_STORE_AND_FORWARD
+#define CONFIG_STORE_AND_FORWARD 1
+#endif
+#ifndef CONFIG_STORE_AND_FORWARD_CAPACITY
+#define CONFIG_STORE_AND_FORWARD_CAPACITY 128
+#endif
+#ifndef CONFIG_STORE_AND_FORWARD_DRAIN_BATCHES
+#define CONFIG_STORE_AND_FORWARD_DRAIN_BATCHES 4
+#endif
+#ifndef CONFIG_STORE_AND_FORWARD_NVS_SPILL
+#define CONFIG_STORE_AND_FORWARD_NVS_SPILL 1
+#endif
+#ifndef CONFIG_STORE_AND_FORWARD_NVS_BLOBS
+#define CONFIG_STORE_AND_FORWARD_NVS_BLOBS 16
+#endif
+
+#ifndef CONFIG_STEPPER_BENCHMARK
+#define CONFIG_STEPPER_BENCHMARK 0
+#endif
+
+#ifndef CONFIG_TIME_WRAP_SOAK
+#define CONFIG_TIME_WRAP_SOAK 0
+#endif
+
+#ifndef CONFIG_METRICS
+#define CONFIG_METRICS 1
+#endif
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,79 @@
+#include "stepper_sink.h"
+#include <stddef.h>
+#include <string.h>
+#include "host.h"
+
+static StepperSink *sinks[STEPPER_SINK_MAX];
+static size_t sinkCount = 0;
+
+static void _record(StepperSink *sink) {
+	if (sink->count > 0 && sink->current.coils == sink->states[sink->count - 1].coils
+			&& memcmp(sink->current.duties, sink->states[sink->count - 1].duties, sizeof(sink->current.duties)) == 0) {
+		return;
+	}
+	if (sink->count == STEPPER_SINK_MAX_STATES) {
+		sink->overflow = true;
+		return;
+	}
+	sink->states[sink->count++] = sink->current;
+}
+
+static void _writePort(const PortMasks *masks, int64_t micros, void *arg) {
+	for (size_t i = 0; i < sinkCount; i++) {
+		StepperSink *sink = sinks[i];
+		for (int coil = 0; coil < 4; coil++) {
+			uint8_t pin = sink->pins[coil];
+			if ((masks->setLow & PIN_MASK_LOW(pin)) || (masks->setHigh & PIN_MASK_HIGH(pin))) {
+				sink->current.coils |= 1 << coil;
+			} else if ((masks->clearLow & PIN_MASK_LOW(pin)) || (masks->clearHigh & PIN_MASK_HIGH(pin))) {
+				sink->current.coils &= ~(1 << coil);
+			}
+		}
+		sink->current.micros = micros;
+		sink->writes++;
+		_record(sink);
+	}
+}
+
+// Duties take effect with the writePort() that ends the tick
+static void _setPwmDuty(uint8_t channel, uint8_t duty, int64_t micros, void *arg) {
+	for (size_t i = 0; i < sinkCount; i++) {
+		StepperSink *sink = sinks[i];
+		if (sink->pwmChannel >= 0 && channel >= sink->pwmChannel && channel < sink->pwmChannel + 4) {
+			sink->current.duties[channel - sink->pwmChannel] = duty;
+		}
+	}
+}
+
+static const HostPortSink portSink = {
+	.writePort = _writePort,
+	.setPwmDuty = _setPwmDuty
+};
+
+/*
+ * Starts recording 'pins' (in the motor's coil order) and, if 'pwmChannel' isn't -1, the four PWM
+ * channels from it. Coils start out LOW.
+ */
+void stepper_sink_attach(StepperSink *sink, const uint8_t pins[4], int8_t pwmChannel) {
+	memset(sink, 0, sizeof(*sink));
+	memcpy(sink->pins, pins, sizeof(sink->pins));
+	sink->pwmChannel = pwmChannel;
+	if (sinkCount < STEPPER_SINK_MAX) {
+		sinks[sinkCount++] = sink;
+	}
+	host_set_port_sink(&portSink);
+}
+
+void stepper_sink_detach_all() {
+	sinkCount = 0;
+	host_set_port_sink(NULL);
+}
+
+/*
+ * Forgets the states recorded so far but keeps the coils' current levels.
+ */
+void stepper_sink_clear(StepperSink *sink) {
+	sink->writes = 0;
+	sink->count = 0;
+	sink->overflow = false;
+}
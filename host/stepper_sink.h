@@ -0,0 +1,42 @@
+#ifndef stepper_sink_h
+#define stepper_sink_h
+
+/*
+ * Records what a motor's coils were told, for checking a stepper on the host build. A sink watches
+ * four coil pins (and, for a microstepping motor, four PWM channels) and logs a state every time a
+ * writePort() leaves them different from the last one, with the time. For a motor driven by
+ * stepper.c that's one state for set_up() and one per step.
+ *
+ * Sinks are owned by the test and must outlive their use; up to STEPPER_SINK_MAX of them can be
+ * attached at once.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STEPPER_SINK_MAX 4
+#define STEPPER_SINK_MAX_STATES 8192
+
+typedef struct StepperSinkState {
+	int64_t micros;
+	uint8_t coils;               // bit N is coil N's level
+	uint8_t duties[4];           // microstepping only
+} StepperSinkState;
+
+typedef struct StepperSink {
+	uint8_t pins[4];
+	int8_t pwmChannel;           // first of the four channels, or -1
+	StepperSinkState current;
+	uint32_t writes;             // every writePort(), changed or not
+	uint32_t count;
+	bool overflow;               // states past STEPPER_SINK_MAX_STATES weren't kept
+	StepperSinkState states[STEPPER_SINK_MAX_STATES];
+} StepperSink;
+
+void stepper_sink_attach(StepperSink *sink, const uint8_t pins[4], int8_t pwmChannel);
+void stepper_sink_detach_all();
+void stepper_sink_clear(StepperSink *sink);
+
+#endif
+
+// END OF FILE
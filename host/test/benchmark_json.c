@@ -0,0 +1,204 @@
+/*
+ * Bytes per µs and heap allocations per message on the host: one cycle's batch of readings written by
+ * json_writer, and by cJSON the way the firmware used it before (a tree per message, printed into the
+ * message body). Both have to write the same text, which is checked, and json_writer mustn't touch the
+ * heap; the host throughput is just logged.
+ *
+ * cJSON is only compared when CMake finds it on the host (HAVE_CJSON); otherwise json_writer is
+ * measured on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dht.h"
+#include "json_writer.h"
+#include "telemetry.h"
+#include "test.h"
+#if HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+#define BENCHMARK_MESSAGES 100000
+#define BODY_SIZE 1024
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+static volatile bool counting;
+static volatile int allocations;
+
+void *malloc(size_t size) {
+	allocations += counting;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	allocations += counting;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+	allocations += counting;
+	return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+	__libc_free(pointer);
+}
+
+static const char *timestamp = "2019-05-04T08:34:56EDT";
+
+// A cycle of eight sensors in two zones, one of them failing, and the zones' aggregates
+static const TelemetryRecord batch[] = {
+	{ .pin = 26, .zone = 0, .status = DHTLIB_OK, .humidityTenths = 451, .temperatureTenths = 215 },
+	{ .pin = 27, .zone = 0, .status = DHTLIB_OK, .humidityTenths = 467, .temperatureTenths = 209 },
+	{ .pin = 25, .zone = 0, .status = DHTLIB_ERROR_TIMEOUT },
+	{ .pin = 33, .zone = 0, .status = DHTLIB_OK, .humidityTenths = 449, .temperatureTenths = 221 },
+	{ .pin = 32, .zone = 1, .status = DHTLIB_OK, .humidityTenths = 802, .temperatureTenths = -35 },
+	{ .pin = 4, .zone = 1, .status = DHTLIB_OK, .humidityTenths = 795, .temperatureTenths = -41 },
+	{ .pin = 5, .zone = 1, .status = DHTLIB_OK, .humidityTenths = 1000, .temperatureTenths = -4 },
+	{ .pin = 18, .zone = 1, .status = DHTLIB_OK, .humidityTenths = 811, .temperatureTenths = -38 },
+	{ .pin = TELEMETRY_ZONE_AGGREGATE, .zone = 0, .status = DHTLIB_OK, .humidityTenths = 456, .temperatureTenths = 215 },
+	{ .pin = TELEMETRY_ZONE_AGGREGATE, .zone = 1, .status = DHTLIB_OK, .humidityTenths = 852, .temperatureTenths = -30 }
+};
+
+#define BATCH_RECORDS (sizeof(batch) / sizeof(batch[0]))
+
+static const char *expected = "{\"timestamp\":\"2019-05-04T08:34:56EDT\",\"readings\":["
+		"{\"pin\":26,\"zone\":0,\"status\":0,\"relative_humidity\":45.1,\"temperature\":21.5},"
+		"{\"pin\":27,\"zone\":0,\"status\":0,\"relative_humidity\":46.7,\"temperature\":20.9},"
+		"{\"pin\":25,\"zone\":0,\"status\":-2},"
+		"{\"pin\":33,\"zone\":0,\"status\":0,\"relative_humidity\":44.9,\"temperature\":22.1},"
+		"{\"pin\":32,\"zone\":1,\"status\":0,\"relative_humidity\":80.2,\"temperature\":-3.5},"
+		"{\"pin\":4,\"zone\":1,\"status\":0,\"relative_humidity\":79.5,\"temperature\":-4.1},"
+		"{\"pin\":5,\"zone\":1,\"status\":0,\"relative_humidity\":100.0,\"temperature\":-0.4},"
+		"{\"pin\":18,\"zone\":1,\"status\":0,\"relative_humidity\":81.1,\"temperature\":-3.8}],\"zones\":["
+		"{\"zone\":0,\"relative_humidity\":45.6,\"temperature\":21.5},"
+		"{\"zone\":1,\"relative_humidity\":85.2,\"temperature\":-3.0}]}";
+
+static int64_t _hostNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * The batch as publish_records() writes it; returns its length, or 0 if it didn't fit.
+ */
+static size_t _writeBatch(char *body, size_t size) {
+	JsonWriter json;
+
+	json_begin(&json, body, size);
+	json_string(&json, "timestamp", timestamp);
+	json_begin_array(&json, "readings");
+	for (int i = 0; i < BATCH_RECORDS; i++) {
+		if (batch[i].pin == TELEMETRY_ZONE_AGGREGATE) {
+			continue;
+		}
+		json_begin_object(&json, NULL);
+		json_uint(&json, "pin", batch[i].pin);
+		json_uint(&json, "zone", batch[i].zone);
+		json_int(&json, "status", batch[i].status);
+		if (batch[i].status == DHTLIB_OK) {
+			json_tenths(&json, "relative_humidity", batch[i].humidityTenths);
+			json_tenths(&json, "temperature", batch[i].temperatureTenths);
+		}
+		json_end_object(&json);
+	}
+	json_end_array(&json);
+	json_begin_array(&json, "zones");
+	for (int i = 0; i < BATCH_RECORDS; i++) {
+		if (batch[i].pin == TELEMETRY_ZONE_AGGREGATE && batch[i].status == DHTLIB_OK) {
+			json_begin_object(&json, NULL);
+			json_uint(&json, "zone", batch[i].zone);
+			json_tenths(&json, "relative_humidity", batch[i].humidityTenths);
+			json_tenths(&json, "temperature", batch[i].temperatureTenths);
+			json_end_object(&json);
+		}
+	}
+	json_end_array(&json);
+	return json_end(&json) ? strlen(body) : 0;
+}
+
+#if HAVE_CJSON
+static void _addTenths(cJSON *object, const char *key, int16_t tenths) {
+	char measurement[JSON_TENTHS_SIZE + 1];
+	snprintf(measurement, sizeof(measurement), "%.1f", tenths / 10.0f);
+	cJSON_AddItemToObject(object, key, cJSON_CreateRaw(measurement));
+}
+
+/*
+ * The same batch as a cJSON tree, printed into the body and freed.
+ */
+static size_t _printBatch(char *body, size_t size) {
+	cJSON *root = cJSON_CreateObject();
+	cJSON *readings = cJSON_CreateArray();
+	cJSON *zones = cJSON_CreateArray();
+
+	cJSON_AddItemToObject(root, "timestamp", cJSON_CreateString(timestamp));
+	cJSON_AddItemToObject(root, "readings", readings);
+	cJSON_AddItemToObject(root, "zones", zones);
+	for (int i = 0; i < BATCH_RECORDS; i++) {
+		cJSON *entry = cJSON_CreateObject();
+		if (batch[i].pin == TELEMETRY_ZONE_AGGREGATE) {
+			cJSON_AddItemToArray(zones, entry);
+		} else {
+			cJSON_AddItemToArray(readings, entry);
+			cJSON_AddItemToObject(entry, "pin", cJSON_CreateNumber(batch[i].pin));
+		}
+		cJSON_AddItemToObject(entry, "zone", cJSON_CreateNumber(batch[i].zone));
+		if (batch[i].pin != TELEMETRY_ZONE_AGGREGATE) {
+			cJSON_AddItemToObject(entry, "status", cJSON_CreateNumber(batch[i].status));
+		}
+		if (batch[i].status == DHTLIB_OK) {
+			_addTenths(entry, "relative_humidity", batch[i].humidityTenths);
+			_addTenths(entry, "temperature", batch[i].temperatureTenths);
+		}
+	}
+	bool printed = cJSON_PrintPreallocated(root, body, size, false);
+	cJSON_Delete(root);
+	return printed ? strlen(body) : 0;
+}
+#endif
+
+/*
+ * Writes the batch BENCHMARK_MESSAGES times and logs the throughput and allocations; returns the
+ * allocations per message.
+ */
+static int _benchmark(const char *name, size_t (*write)(char *body, size_t size)) {
+	static char body[BODY_SIZE];
+	size_t length = 0;
+
+	allocations = 0;
+	counting = true;
+	int64_t started = _hostNanos();
+	for (int message = 0; message < BENCHMARK_MESSAGES; message++) {
+		length = write(body, sizeof(body));
+	}
+	int64_t nanos = _hostNanos() - started;
+	counting = false;
+
+	CHECK(strcmp(expected, body) == 0);
+	CHECK_EQ(strlen(expected), length);
+	printf("%s: %u byte message, %.1f bytes/us and %d allocations per message on the host\n", name,
+			(unsigned) length, (double) length * BENCHMARK_MESSAGES * 1000 / nanos, allocations / BENCHMARK_MESSAGES);
+	return allocations / BENCHMARK_MESSAGES;
+}
+
+static void benchmarkBatch() {
+	CHECK_EQ(0, _benchmark("json_writer", _writeBatch));
+#if HAVE_CJSON
+	CHECK(_benchmark("cJSON", _printBatch) > 0);
+#else
+	printf("cJSON wasn't found on the host, so only json_writer was measured\n");
+#endif
+}
+
+int main() {
+	RUN_TEST(benchmarkBatch);
+	return TEST_RESULT();
+}
@@ -0,0 +1,105 @@
+/*
+ * Cycle time against sensor count on the host: sample_readings() over tables of 1 to SENSORS_MAX
+ * simulated sensors. Up to DHTLIB_MAX_PARALLEL sensors are read together, so on the virtual clock a
+ * cycle takes as long as one sensor's read per group of them, which is checked; the host time per
+ * cycle is just logged.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "nvs.h"
+#include "reading_queue.h"
+#include "sampling.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "test.h"
+
+#define BENCHMARK_CYCLES 5
+
+static const uint8_t pins[SENSORS_MAX] = { 2, 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26 };
+static const size_t sensorCounts[] = { 1, 2, 4, 8, 9, 12, 16 };
+
+static DhtSimSensor simulated[SENSORS_MAX];
+
+static int64_t _hostNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// The first 'count' pins, all in zone 0
+static void _useSensors(size_t count) {
+	char table[SENSORS_MAX * 4];
+	size_t length = 0;
+	nvs_handle handle;
+
+	for (size_t i = 0; i < count; i++) {
+		length += sprintf(&table[length], "%s%d", i > 0 ? " " : "", pins[i]);
+	}
+	CHECK_EQ(ESP_OK, nvs_open("sensors", NVS_READWRITE, &handle));
+	CHECK_EQ(ESP_OK, nvs_set_str(handle, "table", table));
+	nvs_commit(handle);
+	nvs_close(handle);
+	CHECK_EQ(ESP_OK, sensors_init());
+	CHECK_EQ(count, sensors_count());
+	sensor_health_init();
+}
+
+// One sampling period on, then a sample; returns how long it took on the virtual clock
+static int64_t _cycle() {
+	TelemetryRecord records[SENSORS_MAX + SENSOR_ZONES_MAX];
+
+	host_advance(5000 * 1000);
+	int64_t started = host_micros();
+	sample_readings();
+	int64_t elapsed = host_micros() - started;
+	while (reading_queue_pop(records, SENSORS_MAX + SENSOR_ZONES_MAX) > 0) {
+	}
+	return elapsed;
+}
+
+static void benchmarkCycleTime() {
+	int64_t oneSensorMicros = 0;
+
+	for (size_t i = 0; i < sizeof(sensorCounts) / sizeof(sensorCounts[0]); i++) {
+		size_t count = sensorCounts[i];
+		size_t groups = (count + DHTLIB_MAX_PARALLEL - 1) / DHTLIB_MAX_PARALLEL;
+		uint32_t frames = 0;
+
+		_useSensors(count);
+		int64_t cycleMicros = _cycle();
+		if (count == 1) {
+			oneSensorMicros = cycleMicros;
+		}
+
+		int64_t started = _hostNanos();
+		for (int cycle = 0; cycle < BENCHMARK_CYCLES; cycle++) {
+			CHECK_EQ(cycleMicros, _cycle());
+		}
+		int64_t hostNanos = _hostNanos() - started;
+		for (size_t sensor = 0; sensor < count; sensor++) {
+			frames += simulated[sensor].frames;
+			simulated[sensor].frames = 0;
+		}
+
+		CHECK_EQ(count * (BENCHMARK_CYCLES + 1), frames);
+		CHECK_EQ(groups * oneSensorMicros, cycleMicros);
+		printf("%2u sensors: %lld us per cycle on the virtual clock, %lld us on the host\n", (unsigned) count,
+				(long long) cycleMicros, (long long) (hostNanos / BENCHMARK_CYCLES / 1000));
+	}
+}
+
+int main() {
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, sampling_init());
+	// All with the same reading, so every frame takes as long
+	for (int i = 0; i < SENSORS_MAX; i++) {
+		dht_sim_init(&simulated[i], pins[i], 450, 215);
+	}
+
+	RUN_TEST(benchmarkCycleTime);
+	return TEST_RESULT();
+}
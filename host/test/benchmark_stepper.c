@@ -0,0 +1,141 @@
+/*
+ * Step rate and jitter of every stepping mode on the host, the benchmark_stepper() of the host build,
+ * and the cost of a half-step written a pin at a time or from the mask table.
+ * The jitter is measured on the virtual clock, so it's exact and checked; the host time per step only
+ * says how the tick's cost moves between builds and is just logged.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "common.h"
+#include "host.h"
+#include "stepper.h"
+#include "stepper_sink.h"
+#include "test.h"
+
+#define BENCHMARK_STEPS 6000
+#define BENCHMARK_ROUNDS 1000
+
+static const char *modeNames[] = { "wave", "full step", "half step", "microstep" };
+// One rate that divides a second evenly and one that doesn't
+static const uint32_t rates[] = { 2000, 3000 };
+
+static int64_t _hostNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Every step lands on a whole µs next to its exact time, so no interval is more than a µs off the
+ * ideal one and the errors don't add up over the move.
+ */
+static void _benchmarkMode(Stepper *motor, StepMode mode, uint32_t rate) {
+	static StepperSink sink;
+	StepperConfig config = { .pins = { 16, 17, 18, 19 }, .mode = mode, .stepsPerRevolution = 200, .rpm = 60 };
+	Motion move = { .steps = BENCHMARK_STEPS, .direction = STEPPER_FORWARD, .maxStepsPerSecond = rate };
+
+	stepper_sink_attach(&sink, config.pins, mode == STEP_MICRO ? 0 : -1);
+	CHECK_EQ(ESP_OK, set_up(motor, &config));
+	stepper_sink_clear(&sink);
+	int64_t started = _hostNanos();
+	CHECK_EQ(ESP_OK, start_motion(motor, &move, NULL, NULL));
+	host_advance((uint64_t) BENCHMARK_STEPS * 1000000 / rate + 1000);
+	int64_t elapsed = _hostNanos() - started;
+	CHECK(!in_motion(motor));
+	CHECK(!sink.overflow);
+
+	// The tick that starts the move, then one state per step
+	CHECK_EQ(BENCHMARK_STEPS + 1, sink.count);
+	int64_t ideal = 1000000 / rate;
+	int64_t shortest = INT64_MAX, longest = 0;
+	for (uint32_t i = 2; i < sink.count; i++) {
+		int64_t interval = sink.states[i].micros - sink.states[i - 1].micros;
+		shortest = interval < shortest ? interval : shortest;
+		longest = interval > longest ? interval : longest;
+	}
+	CHECK(shortest >= ideal - 1 && longest <= ideal + 1);
+	// Intervals are kept in 1/256 µs, so the rate itself is that much off
+	int64_t moveMicros = sink.states[sink.count - 1].micros - sink.states[1].micros;
+	int64_t exactMicros = (int64_t) (BENCHMARK_STEPS - 1) * ((1000000 << 8) / rate) >> 8;
+	CHECK(moveMicros >= exactMicros - 1 && moveMicros <= exactMicros + 1);
+
+	printf("%s at %u steps/s: %lld ns per step on the host (%lld steps/s), intervals %lld to %lld us\n",
+			modeNames[mode], rate, (long long) (elapsed / BENCHMARK_STEPS),
+			(long long) (elapsed > 0 ? BENCHMARK_STEPS * 1000000000LL / elapsed : 0), (long long) shortest,
+			(long long) longest);
+	stepper_sink_detach_all();
+}
+
+static void benchmarkStepRateAndJitter() {
+	static Stepper motor;
+	for (int mode = STEP_WAVE; mode <= STEP_MICRO; mode++) {
+		for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+			_benchmarkMode(&motor, mode, rates[i]);
+		}
+	}
+}
+
+static int pinWrites;
+
+static void _countWrite(uint8_t pin, bool output, uint8_t level, void *arg) {
+	pinWrites++;
+}
+
+/*
+ * _benchmarkHalfStep() on the host: the old way of stepping, a digitalWrite() per coil, against the
+ * motor's mask table. The table has to give the half-step sequence in one port write a step where the
+ * old way took four; the host time per step of each is logged.
+ */
+static void benchmarkHalfStep() {
+	static Stepper motor;
+	static StepperSink sink;
+	// Coils are energised by LOW, so bit N of each step is coil N idle
+	static const uint8_t sequence[8] = { 0xe, 0xc, 0xd, 0x9, 0xb, 0x3, 0x7, 0x6 };
+	StepperConfig config = { .pins = { 16, 17, 18, 19 }, .mode = STEP_HALF, .stepsPerRevolution = 200, .rpm = 60 };
+
+	stepper_sink_attach(&sink, config.pins, -1);
+	CHECK_EQ(ESP_OK, set_up(&motor, &config));
+	for (int coil = 0; coil < 4; coil++) {
+		host_listen_pin(config.pins[coil], _countWrite, NULL);
+	}
+
+	pinWrites = 0;
+	int64_t started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		for (int step = 0; step < 8; step++) {
+			for (int coil = 0; coil < 4; coil++) {
+				digitalWrite(config.pins[coil], (sequence[step] >> coil) & 1);
+			}
+		}
+	}
+	int64_t perPinNanos = _hostNanos() - started;
+	CHECK_EQ(BENCHMARK_ROUNDS * 8 * 4, pinWrites);
+
+	stepper_sink_clear(&sink);
+	started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		for (int step = 0; step < 8; step++) {
+			writePort(&motor.stepMasks[step]);
+		}
+	}
+	int64_t maskNanos = _hostNanos() - started;
+	CHECK_EQ(BENCHMARK_ROUNDS * 8, sink.writes);
+	CHECK(!sink.overflow);
+	for (uint32_t i = 0; i < sink.count; i++) {
+		CHECK_EQ(sequence[i % 8], sink.states[i].coils);
+	}
+
+	printf("Half-step: %lld ns with digitalWrite per coil, %lld ns with the mask table on the host\n",
+			(long long) (perPinNanos / (BENCHMARK_ROUNDS * 8)), (long long) (maskNanos / (BENCHMARK_ROUNDS * 8)));
+	for (int coil = 0; coil < 4; coil++) {
+		host_listen_pin(config.pins[coil], NULL, NULL);
+	}
+	stepper_sink_detach_all();
+}
+
+int main() {
+	RUN_TEST(benchmarkStepRateAndJitter);
+	RUN_TEST(benchmarkHalfStep);
+	return TEST_RESULT();
+}
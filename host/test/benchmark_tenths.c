@@ -0,0 +1,59 @@
+/*
+ * Nanoseconds per value on the host, the benchmark_tenths() of the host build: snprintf("%.1f") of
+ * the float against json_format_tenths() over every int16_t. Both have to write the same text, which
+ * is checked; the host times are just logged.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "json_writer.h"
+#include "test.h"
+
+#define BENCHMARK_PASSES 10
+
+// Keeps the timed loops from being optimised away
+static volatile size_t sink;
+
+static int64_t _hostNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void benchmarkFormat() {
+	char expected[16];
+	char text[JSON_TENTHS_SIZE];
+	int mismatches = 0;
+
+	for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+		snprintf(expected, sizeof(expected), "%.1f", tenths / 10.0f);
+		json_format_tenths(tenths, text);
+		mismatches += strcmp(expected, text) != 0;
+	}
+	CHECK_EQ(0, mismatches);
+
+	int64_t started = _hostNanos();
+	for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+		for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+			sink = snprintf(expected, sizeof(expected), "%.1f", tenths / 10.0f);
+		}
+	}
+	int64_t floatNanos = _hostNanos() - started;
+
+	started = _hostNanos();
+	for (int pass = 0; pass < BENCHMARK_PASSES; pass++) {
+		for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+			sink = json_format_tenths(tenths, text);
+		}
+	}
+	int64_t tenthsNanos = _hostNanos() - started;
+
+	printf("Tenths: %lld ns each with snprintf of a float, %lld ns with json_format_tenths on the host\n",
+			(long long) (floatNanos / (BENCHMARK_PASSES * 65536)), (long long) (tenthsNanos / (BENCHMARK_PASSES * 65536)));
+}
+
+int main() {
+	RUN_TEST(benchmarkFormat);
+	return TEST_RESULT();
+}
@@ -0,0 +1,106 @@
+/*
+ * Nanoseconds per timestamp on the host, the benchmark_timestamps() of the host build: the old way
+ * (the system clock, localtime_r() and strftime() every time) against timestamp_now() plus
+ * timestamp_format(). Both ways have to write the same text over a sweep that crosses minutes, days
+ * and a daylight saving change, which is checked; the host times are just logged.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "host.h"
+#include "test.h"
+#include "timestamp.h"
+
+#define BENCHMARK_ROUNDS 200000
+// 2019-03-09T12:00:00Z, the day before daylight saving time starts
+#define SWEEP_START_MILLIS 1552132800000LL
+// Several stamps a minute, as a few sensors sampled every 5 s make
+#define SWEEP_STEP_MILLIS 1250
+
+static int64_t _hostNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static size_t _formatOldWay(time_t seconds, char *text, size_t size) {
+	struct tm fields;
+	localtime_r(&seconds, &fields);
+	return strftime(text, size, "%FT%T%Z", &fields);
+}
+
+/*
+ * Formatting alone, over the sweep.
+ */
+static void benchmarkFormat() {
+	static char oldText[TIMESTAMP_TEXT_SIZE];
+	static char newText[TIMESTAMP_TEXT_SIZE];
+	TimestampFormatter formatter = { 0 };
+	int mismatches = 0;
+
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		int64_t epochMillis = SWEEP_START_MILLIS + (int64_t) i * SWEEP_STEP_MILLIS;
+		_formatOldWay(epochMillis / 1000, oldText, sizeof(oldText));
+		timestamp_format(&formatter, epochMillis, newText, sizeof(newText));
+		mismatches += strcmp(oldText, newText) != 0;
+	}
+	CHECK_EQ(0, mismatches);
+
+	int64_t started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		_formatOldWay((SWEEP_START_MILLIS + (int64_t) i * SWEEP_STEP_MILLIS) / 1000, oldText, sizeof(oldText));
+	}
+	int64_t oldNanos = _hostNanos() - started;
+
+	memset(&formatter, 0, sizeof(formatter));
+	started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		timestamp_format(&formatter, SWEEP_START_MILLIS + (int64_t) i * SWEEP_STEP_MILLIS, newText, sizeof(newText));
+	}
+	int64_t newNanos = _hostNanos() - started;
+
+	printf("Formatting: %lld ns each with localtime_r/strftime, %lld ns with the minute cache on the host\n",
+			(long long) (oldNanos / BENCHMARK_ROUNDS), (long long) (newNanos / BENCHMARK_ROUNDS));
+}
+
+/*
+ * Stamping and formatting the current time, as a publish does.
+ */
+static void benchmarkStamp() {
+	char text[TIMESTAMP_TEXT_SIZE];
+	TimestampFormatter formatter = { 0 };
+	struct timeval now;
+
+	int64_t started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		gettimeofday(&now, NULL);
+		_formatOldWay(now.tv_sec, text, sizeof(text));
+	}
+	int64_t oldNanos = _hostNanos() - started;
+
+	started = _hostNanos();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		timestamp_format(&formatter, timestamp_now(), text, sizeof(text));
+	}
+	int64_t newNanos = _hostNanos() - started;
+
+	_formatOldWay(now.tv_sec, text, sizeof(text));
+	char newText[TIMESTAMP_TEXT_SIZE];
+	timestamp_format(&formatter, timestamp_now(), newText, sizeof(newText));
+	CHECK(strcmp(text, newText) == 0);
+
+	printf("Timestamps: %lld ns each with localtime_r/strftime, %lld ns with the cached offset and formatter on the host\n",
+			(long long) (oldNanos / BENCHMARK_ROUNDS), (long long) (newNanos / BENCHMARK_ROUNDS));
+}
+
+int main() {
+	host_set_epoch(SWEEP_START_MILLIS);
+	timestamp_init();
+	CHECK(timestamp_synced());
+
+	RUN_TEST(benchmarkFormat);
+	RUN_TEST(benchmarkStamp);
+	return TEST_RESULT();
+}
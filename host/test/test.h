@@ -0,0 +1,39 @@
+#ifndef test_h
+#define test_h
+
+/*
+ * Just enough of a harness for the host tests: each test file is its own program, CHECKs count their
+ * failures instead of stopping, and main() returns TEST_RESULT() for ctest.
+ */
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(expected, actual) do { \
+		long long expectedValue = (expected); \
+		long long actualValue = (actual); \
+		if (expectedValue != actualValue) { \
+			fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n", __FILE__, __LINE__, #actual, expectedValue, \
+					actualValue); \
+			testFailures++; \
+		} \
+	} while (0)
+
+#define RUN_TEST(test) do { \
+		fprintf(stderr, "-- %s\n", #test); \
+		test(); \
+	} while (0)
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,149 @@
+/*
+ * Nothing on the sampling and publishing path touches the heap once start-up is over. The test
+ * replaces glibc's allocator entry points, so a call from anywhere in the process is counted: the
+ * firmware, the simulated board or the C library on their behalf.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dht.h"
+#include "dht_sim.h"
+#include "esp_log.h"
+#include "host.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "publish.h"
+#include "reading_buffer.h"
+#include "sampling.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "test.h"
+
+#define CYCLES 100
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+static volatile bool counting;
+static volatile int allocations;
+
+void *malloc(size_t size) {
+	allocations += counting;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	allocations += counting;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+	allocations += counting;
+	return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) {
+	__libc_free(pointer);
+}
+
+static DhtSimSensor simulated[SENSORS_MAX];
+static int asyncReadings;
+static int spills;
+
+static void _countReading(uint8_t pin, Reading reading, void *arg) {
+	asyncReadings++;
+}
+
+/*
+ * One sampling period the way power_save.c runs it: sample (read, calibrate, smooth, queue), then
+ * publish into the store-and-forward buffer while the broker is away, and every so often catch up.
+ */
+static void _cycle(int cycle) {
+	static char text[2048];
+	size_t count = sensors_count();
+
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	// Every few cycles a sensor goes quiet for long enough to be quarantined, and the others swing
+	// enough to get past the filter's deadband
+	for (size_t i = 0; i < count; i++) {
+		simulated[i].silent = i == 1 && (cycle / 8) % 2;
+		simulated[i].humidityTenths = 450 + (cycle % 2) * 40;
+	}
+	sample_readings();
+
+	// A cache hit calls back straight away, and a read half a period later goes to the wire
+	getReadingAsync(sensors_pins()[0], DHTLIB_MIN_INTERVAL_MS, _countReading, NULL);
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	readPinAsync(sensors_pins()[2], _countReading, NULL);
+	host_advance(20 * 1000);
+
+	// The broker is away for a while, so the buffer spills, then it all goes out
+	publish_queued();
+	if (reading_buffer_stats().spilled > 0) {
+		spills++;
+	}
+	if (cycle % 40 == 39) {
+		host_mqtt_connect(true);
+		while (reading_buffer_stats().buffered > 0) {
+			publish_queued();
+			host_mqtt_ack_all();
+			host_mqtt_clear();
+		}
+		host_mqtt_connect(false);
+	}
+
+	JsonWriter json;
+	json_begin(&json, text, sizeof(text));
+	json_begin_array(&json, "readings");
+	for (size_t i = 0; i < count; i++) {
+		json_begin_object(&json, NULL);
+		json_uint(&json, "pin", sensors_get(i)->pin);
+		json_tenths(&json, "temperature", simulated[i].temperatureTenths);
+		json_end_object(&json);
+	}
+	json_end_array(&json);
+	sensor_health_write(&json);
+	metrics_write(&json);
+	CHECK(json_end(&json));
+}
+
+static void testSteadyStateDoesNotAllocate() {
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, sensors_init());
+	sensor_health_init();
+	reading_buffer_init();
+	CHECK_EQ(ESP_OK, initAsyncReads());
+	publish_start();
+	esp_log_level_set("sampling", ESP_LOG_WARN);
+	for (size_t i = 0; i < sensors_count(); i++) {
+		dht_sim_init(&simulated[i], sensors_get(i)->pin, 450 + i, 215 - i);
+	}
+	// Start-up is allowed whatever it needs, including the first log line of each kind and the time
+	// zone the first timestamp loads
+	_cycle(0);
+	host_mqtt_connect(true);
+	publish_queued();
+	host_mqtt_ack_all();
+	host_mqtt_clear();
+	host_mqtt_connect(false);
+
+	counting = true;
+	for (int cycle = 1; cycle <= CYCLES; cycle++) {
+		_cycle(cycle);
+	}
+	counting = false;
+
+	CHECK_EQ(0, allocations);
+	// Make sure the quiet paths weren't all that ran
+	CHECK(spills > 0);
+	CHECK_EQ(0, reading_buffer_stats().dropped);
+	CHECK(sensor_health_get(1)->quarantines > 0);
+	CHECK(asyncReadings >= 2 * CYCLES);
+}
+
+int main() {
+	RUN_TEST(testSteadyStateDoesNotAllocate);
+	return TEST_RESULT();
+}
@@ -0,0 +1,182 @@
+/*
+ * The DHT driver against simulated DHT22s.
+ */
+
+#include <string.h>
+#include "common.h"
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "test.h"
+
+#define SENSORS 10
+
+static const uint8_t pins[SENSORS] = { 26, 27, 25, 33, 32, 4, 5, 13, 14, 15 };
+static DhtSimSensor sensors[SENSORS];
+
+// Far enough on that every pin may be read again
+static void _nextCycle() {
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+}
+
+static void _checkReading(const DhtSimSensor *sensor, Reading reading) {
+	CHECK_EQ(DHTLIB_OK, reading.status);
+	CHECK_EQ(sensor->humidityTenths, reading.humidityTenths);
+	CHECK_EQ(sensor->temperatureTenths, reading.temperatureTenths);
+}
+
+/*
+ * Four sensors with their own values and timing are read in one pass, in about the time one takes.
+ */
+static void testParallelRead() {
+	Reading readings[4];
+	sensors[1].responseMicros = 20;
+	sensors[2].responseMicros = 40;
+	sensors[3].zeroMicros = 22;
+	sensors[3].oneMicros = 75;
+
+	_nextCycle();
+	int64_t started = host_micros();
+	readPins(pins, readings, 4);
+	int64_t elapsed = host_micros() - started;
+	for (int i = 0; i < 4; i++) {
+		_checkReading(&sensors[i], readings[i]);
+	}
+	// The wake pulse plus one frame of a bit over 5ms
+	CHECK(elapsed < DHTLIB_DHT_WAKEUP * 1000 + DHTLIB_FRAME_TIMEOUT_US);
+}
+
+/*
+ * More pins than DHTLIB_MAX_PARALLEL go in batches, and every reading lands in its own slot.
+ */
+static void testMoreThanMaxParallel() {
+	Reading readings[SENSORS];
+	memset(readings, 0, sizeof(readings));
+
+	_nextCycle();
+	readPins(pins, readings, SENSORS);
+	for (int i = 0; i < SENSORS; i++) {
+		_checkReading(&sensors[i], readings[i]);
+	}
+}
+
+/*
+ * A sensor that doesn't answer, one that stops partway and one with a bad checksum fail on their own;
+ * the sensors read alongside them are unaffected.
+ */
+static void testFailuresStayPerPin() {
+	Reading readings[4];
+	sensors[0].silent = true;
+	sensors[1].stopAfterBits = 20;
+	sensors[2].badChecksum = true;
+
+	_nextCycle();
+	readPins(pins, readings, 4);
+	CHECK_EQ(DHTLIB_ERROR_TIMEOUT, readings[0].status);
+	CHECK_EQ(DHTLIB_ERROR_TIMEOUT, readings[1].status);
+	CHECK_EQ(DHTLIB_ERROR_CHECKSUM, readings[2].status);
+	_checkReading(&sensors[3], readings[3]);
+
+	sensors[0].silent = false;
+	sensors[1].stopAfterBits = -1;
+	sensors[2].badChecksum = false;
+}
+
+/*
+ * The single-pin path decodes the same frames.
+ */
+static void testReadPin() {
+	_nextCycle();
+	for (int i = 0; i < 4; i++) {
+		_checkReading(&sensors[i], readPin(pins[i]));
+	}
+}
+
+/*
+ * Every data bit's high pulse lands in the histogram, 0s and 1s in the buckets their widths fall in.
+ */
+static void testPulseHistogram() {
+	uint16_t histogram[DHTLIB_HISTOGRAM_BUCKETS];
+	uint8_t bits[5];
+	Reading reading;
+	int ones = 0;
+
+	dht_sim_encode(sensors[4].humidityTenths, sensors[4].temperatureTenths, bits);
+	for (int i = 0; i < 40; i++) {
+		ones += (bits[i / 8] >> (i % 8)) & 1;
+	}
+	sensors[4].zeroMicros = 33;
+	sensors[4].oneMicros = 52;
+	resetPulseHistogram(pins[4]);
+
+	_nextCycle();
+	readPins(&pins[4], &reading, 1);
+	_checkReading(&sensors[4], reading);
+	getPulseHistogram(pins[4], histogram);
+	CHECK_EQ(40 - ones, histogram[33 / DHTLIB_HISTOGRAM_BUCKET_US]);
+	CHECK_EQ(ones, histogram[52 / DHTLIB_HISTOGRAM_BUCKET_US]);
+
+	// The blocking path records into the same histogram
+	_nextCycle();
+	_checkReading(&sensors[4], readPin(pins[4]));
+	getPulseHistogram(pins[4], histogram);
+	CHECK_EQ(2 * (40 - ones), histogram[33 / DHTLIB_HISTOGRAM_BUCKET_US]);
+	CHECK_EQ(2 * ones, histogram[52 / DHTLIB_HISTOGRAM_BUCKET_US]);
+
+	resetPulseHistogram(pins[4]);
+	getPulseHistogram(pins[4], histogram);
+	for (int i = 0; i < DHTLIB_HISTOGRAM_BUCKETS; i++) {
+		CHECK_EQ(0, histogram[i]);
+	}
+	sensors[4].zeroMicros = 27;
+	sensors[4].oneMicros = 70;
+}
+
+/*
+ * Timeouts are measured in time, not in loop passes, so they last as long whatever a pin read costs;
+ * the frames still decode from a CPU a tenth as fast.
+ */
+static void testTimeoutsIgnoreReadCost() {
+	const uint32_t readCosts[] = { 25, 250, 2500 };
+	Reading reading;
+
+	for (int i = 0; i < 3; i++) {
+		host_set_read_cost(readCosts[i]);
+
+		_nextCycle();
+		_checkReading(&sensors[0], readPin(pins[0]));
+		_nextCycle();
+		readPins(&pins[1], &reading, 1);
+		_checkReading(&sensors[1], reading);
+
+		sensors[0].silent = true;
+		_nextCycle();
+		int64_t started = host_micros();
+		CHECK_EQ(DHTLIB_ERROR_TIMEOUT, readPin(pins[0]).status);
+		int64_t elapsed = host_micros() - started - DHTLIB_DHT_WAKEUP * 1000 - 40;
+		CHECK(elapsed > DHTLIB_TIMEOUT_US && elapsed <= DHTLIB_TIMEOUT_US + 10);
+
+		_nextCycle();
+		started = host_micros();
+		readPins(&pins[0], &reading, 1);
+		CHECK_EQ(DHTLIB_ERROR_TIMEOUT, reading.status);
+		elapsed = host_micros() - started - DHTLIB_DHT_WAKEUP * 1000;
+		CHECK(elapsed > DHTLIB_EDGE_TIMEOUT_US && elapsed <= DHTLIB_EDGE_TIMEOUT_US + 10);
+		sensors[0].silent = false;
+	}
+	host_set_read_cost(250);
+}
+
+int main() {
+	for (int i = 0; i < SENSORS; i++) {
+		dht_sim_init(&sensors[i], pins[i], 400 + 37 * i, -200 + 61 * i);
+	}
+
+	RUN_TEST(testParallelRead);
+	RUN_TEST(testMoreThanMaxParallel);
+	RUN_TEST(testFailuresStayPerPin);
+	RUN_TEST(testReadPin);
+	RUN_TEST(testPulseHistogram);
+	RUN_TEST(testTimeoutsIgnoreReadCost);
+	return TEST_RESULT();
+}
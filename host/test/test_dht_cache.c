@@ -0,0 +1,159 @@
+/*
+ * The DHT reading cache and the two-second guard on the wire, blocking and asynchronous.
+ */
+
+#include "common.h"
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "test.h"
+
+static DhtSimSensor sensors[3];
+static const uint8_t pins[3] = { 26, 27, 25 };
+
+static void _checkReading(const DhtSimSensor *sensor, Reading reading) {
+	CHECK_EQ(DHTLIB_OK, reading.status);
+	CHECK_EQ(sensor->humidityTenths, reading.humidityTenths);
+	CHECK_EQ(sensor->temperatureTenths, reading.temperatureTenths);
+}
+
+static void _checkStats(DhtCacheStats before, uint32_t hits, uint32_t misses, uint32_t refused) {
+	DhtCacheStats stats = getCacheStats();
+	CHECK_EQ(before.hits + hits, stats.hits);
+	CHECK_EQ(before.misses + misses, stats.misses);
+	CHECK_EQ(before.refused + refused, stats.refused);
+}
+
+/*
+ * A reading is served from the cache up to and including 'maxAgeMillis' old; past that the wire is
+ * only used again once DHTLIB_MIN_INTERVAL_MS has gone by.
+ */
+static void testGetReading() {
+	DhtCacheStats before = getCacheStats();
+	_checkReading(&sensors[0], getReading(pins[0], 500));
+	CHECK_EQ(1, sensors[0].frames);
+	_checkStats(before, 0, 1, 0);
+
+	// The read itself takes a few ms, so the reading is a little younger than the wire claim
+	host_advance(500 * 1000);
+	before = getCacheStats();
+	_checkReading(&sensors[0], getReading(pins[0], 500));
+	CHECK_EQ(1, sensors[0].frames);
+	_checkStats(before, 1, 0, 0);
+
+	host_advance(20 * 1000);
+	before = getCacheStats();
+	CHECK_EQ(DHTLIB_ERROR_TOO_SOON, getReading(pins[0], 500).status);
+	_checkStats(before, 0, 1, 1);
+
+	// A long enough maxAge still gets the old reading
+	_checkReading(&sensors[0], getReading(pins[0], 60 * 1000));
+
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000 - 520 * 1000);
+	before = getCacheStats();
+	_checkReading(&sensors[0], getReading(pins[0], 500));
+	CHECK_EQ(2, sensors[0].frames);
+	_checkStats(before, 0, 1, 0);
+}
+
+/*
+ * readPin() never looks at the cache and refuses a second read inside DHTLIB_MIN_INTERVAL_MS, to the ms.
+ */
+static void testMinimumInterval() {
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	// readPin() claims the wire before the 10ms wake pulse
+	int64_t claimed = millis64();
+	_checkReading(&sensors[1], readPin(pins[1]));
+
+	host_advance((claimed + DHTLIB_MIN_INTERVAL_MS - 1) * 1000 - micros64() + 500);
+	DhtCacheStats before = getCacheStats();
+	CHECK_EQ(DHTLIB_ERROR_TOO_SOON, readPin(pins[1]).status);
+	_checkStats(before, 0, 0, 1);
+	host_advance(1000);
+	_checkReading(&sensors[1], readPin(pins[1]));
+}
+
+/*
+ * A failed read leaves nothing in the cache to be served later.
+ */
+static void testFailuresArentCached() {
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	sensors[2].silent = true;
+	CHECK_EQ(DHTLIB_ERROR_TIMEOUT, getReading(pins[2], 60 * 1000).status);
+	sensors[2].silent = false;
+	host_advance(100 * 1000);
+	CHECK_EQ(DHTLIB_ERROR_TOO_SOON, getReading(pins[2], 60 * 1000).status);
+}
+
+/*
+ * getReadings() only puts the pins it has nothing recent for on the wire.
+ */
+static void testGetReadings() {
+	Reading readings[3];
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	_checkReading(&sensors[1], readPin(pins[1]));
+	int frames[3] = { sensors[0].frames, sensors[1].frames, sensors[2].frames };
+
+	host_advance(200 * 1000);
+	DhtCacheStats before = getCacheStats();
+	getReadings(pins, readings, 3, 1000);
+	for (int i = 0; i < 3; i++) {
+		_checkReading(&sensors[i], readings[i]);
+		CHECK_EQ(frames[i] + (i != 1), sensors[i].frames);
+	}
+	_checkStats(before, 1, 2, 0);
+}
+
+static int callbacks;
+static Reading callbackReading;
+
+static void _keepReading(uint8_t pin, Reading reading, void *arg) {
+	callbacks++;
+	callbackReading = reading;
+	CHECK_EQ(pins[0], pin);
+	CHECK(arg == &callbacks);
+}
+
+/*
+ * A cache hit calls back before getReadingAsync() returns; a miss reads the pin in the background and
+ * fills the cache for the next caller.
+ */
+static void testGetReadingAsync() {
+	host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+	callbacks = 0;
+	CHECK_EQ(ESP_OK, getReadingAsync(pins[0], 10, _keepReading, &callbacks));
+	CHECK_EQ(0, callbacks);
+	// Nobody may start another read of the pin while this one is going
+	CHECK_EQ(ESP_ERR_INVALID_STATE, readPinAsync(pins[0], _keepReading, &callbacks));
+	host_advance(20 * 1000);
+	CHECK_EQ(1, callbacks);
+	_checkReading(&sensors[0], callbackReading);
+
+	int frames = sensors[0].frames;
+	DhtCacheStats before = getCacheStats();
+	CHECK_EQ(ESP_OK, getReadingAsync(pins[0], 1000, _keepReading, &callbacks));
+	CHECK_EQ(2, callbacks);
+	_checkReading(&sensors[0], callbackReading);
+	CHECK_EQ(frames, sensors[0].frames);
+	_checkStats(before, 1, 0, 0);
+
+	// Too soon for the wire, and nothing young enough cached
+	host_advance(100 * 1000);
+	CHECK_EQ(ESP_ERR_INVALID_STATE, getReadingAsync(pins[0], 10, _keepReading, &callbacks));
+	host_advance(100 * 1000);
+	CHECK_EQ(2, callbacks);
+}
+
+int main() {
+	for (int i = 0; i < 3; i++) {
+		dht_sim_init(&sensors[i], pins[i], 301 + i, 199 - i);
+	}
+	CHECK_EQ(ESP_OK, initAsyncReads());
+
+	RUN_TEST(testGetReading);
+	RUN_TEST(testMinimumInterval);
+	RUN_TEST(testFailuresArentCached);
+	RUN_TEST(testGetReadings);
+	RUN_TEST(testGetReadingAsync);
+	return TEST_RESULT();
+}
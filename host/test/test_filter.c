@@ -0,0 +1,165 @@
+/*
+ * Smoothing and change-driven reporting over scripted series of readings, one every sampling period,
+ * with the host build's window of 3, 50% EWMA, deadbands of 0.5% and 0.2° and 300 s heartbeat.
+ */
+
+#include <string.h>
+#include "dht.h"
+#include "filter.h"
+#include "test.h"
+
+#define PERIOD_MILLIS 5000
+
+static TelemetryRecord _reading(int64_t millis, int16_t humidity, int16_t temperature) {
+	TelemetryRecord record = { .epochMillis = millis, .humidityTenths = humidity, .temperatureTenths = temperature,
+			.pin = 26, .status = DHTLIB_OK };
+	return record;
+}
+
+/*
+ * A single reading far off the rest never makes it past the median, and the filter starts at the
+ * first reading rather than ramping up to it.
+ */
+static void testMedianRejectsSpike() {
+	static const int16_t temperatures[] = { 200, 200, 300, 200, 200, -150, 200 };
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+
+	for (size_t i = 0; i < sizeof(temperatures) / sizeof(temperatures[0]); i++) {
+		TelemetryRecord record = _reading(i * PERIOD_MILLIS, 550 + (i == 4 ? 400 : 0), temperatures[i]);
+		filter_smooth(&filter, &record);
+		CHECK_EQ(550, record.humidityTenths);
+		CHECK_EQ(200, record.temperatureTenths);
+	}
+}
+
+/*
+ * A step gets through the median on its second reading, then the average closes half the remaining
+ * gap each period, rounding to the nearest tenth.
+ */
+static void testEwmaFollowsStep() {
+	static const int16_t expected[] = { 200, 200, 200, 200, 250, 275, 288, 294, 297, 298, 299, 300 };
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+
+	for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+		TelemetryRecord record = _reading(i * PERIOD_MILLIS, 500, i < 3 ? 200 : 300);
+		filter_smooth(&filter, &record);
+		CHECK_EQ(expected[i], record.temperatureTenths);
+	}
+}
+
+/*
+ * Failed readings pass through untouched and leave the window and average as they were.
+ */
+static void testFailuresLeftAlone() {
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+	TelemetryRecord record = _reading(0, 500, 200);
+	filter_smooth(&filter, &record);
+
+	TelemetryRecord failed = { .epochMillis = PERIOD_MILLIS, .humidityTenths = DHTLIB_INVALID_VALUE,
+			.temperatureTenths = DHTLIB_INVALID_VALUE, .status = DHTLIB_ERROR_TIMEOUT };
+	filter_smooth(&filter, &failed);
+	CHECK_EQ(DHTLIB_INVALID_VALUE, failed.humidityTenths);
+	CHECK_EQ(DHTLIB_INVALID_VALUE, failed.temperatureTenths);
+	CHECK_EQ(1, filter.windowCount);
+
+	record = _reading(2 * PERIOD_MILLIS, 500, 200);
+	filter_smooth(&filter, &record);
+	CHECK_EQ(200, record.temperatureTenths);
+}
+
+/*
+ * Only a move of the whole deadband from the last report (not from the last reading) is reported, so
+ * a slow drift is too once it adds up; a change of status always is.
+ */
+static void testDeadband() {
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+	int64_t millis = 0;
+
+	CHECK(filter_should_report(&filter, &(TelemetryRecord) { .humidityTenths = 500, .temperatureTenths = 200 }));
+	TelemetryRecord record = _reading(millis += PERIOD_MILLIS, 504, 201);
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 496, 199);
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 500, 202);
+	CHECK(filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 500, 203);
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 505, 203);
+	CHECK(filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 501, 202);
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 500, 200);
+	CHECK(filter_should_report(&filter, &record));
+
+	// A failure is news once, whatever values it carries, and so is the recovery
+	record.status = DHTLIB_ERROR_TIMEOUT;
+	record.epochMillis = millis += PERIOD_MILLIS;
+	CHECK(filter_should_report(&filter, &record));
+	record.humidityTenths = record.temperatureTenths = DHTLIB_INVALID_VALUE;
+	record.epochMillis = millis += PERIOD_MILLIS;
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(millis += PERIOD_MILLIS, 500, 200);
+	CHECK(filter_should_report(&filter, &record));
+	CHECK_EQ(11, filter.samples);
+	CHECK_EQ(6, filter.reports);
+}
+
+/*
+ * An unchanging sensor is reported again once a heartbeat has gone by since its last report, going
+ * by the records' timestamps.
+ */
+static void testHeartbeat() {
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+	int64_t heartbeat = CONFIG_FILTER_HEARTBEAT_SEC * 1000;
+
+	for (int64_t millis = 0; millis <= 2 * heartbeat; millis += PERIOD_MILLIS) {
+		TelemetryRecord record = _reading(millis, 500, 200);
+		CHECK_EQ(millis % heartbeat == 0, filter_should_report(&filter, &record));
+	}
+	// A report for a change starts the heartbeat over
+	TelemetryRecord record = _reading(2 * heartbeat + 1000, 520, 200);
+	CHECK(filter_should_report(&filter, &record));
+	record = _reading(3 * heartbeat, 520, 200);
+	CHECK(!filter_should_report(&filter, &record));
+	record = _reading(3 * heartbeat + 1000, 520, 200);
+	CHECK(filter_should_report(&filter, &record));
+}
+
+/*
+ * An hour of a quiet incubator, with a tenth of noise, a couple of spikes and a failed read, goes out
+ * as the heartbeats plus the failure and the recovery, about one sample in fifty.
+ */
+static void testReportedFraction() {
+	SensorFilter filter;
+	memset(&filter, 0, sizeof(filter));
+	int samples = 3600 * 1000 / PERIOD_MILLIS;
+
+	for (int i = 0; i < samples; i++) {
+		TelemetryRecord record = _reading((int64_t) i * PERIOD_MILLIS, 500 + 2 * (i % 2), 200 + (i / 3) % 2);
+		if (i == 100 || i == 400) {
+			record.temperatureTenths = 350;
+		}
+		if (i == 250) {
+			record.status = DHTLIB_ERROR_CHECKSUM;
+		}
+		filter_smooth(&filter, &record);
+		filter_should_report(&filter, &record);
+	}
+	CHECK_EQ(samples, filter.samples);
+	CHECK_EQ(3600 / CONFIG_FILTER_HEARTBEAT_SEC + 2, filter.reports);
+}
+
+int main() {
+	RUN_TEST(testMedianRejectsSpike);
+	RUN_TEST(testEwmaFollowsStep);
+	RUN_TEST(testFailuresLeftAlone);
+	RUN_TEST(testDeadband);
+	RUN_TEST(testHeartbeat);
+	RUN_TEST(testReportedFraction);
+	return TEST_RESULT();
+}
@@ -0,0 +1,283 @@
+/*
+ * The simulated board itself: virtual time, timers, scripted pins and interrupts, the DHT22 waveform,
+ * the stepper sink and NVS.
+ */
+
+#include <string.h>
+#include "common.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "nvs.h"
+#include "stepper_sink.h"
+#include "test.h"
+
+static int fired;
+static int64_t firedMicros[8];
+
+static void _countFiring(void *arg) {
+	if (fired < 8) {
+		firedMicros[fired] = host_micros();
+	}
+	fired++;
+}
+
+static void testClock() {
+	int64_t start = micros64();
+	delay(3);
+	CHECK_EQ(start + 3000, micros64());
+	delayMicroseconds(250);
+	CHECK_EQ(start + 3250, micros64());
+	CHECK_EQ(micros64() / 1000, millis());
+
+	uint32_t cycles = cycleCount();
+	host_advance(10);
+	CHECK_EQ(2400, cycleCount() - cycles);
+}
+
+static void testTimers() {
+	Timer once, periodic;
+	CHECK_EQ(ESP_OK, createTimer(&once, _countFiring, NULL, "once"));
+	CHECK_EQ(ESP_OK, createTimer(&periodic, _countFiring, NULL, "periodic"));
+
+	fired = 0;
+	int64_t start = host_micros();
+	CHECK_EQ(ESP_OK, startTimer(once, 500));
+	CHECK_EQ(ESP_ERR_INVALID_STATE, startTimer(once, 500));
+	host_advance(499);
+	CHECK_EQ(0, fired);
+	host_advance(1);
+	CHECK_EQ(1, fired);
+	CHECK_EQ(start + 500, firedMicros[0]);
+	CHECK_EQ(ESP_ERR_INVALID_STATE, stopTimer(once));
+
+	fired = 0;
+	start = host_micros();
+	CHECK_EQ(ESP_OK, startPeriodicTimer(periodic, 1000));
+	host_advance(3500);
+	CHECK_EQ(3, fired);
+	CHECK_EQ(start + 3000, firedMicros[2]);
+	CHECK_EQ(ESP_OK, stopTimer(periodic));
+	host_advance(5000);
+	CHECK_EQ(3, fired);
+
+	// A critical section holds the timer back, like a masked interrupt
+	fired = 0;
+	start = host_micros();
+	startTimer(once, 100);
+	host_enter_critical();
+	delayMicroseconds(300);
+	CHECK_EQ(0, fired);
+	host_exit_critical();
+	CHECK_EQ(1, fired);
+	CHECK_EQ(start + 300, firedMicros[0]);
+}
+
+static void testScriptedPin() {
+	int64_t now = host_micros();
+	HostEdge edges[] = { { now + 10, LOW }, { now + 30, HIGH }, { now + 45, LOW } };
+
+	host_set_read_cost(0);
+	host_script_pin(4, edges, 3);
+	pinModeInput(4);
+	CHECK_EQ(HIGH, digitalRead(4));
+	host_advance(10);
+	CHECK_EQ(LOW, digitalRead(4));
+	CHECK_EQ(0, (readInputs() >> 4) & 1);
+	host_advance(20);
+	CHECK_EQ(HIGH, digitalRead(4));
+	host_advance(100);
+	CHECK_EQ(LOW, digitalRead(4));
+
+	// An output reads what it drives, whatever the script says
+	pinModeOutput(4);
+	digitalWrite(4, HIGH);
+	CHECK_EQ(HIGH, digitalRead(4));
+	pinModeInput(4);
+	host_set_read_cost(250);
+}
+
+static void testInterrupts() {
+	int64_t now = host_micros();
+	HostEdge edges[] = { { now + 5, HIGH }, { now + 10, LOW }, { now + 20, LOW }, { now + 40, HIGH } };
+
+	pinModeInput(13);
+	host_script_pin(13, edges, 4);
+	fired = 0;
+	attachInterrupt(13, _countFiring, NULL);
+	host_advance(100);
+	// The first "edge" doesn't change the level (the pull-up has it HIGH already), nor does the third
+	CHECK_EQ(2, fired);
+	CHECK_EQ(now + 10, firedMicros[0]);
+	CHECK_EQ(now + 40, firedMicros[1]);
+	detachInterrupt(13);
+}
+
+static uint32_t intervals[] = { 100, 50, 0 };
+static int intervalCalls;
+
+static uint32_t _nextInterval(void *arg) {
+	firedMicros[intervalCalls] = host_micros();
+	return intervals[intervalCalls++];
+}
+
+static void testIntervalTimer() {
+	intervalCalls = 0;
+	initIntervalTimer(_nextInterval, NULL);
+	int64_t start = host_micros();
+	startIntervalTimer(20);
+	host_advance(1000);
+	CHECK_EQ(3, intervalCalls);
+	CHECK_EQ(start + 20, firedMicros[0]);
+	CHECK_EQ(start + 120, firedMicros[1]);
+	CHECK_EQ(start + 170, firedMicros[2]);
+	CHECK_EQ(50, intervalTimerLast());
+}
+
+static uint32_t _slowInterval(void *arg) {
+	firedMicros[intervalCalls++] = host_micros();
+	delayMicroseconds(30);
+	return intervalCalls < 3 ? 5 : 0;
+}
+
+/*
+ * A callback that asks for less than it ran plus the minimum gets the minimum past where it ended,
+ * as in common.c, and intervalTimerLast() says how long that made the interval.
+ */
+static void testIntervalTimerClamp() {
+	intervalCalls = 0;
+	initIntervalTimer(_slowInterval, NULL);
+	int64_t start = host_micros();
+	startIntervalTimer(20);
+	CHECK_EQ(20, intervalTimerLast());
+	host_advance(1000);
+	CHECK_EQ(3, intervalCalls);
+	CHECK_EQ(start + 20, firedMicros[0]);
+	CHECK_EQ(start + 60, firedMicros[1]);
+	CHECK_EQ(start + 100, firedMicros[2]);
+	CHECK_EQ(40, intervalTimerLast());
+}
+
+/*
+ * Follows the line from the release and decodes the frame from the widths of its high pulses.
+ */
+static void _sampleFrame(uint8_t pin, uint8_t bits[5], int *pulses) {
+	uint8_t level = HIGH;
+	int64_t rise = 0;
+	*pulses = 0;
+	memset(bits, 0, 5);
+	for (int us = 0; us < 6000; us++) {
+		host_advance(1);
+		uint8_t now = digitalRead(pin);
+		if (now == level) {
+			continue;
+		}
+		level = now;
+		if (level == HIGH) {
+			rise = host_micros();
+			continue;
+		}
+		// The first high pulse is the acknowledgement
+		if (rise > 0 && (*pulses)++ > 0 && *pulses <= 41) {
+			int bit = *pulses - 2;
+			if (host_micros() - rise > 40) {
+				bits[bit / 8] |= 128 >> (bit % 8);
+			}
+		}
+	}
+}
+
+static void _wake(uint8_t pin, uint32_t lowMicros) {
+	pinModeOutput(pin);
+	digitalWrite(pin, LOW);
+	delayMicroseconds(lowMicros);
+	digitalWrite(pin, HIGH);
+	pinModeInput(pin);
+}
+
+static void testDhtWaveform() {
+	static DhtSimSensor sensor;
+	uint8_t expected[5], bits[5];
+	int pulses;
+
+	host_set_read_cost(0);
+	dht_sim_init(&sensor, 26, 655, -123);
+	dht_sim_encode(655, -123, expected);
+	CHECK_EQ(0x80, expected[2] & 0x80);
+
+	_wake(26, 1000);
+	CHECK_EQ(1, sensor.frames);
+	_sampleFrame(26, bits, &pulses);
+	CHECK_EQ(41, pulses);
+	CHECK(memcmp(expected, bits, 5) == 0);
+
+	// Too short a wake pulse isn't answered
+	_wake(26, 500);
+	CHECK_EQ(1, sensor.frames);
+
+	sensor.stopAfterBits = 8;
+	_wake(26, 1000);
+	_sampleFrame(26, bits, &pulses);
+	CHECK_EQ(9, pulses);
+
+	sensor.stopAfterBits = -1;
+	sensor.silent = true;
+	_wake(26, 1000);
+	_sampleFrame(26, bits, &pulses);
+	CHECK_EQ(0, pulses);
+	host_set_read_cost(250);
+}
+
+static void testStepperSink() {
+	static StepperSink sink;
+	const uint8_t pins[4] = { 17, 5, 18, 33 };
+	stepper_sink_attach(&sink, pins, -1);
+
+	PortMasks masks = { .setLow = PIN_MASK_LOW(17) | PIN_MASK_LOW(18), .setHigh = PIN_MASK_HIGH(33) };
+	writePort(&masks);
+	host_advance(100);
+	writePort(&masks);
+	PortMasks other = { .clearLow = PIN_MASK_LOW(17) | PIN_MASK_LOW(2) };
+	writePort(&other);
+
+	CHECK_EQ(3, sink.writes);
+	CHECK_EQ(2, sink.count);
+	CHECK_EQ(0xd, sink.states[0].coils);
+	CHECK_EQ(0xc, sink.states[1].coils);
+	CHECK_EQ(sink.states[0].micros + 100, sink.states[1].micros);
+	stepper_sink_detach_all();
+}
+
+static void testNvs() {
+	nvs_handle handle;
+	uint8_t blob[3] = { 1, 2, 3 }, back[8];
+	size_t length = sizeof(back);
+
+	CHECK_EQ(ESP_ERR_NVS_NOT_FOUND, nvs_open("test", NVS_READONLY, &handle));
+	CHECK_EQ(ESP_OK, nvs_open("test", NVS_READWRITE, &handle));
+	CHECK_EQ(ESP_OK, nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+	CHECK_EQ(ESP_ERR_NVS_NOT_FOUND, nvs_get_str(handle, "blob", (char *) back, &length));
+	CHECK_EQ(ESP_OK, nvs_get_blob(handle, "blob", back, &length));
+	CHECK_EQ(3, length);
+	CHECK(memcmp(blob, back, 3) == 0);
+
+	host_nvs_fail_writes(true);
+	CHECK(nvs_set_blob(handle, "other", blob, sizeof(blob)) != ESP_OK);
+	host_nvs_fail_writes(false);
+	nvs_close(handle);
+
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_ERR_NVS_NOT_FOUND, nvs_open("test", NVS_READONLY, &handle));
+}
+
+int main() {
+	RUN_TEST(testClock);
+	RUN_TEST(testTimers);
+	RUN_TEST(testScriptedPin);
+	RUN_TEST(testInterrupts);
+	RUN_TEST(testIntervalTimer);
+	RUN_TEST(testIntervalTimerClamp);
+	RUN_TEST(testDhtWaveform);
+	RUN_TEST(testStepperSink);
+	RUN_TEST(testNvs);
+	return TEST_RESULT();
+}
@@ -0,0 +1,62 @@
+/*
+ * The streaming JSON writer.
+ */
+
+#include <string.h>
+#include "json_writer.h"
+#include "test.h"
+
+static const char *expectedDocument = "{\"name\":\"a \\\"b\\\" \\\\ c\\u000a\",\"int\":-2147483648,"
+		"\"uint\":4294967295,\"tenths\":-0.5,\"ok\":true,\"list\":[1,{\"x\":false},[]],\"empty\":{}}";
+
+static bool _writeDocument(char *buffer, size_t size) {
+	JsonWriter json;
+	json_begin(&json, buffer, size);
+	json_string(&json, "name", "a \"b\" \\ c\n");
+	json_int(&json, "int", INT32_MIN);
+	json_uint(&json, "uint", UINT32_MAX);
+	json_tenths(&json, "tenths", -5);
+	json_bool(&json, "ok", true);
+	json_begin_array(&json, "list");
+	json_int(&json, NULL, 1);
+	json_begin_object(&json, NULL);
+	json_bool(&json, "x", false);
+	json_end_object(&json);
+	json_begin_array(&json, NULL);
+	json_end_array(&json);
+	json_end_array(&json);
+	json_begin_object(&json, "empty");
+	json_end_object(&json);
+	return json_end(&json);
+}
+
+static void testDocument() {
+	char buffer[256];
+	CHECK(_writeDocument(buffer, sizeof(buffer)));
+	CHECK(strcmp(expectedDocument, buffer) == 0);
+}
+
+/*
+ * Every buffer too small for the document gets a terminated prefix of it and a failed json_end();
+ * one byte more than the text is enough.
+ */
+static void testOverflow() {
+	char buffer[256];
+	size_t length = strlen(expectedDocument);
+
+	for (size_t size = 1; size <= length; size++) {
+		memset(buffer, 'Z', sizeof(buffer));
+		CHECK(!_writeDocument(buffer, size));
+		CHECK_EQ(size - 1, strlen(buffer));
+		CHECK(strncmp(expectedDocument, buffer, size - 1) == 0);
+		CHECK_EQ('Z', buffer[size]);
+	}
+	CHECK(_writeDocument(buffer, length + 1));
+	CHECK(strcmp(expectedDocument, buffer) == 0);
+}
+
+int main() {
+	RUN_TEST(testDocument);
+	RUN_TEST(testOverflow);
+	return TEST_RESULT();
+}
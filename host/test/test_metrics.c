@@ -0,0 +1,118 @@
+/*
+ * The metrics' log-linear histograms: which bucket a value lands in and the percentiles read back.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+#include "test.h"
+
+typedef struct SpanFigures {
+	unsigned count;
+	unsigned min;
+	unsigned p50;
+	unsigned p99;
+	unsigned max;
+} SpanFigures;
+
+/*
+ * Writes the metrics document (which starts the spans over) and reads back one span's figures.
+ */
+static SpanFigures _figures(const char *span) {
+	static char buffer[1024];
+	char key[32];
+	SpanFigures figures = { 0 };
+	JsonWriter json;
+
+	json_begin(&json, buffer, sizeof(buffer));
+	metrics_write(&json);
+	CHECK(json_end(&json));
+	snprintf(key, sizeof(key), "\"%s\":[", span);
+	const char *found = strstr(buffer, key);
+	CHECK(found != NULL);
+	if (found != NULL) {
+		CHECK_EQ(5, sscanf(found + strlen(key), "%u,%u,%u,%u,%u", &figures.count, &figures.min, &figures.p50,
+				&figures.p99, &figures.max));
+	}
+	return figures;
+}
+
+/*
+ * Values up to 7 have buckets of their own, so small spans come back exact; p99 of a couple of
+ * samples is the larger one.
+ */
+static void testSmallValuesExact() {
+	metrics_record(METRIC_STEP, 10);
+	metrics_record(METRIC_STEP, 20);
+	metrics_record(METRIC_DHT_WAKE, 5);
+	metrics_record(METRIC_DHT_WAKE, 6);
+	metrics_record(METRIC_DHT_WAKE, 7);
+
+	SpanFigures figures = _figures("step_cycles");
+	CHECK_EQ(2, figures.count);
+	CHECK_EQ(10, figures.min);
+	CHECK_EQ(10, figures.p50);
+	CHECK_EQ(20, figures.p99);
+	CHECK_EQ(20, figures.max);
+	// The document started every span over, not just the one read
+	figures = _figures("dht_wake_us");
+	CHECK_EQ(0, figures.count);
+}
+
+/*
+ * A percentile is the lowest value of its bucket, which is never more than 25% under the sample.
+ */
+static void testPercentileWithinBucket() {
+	for (uint32_t value = 2; value < (1u << 25); value = value * 3 / 2 + 1) {
+		metrics_record(METRIC_PUBLISH, 1);
+		metrics_record(METRIC_PUBLISH, value);
+		metrics_record(METRIC_PUBLISH, UINT32_MAX);
+		SpanFigures figures = _figures("publish_us");
+		CHECK_EQ(3, figures.count);
+		CHECK(figures.p50 <= value && 4ULL * value < 5ULL * figures.p50);
+	}
+}
+
+/*
+ * 1 to 100 once each: the median and p99 come back as the bottoms of the buckets 50 and 99 fall in.
+ */
+static void testPercentiles() {
+	for (uint32_t value = 1; value <= 100; value++) {
+		metrics_record(METRIC_SERIALIZE, value);
+	}
+	SpanFigures figures = _figures("serialize_us");
+	CHECK_EQ(100, figures.count);
+	CHECK_EQ(1, figures.min);
+	CHECK_EQ(48, figures.p50);
+	CHECK_EQ(96, figures.p99);
+	CHECK_EQ(100, figures.max);
+}
+
+/*
+ * A percentile never comes out below the smallest sample or above the largest. The last bucket holds
+ * everything from 2^25 up, so only min and max tell its samples apart.
+ */
+static void testPercentilesClamped() {
+	for (int i = 0; i < 3; i++) {
+		metrics_record(METRIC_SAMPLE, 1000);
+	}
+	SpanFigures figures = _figures("sample_us");
+	CHECK_EQ(1000, figures.p50);
+	CHECK_EQ(1000, figures.p99);
+
+	metrics_record(METRIC_SAMPLE, 1u << 26);
+	metrics_record(METRIC_SAMPLE, UINT32_MAX);
+	figures = _figures("sample_us");
+	CHECK_EQ(1u << 26, figures.min);
+	CHECK_EQ(1u << 26, figures.p50);
+	CHECK_EQ(1u << 26, figures.p99);
+	CHECK_EQ(UINT32_MAX, figures.max);
+}
+
+int main() {
+	RUN_TEST(testSmallValuesExact);
+	RUN_TEST(testPercentileWithinBucket);
+	RUN_TEST(testPercentiles);
+	RUN_TEST(testPercentilesClamped);
+	return TEST_RESULT();
+}
@@ -0,0 +1,109 @@
+/*
+ * The sampling and publishing stages together, from the simulated sensors to the MQTT client.
+ */
+
+#include <string.h>
+#include "dht_sim.h"
+#include "host.h"
+#include "publish.h"
+#include "reading_buffer.h"
+#include "sampling.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "test.h"
+#include "timestamp.h"
+
+#define SENSORS 4
+
+// 2019-05-04T12:34:56Z
+#define EPOCH_MILLIS 1556973296000LL
+
+static DhtSimSensor simulated[SENSORS];
+
+// One sampling period on, as the firmware samples
+static void _nextCycle() {
+	host_advance(5000 * 1000);
+}
+
+static void _checkMessage(size_t index, const char *topic, const char *body) {
+	const HostMqttMessage *message = host_mqtt_message(index);
+	CHECK(message != NULL);
+	if (message != NULL) {
+		CHECK(strcmp(topic, message->topic) == 0);
+		CHECK(strcmp(body, message->body) == 0);
+		CHECK(!message->retained);
+	}
+}
+
+/*
+ * Each reading, and the zone's average, goes out as a humidity and a temperature message stamped with
+ * local time. They stay unacknowledged until the broker's PUBACKs come in.
+ */
+static void testPublishesEachReading() {
+	_nextCycle();
+	CHECK_EQ(SENSORS + 1, sample_readings());
+	publish_queued();
+
+	CHECK_EQ(2 * (SENSORS + 1), host_mqtt_count());
+	_checkMessage(0, "humidity/26", "{\"timestamp\":\"2019-05-04T08:35:01EDT\",\"relative_humidity\":\"45.0\"}");
+	_checkMessage(1, "temperature/26", "{\"timestamp\":\"2019-05-04T08:35:01EDT\",\"temperature\":\"21.5\"}");
+	_checkMessage(7, "temperature/33", "{\"timestamp\":\"2019-05-04T08:35:01EDT\",\"temperature\":\"21.5\"}");
+	_checkMessage(8, "humidity/zone/0", "{\"timestamp\":\"2019-05-04T08:35:01EDT\",\"relative_humidity\":\"46.5\"}");
+	_checkMessage(9, "temperature/zone/0", "{\"timestamp\":\"2019-05-04T08:35:01EDT\",\"temperature\":\"21.5\"}");
+	CHECK_EQ(0, reading_buffer_stats().buffered);
+
+	CHECK_EQ(2 * (SENSORS + 1), publish_unacked());
+	host_mqtt_ack_all();
+	CHECK_EQ(0, publish_unacked());
+	host_mqtt_clear();
+}
+
+/*
+ * While the broker is away readings wait in the store-and-forward buffer, and go out oldest first
+ * once it's back.
+ */
+static void testBuffersWhileDisconnected() {
+	host_mqtt_connect(false);
+	CHECK(!publish_connected());
+	for (int i = 0; i < SENSORS; i++) {
+		simulated[i].temperatureTenths = 250;
+	}
+	// The median filter holds the first sample of a step back
+	int queued = 0;
+	for (int cycle = 0; cycle < 2; cycle++) {
+		_nextCycle();
+		queued += sample_readings();
+		publish_queued();
+	}
+	CHECK(queued > 0);
+	CHECK_EQ(0, host_mqtt_count());
+	CHECK_EQ(queued, reading_buffer_stats().buffered);
+
+	host_mqtt_connect(true);
+	CHECK(publish_connected());
+	publish_queued();
+	CHECK_EQ(0, reading_buffer_stats().buffered);
+	CHECK_EQ(2 * queued, host_mqtt_count());
+	CHECK(strcmp("humidity/26", host_mqtt_message(0)->topic) == 0);
+	host_mqtt_ack_all();
+	host_mqtt_clear();
+}
+
+int main() {
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, sensors_init());
+	sensor_health_init();
+	reading_buffer_init();
+	CHECK_EQ(ESP_OK, sampling_init());
+	for (int i = 0; i < SENSORS; i++) {
+		dht_sim_init(&simulated[i], sensors_get(i)->pin, 450 + 10 * i, 215);
+	}
+	host_set_epoch(EPOCH_MILLIS);
+	timestamp_init();
+	publish_start();
+	host_mqtt_connect(true);
+
+	RUN_TEST(testPublishesEachReading);
+	RUN_TEST(testBuffersWhileDisconnected);
+	return TEST_RESULT();
+}
@@ -0,0 +1,208 @@
+/*
+ * Batched publishing (CONFIG_PUBLISH_MODE_BATCHED), as JSON or CBOR: how publish_records() splits
+ * records into messages on the "readings" topic, and what it does with a batch that doesn't fit.
+ */
+
+#include <string.h>
+#include "host.h"
+#include "publish.h"
+#include "sensors.h"
+#include "telemetry.h"
+#include "test.h"
+#include "timestamp.h"
+
+// 2019-05-04T12:34:56Z
+#define EPOCH_MILLIS 1556973296000LL
+#define SAMPLING_PERIOD_MILLIS 5000
+
+static TelemetryRecord records[3 * CONFIG_BATCH_MAX_READINGS + SENSOR_ZONES_MAX];
+
+static int _reading(int index, int64_t epochMillis, int16_t humidityTenths, int16_t temperatureTenths) {
+	records[index] = (TelemetryRecord) {
+		.epochMillis = epochMillis,
+		.humidityTenths = humidityTenths,
+		.temperatureTenths = temperatureTenths,
+		.pin = 26 + index % 8,
+		.zone = 0,
+		.status = 0
+	};
+	return index + 1;
+}
+
+static int _aggregate(int index, int64_t epochMillis, uint8_t zone) {
+	_reading(index, epochMillis, 450, 215);
+	records[index].pin = TELEMETRY_ZONE_AGGREGATE;
+	records[index].zone = zone;
+	return index + 1;
+}
+
+#if !CONFIG_PAYLOAD_FORMAT_CBOR
+static int _occurrences(const char *text, const char *pattern) {
+	int found = 0;
+	for (const char *at = strstr(text, pattern); at != NULL; at = strstr(at + 1, pattern)) {
+		found++;
+	}
+	return found;
+}
+#endif
+
+/*
+ * Checks that message 'index' went out on the "readings" topic holding 'readings' sensor readings and
+ * 'zones' zone aggregates.
+ */
+static void _checkBatch(size_t index, int readings, int zones) {
+	const HostMqttMessage *message = host_mqtt_message(index);
+	CHECK(message != NULL);
+	if (message == NULL) {
+		return;
+	}
+	CHECK(strcmp("readings", message->topic) == 0);
+	CHECK(!message->retained);
+
+#if CONFIG_PAYLOAD_FORMAT_CBOR
+	TelemetryRecord decoded[CONFIG_BATCH_MAX_READINGS + SENSOR_ZONES_MAX];
+	size_t count = 0;
+	CHECK(telemetry_decode_batch((const uint8_t *) message->body, message->length, decoded,
+			CONFIG_BATCH_MAX_READINGS + SENSOR_ZONES_MAX, &count));
+	int aggregates = 0;
+	for (size_t i = 0; i < count; i++) {
+		aggregates += decoded[i].pin == TELEMETRY_ZONE_AGGREGATE;
+	}
+	CHECK_EQ(readings, count - aggregates);
+	CHECK_EQ(zones, aggregates);
+#else
+	CHECK_EQ(readings, _occurrences(message->body, "\"pin\""));
+	CHECK_EQ(zones, _occurrences(message->body, "\"zone\"") - readings);
+#endif
+}
+
+static void _done() {
+	host_mqtt_ack_all();
+	host_mqtt_clear();
+}
+
+/*
+ * A full cycle splits into batches of CONFIG_BATCH_MAX_READINGS readings, and the zone aggregates
+ * ride along in slots of their own rather than taking a reading's.
+ */
+static void testSplitsAtReadingCap() {
+	int count = 0;
+	for (int i = 0; i < 2 * CONFIG_BATCH_MAX_READINGS + 1; i++) {
+		count = _reading(count, EPOCH_MILLIS, 450, 215);
+	}
+	count = _aggregate(count, EPOCH_MILLIS, 0);
+	count = _aggregate(count, EPOCH_MILLIS, 1);
+
+	CHECK_EQ(count, publish_records(records, count));
+	CHECK_EQ(3, host_mqtt_count());
+	_checkBatch(0, CONFIG_BATCH_MAX_READINGS, 0);
+	_checkBatch(1, CONFIG_BATCH_MAX_READINGS, 0);
+	_checkBatch(2, 1, 2);
+	_done();
+}
+
+/*
+ * A batch that's full of readings still takes every zone's aggregate, and only a zone past
+ * SENSOR_ZONES_MAX starts another one.
+ */
+static void testZoneSlotsOnTopOfReadings() {
+	int count = 0;
+	for (int i = 0; i < CONFIG_BATCH_MAX_READINGS; i++) {
+		count = _reading(count, EPOCH_MILLIS, 450, 215);
+	}
+	for (int zone = 0; zone <= SENSOR_ZONES_MAX; zone++) {
+		count = _aggregate(count, EPOCH_MILLIS, zone % SENSOR_ZONES_MAX);
+	}
+
+	CHECK_EQ(count, publish_records(records, count));
+	CHECK_EQ(2, host_mqtt_count());
+	_checkBatch(0, CONFIG_BATCH_MAX_READINGS, SENSOR_ZONES_MAX);
+	_checkBatch(1, 0, 1);
+	_done();
+}
+
+/*
+ * A JSON batch has a single timestamp, so records from the next sampling cycle start a new message;
+ * a CBOR record carries its own, so a batch can span cycles.
+ */
+static void testCycleBoundary() {
+	int count = 0;
+	count = _reading(count, EPOCH_MILLIS, 450, 215);
+	count = _aggregate(count, EPOCH_MILLIS, 0);
+	count = _reading(count, EPOCH_MILLIS + SAMPLING_PERIOD_MILLIS, 451, 216);
+	count = _aggregate(count, EPOCH_MILLIS + SAMPLING_PERIOD_MILLIS, 0);
+
+	CHECK_EQ(count, publish_records(records, count));
+#if CONFIG_PAYLOAD_FORMAT_CBOR
+	CHECK_EQ(1, host_mqtt_count());
+	_checkBatch(0, 2, 2);
+#else
+	CHECK_EQ(2, host_mqtt_count());
+	_checkBatch(0, 1, 1);
+	_checkBatch(1, 1, 1);
+	CHECK(strstr(host_mqtt_message(0)->body, "\"2019-05-04T08:34:56EDT\"") != NULL);
+	CHECK(strstr(host_mqtt_message(1)->body, "\"2019-05-04T08:35:01EDT\"") != NULL);
+#endif
+	_done();
+}
+
+/*
+ * With the broker away nothing is published, and the batch stays with the caller.
+ */
+static void testStopsWhenRefused() {
+	int count = 0;
+	for (int i = 0; i < CONFIG_BATCH_MAX_READINGS + 1; i++) {
+		count = _reading(count, EPOCH_MILLIS, 450, 215);
+	}
+
+	host_mqtt_connect(false);
+	CHECK_EQ(0, publish_records(records, count));
+	CHECK_EQ(0, host_mqtt_count());
+	host_mqtt_connect(true);
+}
+
+#if !CONFIG_PAYLOAD_FORMAT_CBOR
+/*
+ * MQTT_BODY_SIZE only has room for what the sensor table can produce, so a full batch of records
+ * wider than that (three-digit pins and zones, values at the ends of a tenth's range) doesn't fit.
+ * It's dropped, counts as handled so the store-and-forward buffer moves past it, and the next batch
+ * goes out as usual. (A CBOR batch is a fraction of the body size, so it can't get here.)
+ */
+static void testDropsOversizedBatch() {
+	int count = 0;
+	for (int i = 0; i < CONFIG_BATCH_MAX_READINGS; i++) {
+		count = _reading(count, EPOCH_MILLIS, INT16_MIN, INT16_MIN);
+		records[count - 1].pin = 200 + i;
+		records[count - 1].zone = 200;
+	}
+	for (int zone = 0; zone < SENSOR_ZONES_MAX; zone++) {
+		count = _aggregate(count, EPOCH_MILLIS, 200 + zone);
+		records[count - 1].humidityTenths = INT16_MIN;
+		records[count - 1].temperatureTenths = INT16_MIN;
+	}
+	count = _reading(count, EPOCH_MILLIS + SAMPLING_PERIOD_MILLIS, 450, 215);
+
+	CHECK_EQ(count, publish_records(records, count));
+	CHECK_EQ(1, host_mqtt_count());
+	_checkBatch(0, 1, 0);
+	CHECK(strstr(host_mqtt_message(0)->body, "\"2019-05-04T08:35:01EDT\"") != NULL);
+	_done();
+}
+#endif
+
+int main() {
+	host_set_epoch(EPOCH_MILLIS);
+	timestamp_init();
+	publish_start();
+	host_mqtt_connect(true);
+
+	RUN_TEST(testSplitsAtReadingCap);
+	RUN_TEST(testZoneSlotsOnTopOfReadings);
+	RUN_TEST(testCycleBoundary);
+	RUN_TEST(testStopsWhenRefused);
+#if !CONFIG_PAYLOAD_FORMAT_CBOR
+	RUN_TEST(testDropsOversizedBatch);
+#endif
+	CHECK_EQ(0, publish_unacked());
+	return TEST_RESULT();
+}
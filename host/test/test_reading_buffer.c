@@ -0,0 +1,187 @@
+/*
+ * The store-and-forward buffer, built with a ring of 8 so that it fills quickly. With
+ * CONFIG_STORE_AND_FORWARD_NVS_SPILL it spills chunks of 4 to at most 2 NVS blobs; without, it drops.
+ */
+
+#include <string.h>
+#include "host.h"
+#include "nvs.h"
+#include "reading_buffer.h"
+#include "test.h"
+
+#define CAPACITY CONFIG_STORE_AND_FORWARD_CAPACITY
+
+// Records are told apart by their sequence number, kept in epochMillis
+static int64_t sequence;
+
+static void _append(int count) {
+	for (int i = 0; i < count; i++) {
+		TelemetryRecord record = { .epochMillis = ++sequence, .pin = 26 };
+		reading_buffer_append(&record);
+	}
+}
+
+/*
+ * Takes everything out, a few records at a time, checking that it comes out oldest first and ends
+ * with the newest record. Returns how many there were.
+ */
+static int _drain() {
+	TelemetryRecord records[3];
+	int64_t previous = 0;
+	int drained = 0;
+	size_t count;
+
+	while ((count = reading_buffer_peek(records, 3)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			CHECK(records[i].epochMillis > previous);
+			previous = records[i].epochMillis;
+		}
+		reading_buffer_consume(count);
+		drained += count;
+	}
+	CHECK_EQ(sequence, previous);
+	return drained;
+}
+
+static void _checkPeek(int64_t first, size_t expected) {
+	TelemetryRecord records[CAPACITY];
+	size_t count = reading_buffer_peek(records, CAPACITY);
+	CHECK_EQ(expected, count);
+	for (size_t i = 0; i < count; i++) {
+		CHECK_EQ(first + i, records[i].epochMillis);
+	}
+}
+
+static void testWrap() {
+	reading_buffer_init();
+	CHECK_EQ(CAPACITY, reading_buffer_stats().capacity);
+
+	// Go round the ring a few times without ever filling it
+	for (int i = 0; i < 5; i++) {
+		_append(CAPACITY - 1);
+		CHECK_EQ(CAPACITY - 1, reading_buffer_stats().buffered);
+		_checkPeek(sequence - CAPACITY + 2, CAPACITY - 1);
+		reading_buffer_consume(2);
+		_checkPeek(sequence - CAPACITY + 4, CAPACITY - 3);
+		CHECK_EQ(CAPACITY - 3, _drain());
+	}
+	CHECK_EQ(0, reading_buffer_stats().buffered);
+	CHECK_EQ(0, reading_buffer_stats().dropped);
+}
+
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+
+static bool _spillExists(uint32_t chunk) {
+	nvs_handle handle;
+	char key[16];
+	uint8_t blob[CAPACITY / 2 * sizeof(TelemetryRecord)];
+	size_t length = sizeof(blob);
+
+	snprintf(key, sizeof(key), "spill%u", chunk);
+	if (nvs_open("readings", NVS_READONLY, &handle) != ESP_OK) {
+		return false;
+	}
+	bool exists = nvs_get_blob(handle, key, blob, &length) == ESP_OK;
+	nvs_close(handle);
+	return exists;
+}
+
+/*
+ * A full ring moves its older half to NVS; once both blobs are used the oldest chunk goes.
+ */
+static void testSpill() {
+	host_nvs_erase_all();
+	reading_buffer_init();
+	int64_t first = sequence + 1;
+
+	_append(CAPACITY + 1);
+	CHECK_EQ(CAPACITY / 2, reading_buffer_stats().spilled);
+	CHECK_EQ(CAPACITY / 2 + 1, reading_buffer_stats().buffered);
+	_append(CAPACITY / 2);
+	CHECK_EQ(CAPACITY, reading_buffer_stats().spilled);
+
+	// The first chunk has to make way for the third
+	_append(CAPACITY / 2);
+	ReadingBufferStats stats = reading_buffer_stats();
+	CHECK_EQ(CAPACITY, stats.spilled);
+	CHECK_EQ(CAPACITY / 2 + 1, stats.buffered);
+	CHECK_EQ(CAPACITY / 2, stats.dropped);
+
+	// Spilled records come back a chunk at a time, and a drained chunk is erased
+	_checkPeek(first + CAPACITY / 2, CAPACITY / 2);
+	reading_buffer_consume(1);
+	_checkPeek(first + CAPACITY / 2 + 1, CAPACITY / 2 - 1);
+	reading_buffer_consume(CAPACITY / 2 - 1);
+	CHECK(!_spillExists(1));
+	CHECK(_spillExists(2));
+	_checkPeek(first + CAPACITY, CAPACITY / 2);
+
+	CHECK_EQ(CAPACITY / 2 + CAPACITY / 2 + 1, _drain());
+	CHECK(!_spillExists(2));
+	stats = reading_buffer_stats();
+	CHECK_EQ(0, stats.spilled);
+	CHECK_EQ(0, stats.buffered);
+}
+
+/*
+ * The ring and the spill bookkeeping survive a restart; the chunk being drained is read back from NVS.
+ */
+static void testRecovery() {
+	host_nvs_erase_all();
+	reading_buffer_init();
+	TelemetryRecord oldest;
+	int64_t first = sequence + 1;
+
+	_append(CAPACITY + 2);
+	reading_buffer_consume(reading_buffer_peek(&oldest, 1));
+	reading_buffer_init();
+	ReadingBufferStats stats = reading_buffer_stats();
+	CHECK_EQ(CAPACITY / 2 - 1, stats.spilled);
+	CHECK_EQ(CAPACITY / 2 + 2, stats.buffered);
+	_checkPeek(first + 1, CAPACITY / 2 - 1);
+	CHECK_EQ(CAPACITY + 1, _drain());
+}
+
+/*
+ * When NVS won't take the chunk, records are dropped one at a time, oldest first.
+ */
+static void testSpillFailure() {
+	host_nvs_erase_all();
+	reading_buffer_init();
+	uint32_t dropped = reading_buffer_stats().dropped;
+
+	host_nvs_fail_writes(true);
+	_append(CAPACITY + 3);
+	host_nvs_fail_writes(false);
+	CHECK_EQ(dropped + 3, reading_buffer_stats().dropped);
+	CHECK_EQ(0, reading_buffer_stats().spilled);
+	_checkPeek(sequence - CAPACITY + 1, CAPACITY);
+	CHECK_EQ(CAPACITY, _drain());
+}
+
+#else
+
+static void testDropOldest() {
+	reading_buffer_init();
+	uint32_t dropped = reading_buffer_stats().dropped;
+
+	_append(CAPACITY + 5);
+	CHECK_EQ(dropped + 5, reading_buffer_stats().dropped);
+	CHECK_EQ(CAPACITY, reading_buffer_stats().buffered);
+	_checkPeek(sequence - CAPACITY + 1, CAPACITY);
+	CHECK_EQ(CAPACITY, _drain());
+}
+
+#endif
+
+int main() {
+	RUN_TEST(testWrap);
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+	RUN_TEST(testSpill);
+	RUN_TEST(testRecovery);
+	RUN_TEST(testSpillFailure);
+#else
+	RUN_TEST(testDropOldest);
+#endif
+	return TEST_RESULT();
+}
@@ -0,0 +1,148 @@
+/*
+ * The lock-free reading queue, once in a single thread and then with the producer and consumer on
+ * their own threads racing each other. Built with both of the overflow policies.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "reading_queue.h"
+#include "sdkconfig.h"
+#include "test.h"
+
+#define CAPACITY CONFIG_READING_QUEUE_CAPACITY
+#define RACE_RECORDS 1000000
+
+// Every field is derived from the sequence number, so a record torn by a concurrent write shows
+static TelemetryRecord _record(uint32_t sequence) {
+	TelemetryRecord record = {
+		.epochMillis = sequence,
+		.humidityTenths = sequence & 0x7FFF,
+		.temperatureTenths = -(int16_t) (sequence >> 15),
+		.pin = sequence,
+		.zone = sequence >> 8,
+		.status = sequence >> 16
+	};
+	return record;
+}
+
+static bool _intact(const TelemetryRecord *record) {
+	TelemetryRecord expected = _record(record->epochMillis);
+	return record->humidityTenths == expected.humidityTenths
+			&& record->temperatureTenths == expected.temperatureTenths && record->pin == expected.pin
+			&& record->zone == expected.zone && record->status == expected.status;
+}
+
+static uint32_t sequence;
+
+/*
+ * Overfills the queue by a few records and checks which ones the policy kept.
+ */
+static void testOverflow() {
+	TelemetryRecord records[CAPACITY];
+	uint32_t first = sequence;
+
+	for (int i = 0; i < CAPACITY + 3; i++) {
+		TelemetryRecord record = _record(sequence++);
+		bool pushed = reading_queue_push(&record);
+#if CONFIG_READING_QUEUE_DROP_NEWEST
+		CHECK_EQ(i < CAPACITY, pushed);
+#else
+		CHECK(pushed);
+#endif
+	}
+	ReadingQueueStats stats = reading_queue_stats();
+	CHECK_EQ(CAPACITY, stats.queued);
+	CHECK_EQ(CAPACITY, stats.capacity);
+
+	size_t count = reading_queue_pop(records, CAPACITY);
+	CHECK_EQ(CAPACITY, count);
+#if CONFIG_READING_QUEUE_DROP_NEWEST
+	CHECK_EQ(first, records[0].epochMillis);
+	// The refused records never got sequence numbers in the queue
+	sequence = first + CAPACITY;
+#else
+	CHECK_EQ(first + 3, records[0].epochMillis);
+#endif
+	for (size_t i = 1; i < count; i++) {
+		CHECK_EQ(records[i - 1].epochMillis + 1, records[i].epochMillis);
+	}
+
+	stats = reading_queue_stats();
+	CHECK_EQ(0, stats.queued);
+	CHECK_EQ(3, stats.dropped);
+	CHECK_EQ(CAPACITY, stats.popped);
+	CHECK_EQ(0, reading_queue_pop(records, CAPACITY));
+}
+
+static volatile bool producing;
+static uint32_t producerDrops;
+
+static void *_produce(void *arg) {
+	for (uint32_t i = 0; i < RACE_RECORDS; i++) {
+		TelemetryRecord record = _record(sequence);
+		if (reading_queue_push(&record)) {
+			sequence++;
+		} else {
+			producerDrops++;
+			sched_yield();
+		}
+	}
+	__atomic_store_n(&producing, false, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * A consumer popping odd-sized batches as fast as it can must see every record whole, in order and at
+ * most once, and what it got plus what was dropped must account for everything pushed.
+ */
+static void testRace() {
+	TelemetryRecord records[7];
+	ReadingQueueStats before = reading_queue_stats();
+	uint32_t first = sequence;
+	int64_t previous = (int64_t) first - 1;
+	uint32_t popped = 0, torn = 0, outOfOrder = 0;
+	size_t max = 1;
+	pthread_t producer;
+
+	producing = true;
+	producerDrops = 0;
+	pthread_create(&producer, NULL, _produce, NULL);
+	for (;;) {
+		bool more = __atomic_load_n(&producing, __ATOMIC_ACQUIRE);
+		size_t count = reading_queue_pop(records, max);
+		for (size_t i = 0; i < count; i++) {
+			torn += !_intact(&records[i]);
+			outOfOrder += records[i].epochMillis <= previous;
+			previous = records[i].epochMillis;
+		}
+		popped += count;
+		max = max % 7 + 1;
+		if (count == 0) {
+			if (!more) {
+				break;
+			}
+			sched_yield();
+		}
+	}
+	pthread_join(producer, NULL);
+
+	ReadingQueueStats stats = reading_queue_stats();
+	CHECK_EQ(0, torn);
+	CHECK_EQ(0, outOfOrder);
+	CHECK_EQ(sequence - 1, previous);
+	CHECK_EQ(0, stats.queued);
+	CHECK_EQ(popped, stats.popped - before.popped);
+	CHECK_EQ(RACE_RECORDS, popped + stats.dropped - before.dropped);
+#if CONFIG_READING_QUEUE_DROP_NEWEST
+	CHECK_EQ(producerDrops, stats.dropped - before.dropped);
+	CHECK_EQ(sequence - first, popped);
+#else
+	CHECK_EQ(0, producerDrops);
+#endif
+}
+
+int main() {
+	RUN_TEST(testOverflow);
+	RUN_TEST(testRace);
+	return TEST_RESULT();
+}
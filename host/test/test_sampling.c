@@ -0,0 +1,106 @@
+/*
+ * The sampling stage against simulated sensors, one of them unplugged: on the virtual clock a cycle
+ * takes as long as it did with every sensor healthy, except for the quarantine's occasional retries.
+ */
+
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "sampling.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "test.h"
+
+#define SENSORS 4
+#define CYCLES 200
+#define UNPLUGGED 1
+
+static DhtSimSensor simulated[SENSORS];
+static int64_t baselineMicros;
+
+// One sampling period on, then a sample; returns how long it took
+static int64_t _cycle() {
+	host_advance(5000 * 1000);
+	int64_t started = host_micros();
+	sample_readings();
+	return host_micros() - started;
+}
+
+/*
+ * With every sensor answering, each cycle takes the same time.
+ */
+static void testHealthyCyclesFlat() {
+	baselineMicros = _cycle();
+	for (int i = 0; i < 5; i++) {
+		CHECK_EQ(baselineMicros, _cycle());
+	}
+	// The wake pulse and one frame, read in parallel
+	CHECK(baselineMicros < DHTLIB_DHT_WAKEUP * 1000 + DHTLIB_FRAME_TIMEOUT_US);
+}
+
+/*
+ * Only the cycles that retry the unplugged sensor run long, and those are what sensor_health counts
+ * as wasted. Every other cycle takes the healthy time, or less with one sensor fewer to read.
+ */
+static void testUnpluggedSensorKeepsCyclesFlat() {
+	const SensorHealth *health = sensor_health_get(UNPLUGGED);
+	int slowCycles = 0;
+	int64_t slowMicros = 0;
+	int64_t totalMicros = 0;
+
+	simulated[UNPLUGGED].silent = true;
+	for (int cycle = 0; cycle < CYCLES; cycle++) {
+		uint32_t attempts = health->attempts;
+		int64_t elapsed = _cycle();
+		totalMicros += elapsed;
+		if (health->attempts != attempts) {
+			slowCycles++;
+			slowMicros += elapsed;
+		} else {
+			CHECK(elapsed <= baselineMicros);
+		}
+	}
+
+	CHECK_EQ(SENSOR_QUARANTINED, health->state);
+	CHECK_EQ(slowCycles, health->timeouts);
+	CHECK_EQ(slowMicros, health->wastedMicros);
+	CHECK_EQ(CYCLES - slowCycles, health->skipped);
+	// Three failures to get quarantined, then retries 1, 2, 4, ... 64 cycles apart
+	CHECK(slowCycles <= 12);
+	CHECK(totalMicros <= CYCLES * baselineMicros + slowMicros);
+}
+
+/*
+ * Plugged back in, the sensor comes back at its next retry, and the cycles take the healthy time again.
+ */
+static void testPluggedBackIn() {
+	const SensorHealth *health = sensor_health_get(UNPLUGGED);
+	uint32_t successes = health->successes;
+
+	simulated[UNPLUGGED].silent = false;
+	for (int cycle = 0; cycle <= CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF && health->state != SENSOR_HEALTHY; cycle++) {
+		_cycle();
+	}
+	CHECK_EQ(SENSOR_HEALTHY, health->state);
+	CHECK_EQ(successes + 1, health->successes);
+	for (int i = 0; i < 5; i++) {
+		CHECK_EQ(baselineMicros, _cycle());
+	}
+	CHECK_EQ(successes + 6, health->successes);
+}
+
+int main() {
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, sensors_init());
+	CHECK_EQ(SENSORS, sensors_count());
+	sensor_health_init();
+	CHECK_EQ(ESP_OK, sampling_init());
+	for (int i = 0; i < SENSORS; i++) {
+		dht_sim_init(&simulated[i], sensors_get(i)->pin, 450 + 10 * i, 215 + i);
+	}
+
+	RUN_TEST(testHealthyCyclesFlat);
+	RUN_TEST(testUnpluggedSensorKeepsCyclesFlat);
+	RUN_TEST(testPluggedBackIn);
+	return TEST_RESULT();
+}
@@ -0,0 +1,134 @@
+/*
+ * Scheduler deadlines and their stats on the virtual clock.
+ */
+
+#include "host.h"
+#include "scheduler.h"
+#include "test.h"
+
+#define PERIOD_MICROS 10000
+
+static uint32_t runMillis[4];
+static int runs;
+
+// Runs for as long as this run's entry in runMillis says
+static void _work(void *arg) {
+	delay(runMillis[runs++ % 4]);
+}
+
+static void _reset(Job *job) {
+	*job = (Job) { .name = "work", .function = _work, .periodMicros = PERIOD_MICROS };
+	runs = 0;
+	for (int i = 0; i < 4; i++) {
+		runMillis[i] = 0;
+	}
+}
+
+/*
+ * A run that overruns two deadlines misses them, and the next run starts on the original grid rather
+ * than a period after the overrun ended.
+ */
+static void testOverrunKeepsGrid() {
+	static Job job;
+	_reset(&job);
+	runMillis[0] = 25;
+
+	int64_t start = host_micros();
+	CHECK_EQ(ESP_OK, scheduler_add(&job, PERIOD_MICROS));
+	CHECK(scheduler_run_due(20));
+	CHECK_EQ(start + 35000, host_micros());
+	CHECK_EQ(2, job.stats.missed);
+
+	CHECK(scheduler_run_due(20));
+	CHECK_EQ(start + 4 * PERIOD_MICROS, host_micros());
+	CHECK_EQ(2, job.stats.runs);
+	CHECK_EQ(2, job.stats.missed);
+	CHECK_EQ(0, job.stats.maxLatenessMicros);
+	CHECK_EQ(25000, job.stats.maxRunMicros);
+	CHECK_EQ(start + 5 * PERIOD_MICROS, job.nextDeadline);
+	CHECK_EQ(ESP_OK, scheduler_cancel(&job));
+}
+
+/*
+ * A timer callback held back past two deadlines (as by a long critical section) counts them as
+ * missed and runs the job once, late by the full delay; the grid is kept all the same.
+ */
+static void testLateCallbackCountsMissed() {
+	static Job job;
+	_reset(&job);
+
+	int64_t start = host_micros();
+	CHECK_EQ(ESP_OK, scheduler_add(&job, PERIOD_MICROS));
+	host_enter_critical();
+	host_advance(35000);
+	host_exit_critical();
+
+	CHECK(scheduler_run_due(0));
+	CHECK_EQ(1, job.stats.runs);
+	CHECK_EQ(2, job.stats.missed);
+	CHECK_EQ(25000, job.stats.maxLatenessMicros);
+	CHECK_EQ(start + 4 * PERIOD_MICROS, job.nextDeadline);
+	CHECK(!scheduler_run_due(0));
+
+	CHECK(scheduler_run_due(10));
+	CHECK_EQ(start + 4 * PERIOD_MICROS, host_micros());
+	CHECK_EQ(2, job.stats.runs);
+	CHECK_EQ(25000 + 0, job.stats.totalLatenessMicros);
+	CHECK_EQ(ESP_OK, scheduler_cancel(&job));
+}
+
+/*
+ * Lateness is measured from the deadline, so a job queued behind another one's run starts late by
+ * however long that run took.
+ */
+static void testQueuedBehindAnotherJob() {
+	static Job first;
+	static Job second;
+	_reset(&first);
+	_reset(&second);
+	second.name = "second";
+	runMillis[0] = 4;
+
+	CHECK_EQ(ESP_OK, scheduler_add(&first, PERIOD_MICROS));
+	CHECK_EQ(ESP_OK, scheduler_add(&second, PERIOD_MICROS));
+	CHECK(scheduler_run_due(20));
+	CHECK(scheduler_run_due(0));
+	CHECK_EQ(0, first.stats.maxLatenessMicros);
+	CHECK_EQ(4000, second.stats.maxLatenessMicros);
+	CHECK_EQ(0, first.stats.missed + second.stats.missed);
+	CHECK_EQ(ESP_OK, scheduler_cancel(&first));
+	CHECK_EQ(ESP_OK, scheduler_cancel(&second));
+}
+
+/*
+ * A one-shot job runs once, and a cancelled periodic job stops coming due.
+ */
+static void testOneShotAndCancel() {
+	static Job once;
+	static Job periodic;
+	_reset(&once);
+	_reset(&periodic);
+	once.periodMicros = 0;
+
+	CHECK_EQ(ESP_OK, scheduler_add(&once, 1000));
+	CHECK(scheduler_run_due(5));
+	CHECK(!scheduler_run_due(50));
+	CHECK_EQ(1, once.stats.runs);
+
+	CHECK_EQ(ESP_OK, scheduler_add(&periodic, PERIOD_MICROS));
+	CHECK(scheduler_run_due(20));
+	CHECK_EQ(ESP_OK, scheduler_cancel(&periodic));
+	CHECK(!scheduler_run_due(50));
+	CHECK_EQ(1, periodic.stats.runs);
+	CHECK_EQ(0, periodic.stats.missed);
+}
+
+int main() {
+	CHECK_EQ(ESP_OK, scheduler_init());
+
+	RUN_TEST(testOverrunKeepsGrid);
+	RUN_TEST(testLateCallbackCountsMissed);
+	RUN_TEST(testQueuedBehindAnotherJob);
+	RUN_TEST(testOneShotAndCancel);
+	return TEST_RESULT();
+}
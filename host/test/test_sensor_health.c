@@ -0,0 +1,152 @@
+/*
+ * Quarantine and backoff of failing sensors, and the health report.
+ */
+
+#include <string.h>
+#include "dht.h"
+#include "host.h"
+#include "nvs.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "test.h"
+
+static void _useTable(const char *table) {
+	nvs_handle handle;
+	host_nvs_erase_all();
+	nvs_open("sensors", NVS_READWRITE, &handle);
+	nvs_set_str(handle, "table", table);
+	nvs_close(handle);
+	CHECK_EQ(ESP_OK, sensors_init());
+	sensor_health_init();
+}
+
+/*
+ * Runs one sampling cycle for sensor 0 as power_save.c does, with every read coming back 'status'.
+ * Returns whether the sensor was read.
+ */
+static bool _cycle(int status) {
+	if (!sensor_health_due(0)) {
+		return false;
+	}
+	sensor_health_record(0, status, 1000);
+	return true;
+}
+
+/*
+ * After CONFIG_SENSOR_QUARANTINE_FAILURES failures in a row the gaps between retries double, up to
+ * CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF cycles.
+ */
+static void testBackoffSchedule() {
+	const int expectedGaps[] = { 1, 2, 4, 8, 16, 32, 64, 64, 64 };
+	_useTable("4");
+
+	for (int i = 0; i < CONFIG_SENSOR_QUARANTINE_FAILURES - 1; i++) {
+		CHECK(_cycle(DHTLIB_ERROR_TIMEOUT));
+		CHECK_EQ(SENSOR_HEALTHY, sensor_health_get(0)->state);
+	}
+	CHECK(_cycle(DHTLIB_ERROR_TIMEOUT));
+	CHECK_EQ(SENSOR_QUARANTINED, sensor_health_get(0)->state);
+	CHECK_EQ(1, sensor_health_get(0)->quarantines);
+
+	for (size_t retry = 0; retry < sizeof(expectedGaps) / sizeof(expectedGaps[0]); retry++) {
+		int gap = 0;
+		while (!_cycle(DHTLIB_ERROR_CHECKSUM)) {
+			gap++;
+		}
+		CHECK_EQ(expectedGaps[retry], gap);
+	}
+
+	const SensorHealth *sensor = sensor_health_get(0);
+	CHECK_EQ(CONFIG_SENSOR_QUARANTINE_FAILURES + 9, sensor->attempts);
+	CHECK_EQ(CONFIG_SENSOR_QUARANTINE_FAILURES, sensor->timeouts);
+	CHECK_EQ(9, sensor->checksumErrors);
+	CHECK_EQ(1 + 2 + 4 + 8 + 16 + 32 + 64 * 3, sensor->skipped);
+	CHECK_EQ(sensor->attempts * 1000, sensor->wastedMicros);
+	CHECK_EQ(1, sensor->quarantines);
+}
+
+/*
+ * One good retry brings a sensor straight back, and it takes another run of failures to quarantine it
+ * again, starting over from a single cycle.
+ */
+static void testRecovery() {
+	_useTable("5");
+	for (int i = 0; i < CONFIG_SENSOR_QUARANTINE_FAILURES; i++) {
+		_cycle(DHTLIB_ERROR_TIMEOUT);
+	}
+	CHECK(!_cycle(DHTLIB_OK));
+	CHECK(_cycle(DHTLIB_OK));
+	CHECK_EQ(SENSOR_HEALTHY, sensor_health_get(0)->state);
+	CHECK_EQ(0, sensor_health_get(0)->consecutiveFailures);
+
+	for (int i = 0; i < CONFIG_SENSOR_QUARANTINE_FAILURES; i++) {
+		CHECK(_cycle(DHTLIB_ERROR_TIMEOUT));
+	}
+	CHECK_EQ(2, sensor_health_get(0)->quarantines);
+	CHECK(!_cycle(DHTLIB_ERROR_TIMEOUT));
+	CHECK(_cycle(DHTLIB_ERROR_TIMEOUT));
+	CHECK(!_cycle(DHTLIB_ERROR_TIMEOUT));
+	CHECK(!_cycle(DHTLIB_ERROR_TIMEOUT));
+	CHECK(_cycle(DHTLIB_ERROR_TIMEOUT));
+}
+
+/*
+ * A refused read says nothing about the sensor: no attempt, no failure, no step in the backoff.
+ */
+static void testTooSoonIsIgnored() {
+	_useTable("13");
+	for (int i = 0; i < 10; i++) {
+		CHECK(_cycle(DHTLIB_ERROR_TOO_SOON));
+	}
+	_cycle(DHTLIB_ERROR_TIMEOUT);
+	_cycle(DHTLIB_ERROR_TOO_SOON);
+	_cycle(DHTLIB_ERROR_TIMEOUT);
+	_cycle(DHTLIB_ERROR_TOO_SOON);
+	CHECK_EQ(SENSOR_HEALTHY, sensor_health_get(0)->state);
+	CHECK_EQ(2, sensor_health_get(0)->attempts);
+	CHECK_EQ(2, sensor_health_get(0)->consecutiveFailures);
+	CHECK_EQ(2000, sensor_health_get(0)->wastedMicros);
+}
+
+/*
+ * State is kept for a sensor still on the same pin (across deep sleep) and dropped for a new one.
+ */
+static void testInitKeepsSamePin() {
+	_useTable("14 15");
+	sensor_health_record(0, DHTLIB_OK, 0);
+	sensor_health_record(1, DHTLIB_OK, 0);
+	sensor_health_init();
+	CHECK_EQ(1, sensor_health_get(0)->attempts);
+
+	_useTable("14 16");
+	CHECK_EQ(1, sensor_health_get(0)->attempts);
+	CHECK_EQ(16, sensor_health_get(1)->pin);
+	CHECK_EQ(0, sensor_health_get(1)->attempts);
+}
+
+static void testReport() {
+	char text[512];
+	JsonWriter json;
+
+	_useTable("17 18");
+	sensor_health_record(0, DHTLIB_OK, 0);
+	sensor_health_record(0, DHTLIB_OK, 0);
+	sensor_health_record(0, DHTLIB_ERROR_CHECKSUM, 4500);
+	json_begin(&json, text, sizeof(text));
+	sensor_health_write(&json);
+	CHECK(json_end(&json));
+	CHECK(strcmp("{\"sensors\":["
+			"{\"pin\":17,\"state\":\"healthy\",\"success_pct\":66.7,\"attempts\":3,\"timeouts\":0,"
+			"\"checksum_errors\":1,\"quarantines\":0,\"skipped\":0,\"wasted_ms\":4},"
+			"{\"pin\":18,\"state\":\"healthy\",\"success_pct\":0.0,\"attempts\":0,\"timeouts\":0,"
+			"\"checksum_errors\":0,\"quarantines\":0,\"skipped\":0,\"wasted_ms\":0}]}", text) == 0);
+}
+
+int main() {
+	RUN_TEST(testBackoffSchedule);
+	RUN_TEST(testRecovery);
+	RUN_TEST(testTooSoonIsIgnored);
+	RUN_TEST(testInitKeepsSamePin);
+	RUN_TEST(testReport);
+	return TEST_RESULT();
+}
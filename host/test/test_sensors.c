@@ -0,0 +1,161 @@
+/*
+ * The sensor table: parsing, falling back to CONFIG_SENSOR_TABLE, and calibration.
+ */
+
+#include <string.h>
+#include "dht.h"
+#include "host.h"
+#include "nvs.h"
+#include "sensors.h"
+#include "test.h"
+
+static void _storeTable(const char *table) {
+	nvs_handle handle;
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, nvs_open("sensors", NVS_READWRITE, &handle));
+	CHECK_EQ(ESP_OK, nvs_set_str(handle, "table", table));
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+static void _checkSensor(size_t index, uint8_t pin, uint8_t zone, int16_t humidityOffset, int16_t temperatureOffset) {
+	const Sensor *sensor = sensors_get(index);
+	CHECK_EQ(pin, sensor->pin);
+	CHECK_EQ(pin, sensors_pins()[index]);
+	CHECK_EQ(zone, sensor->zone);
+	CHECK_EQ(humidityOffset, sensor->humidityOffsetTenths);
+	CHECK_EQ(temperatureOffset, sensor->temperatureOffsetTenths);
+}
+
+// What the host sdkconfig.h has for CONFIG_SENSOR_TABLE
+static void _checkDefaultTable() {
+	const uint8_t pins[] = { 26, 27, 25, 33 };
+	CHECK_EQ(4, sensors_count());
+	CHECK_EQ(1, sensors_zones());
+	for (size_t i = 0; i < 4; i++) {
+		_checkSensor(i, pins[i], 0, 0, 0);
+	}
+}
+
+static void testDefaultTable() {
+	host_nvs_erase_all();
+	CHECK_EQ(ESP_OK, sensors_init());
+	_checkDefaultTable();
+}
+
+static void testStoredTable() {
+	_storeTable("4:2, 5:1:2.5:-0.4\t13 , 14:0:-1.55\n15:3:0:100");
+	CHECK_EQ(ESP_OK, sensors_init());
+	CHECK_EQ(5, sensors_count());
+	CHECK_EQ(4, sensors_zones());
+	_checkSensor(0, 4, 2, 0, 0);
+	_checkSensor(1, 5, 1, 25, -4);
+	_checkSensor(2, 13, 0, 0, 0);
+	_checkSensor(3, 14, 0, -16, 0);
+	_checkSensor(4, 15, 3, 0, 1000);
+
+	// Zones are counted up to the highest one used, even with gaps
+	_storeTable("32:3");
+	CHECK_EQ(ESP_OK, sensors_init());
+	CHECK_EQ(1, sensors_count());
+	CHECK_EQ(4, sensors_zones());
+}
+
+/*
+ * Any bad entry throws out the whole stored table, and the board comes up with CONFIG_SENSOR_TABLE.
+ */
+static void testRejectedTables() {
+	char tooMany[128] = "";
+	char tooLong[300];
+	const uint8_t manyPins[] = { 0, 2, 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26 };
+	for (size_t i = 0; i < sizeof(manyPins); i++) {
+		snprintf(tooMany + strlen(tooMany), sizeof(tooMany) - strlen(tooMany), "%d ", manyPins[i]);
+	}
+	memset(tooLong, ' ', sizeof(tooLong) - 3);
+	strcpy(tooLong + sizeof(tooLong) - 3, "4");
+
+	const char *tables[] = {
+		"4:1:x",        // offsets are numbers
+		"4:1:1.0x",
+		"4:1:0:0:0",    // at most four fields
+		"4x",
+		":1",           // no empty fields
+		"4::1",
+		"4:",
+		"-1",
+		"20",           // not a GPIO
+		"34",           // input only
+		"40",
+		"4:4",          // CONFIG_SENSOR_ZONES_MAX is 4
+		"4:-1",
+		"4:1:100.1",    // offsets within ±100
+		"4 5:1 4:2",    // pins only once
+		"",
+		" , ",
+		tooMany,
+		tooLong
+	};
+
+	for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		// A good table first, so a rejected one can't pass by leaving the registry as it was
+		_storeTable("32:3");
+		sensors_init();
+		_storeTable(tables[i]);
+		CHECK_EQ(ESP_OK, sensors_init());
+		if (sensors_count() != 4) {
+			fprintf(stderr, "Table %d (\"%s\") wasn't rejected\n", (int) i, tables[i]);
+		}
+		_checkDefaultTable();
+	}
+}
+
+static void testCalibrate() {
+	_storeTable("5:1:2.5:-0.4");
+	CHECK_EQ(ESP_OK, sensors_init());
+
+	TelemetryRecord record = { .pin = 5, .status = DHTLIB_OK, .humidityTenths = 500, .temperatureTenths = 200 };
+	sensors_calibrate(sensors_get(0), &record);
+	CHECK_EQ(1, record.zone);
+	CHECK_EQ(525, record.humidityTenths);
+	CHECK_EQ(196, record.temperatureTenths);
+
+	// A failed reading only gets its zone
+	record = (TelemetryRecord) { .pin = 5, .status = DHTLIB_ERROR_TIMEOUT, .humidityTenths = DHTLIB_INVALID_VALUE,
+			.temperatureTenths = DHTLIB_INVALID_VALUE };
+	sensors_calibrate(sensors_get(0), &record);
+	CHECK_EQ(1, record.zone);
+	CHECK_EQ(DHTLIB_INVALID_VALUE, record.humidityTenths);
+	CHECK_EQ(DHTLIB_INVALID_VALUE, record.temperatureTenths);
+}
+
+/*
+ * An offset never takes the humidity outside 0-100%.
+ */
+static void testCalibrateClampsHumidity() {
+	_storeTable("5:1:2.5 6:1:-3");
+	CHECK_EQ(ESP_OK, sensors_init());
+
+	TelemetryRecord record = { .pin = 5, .status = DHTLIB_OK, .humidityTenths = 990, .temperatureTenths = 200 };
+	sensors_calibrate(sensors_get(0), &record);
+	CHECK_EQ(1000, record.humidityTenths);
+	CHECK_EQ(200, record.temperatureTenths);
+
+	record = (TelemetryRecord) { .pin = 6, .status = DHTLIB_OK, .humidityTenths = 12, .temperatureTenths = -50 };
+	sensors_calibrate(sensors_get(1), &record);
+	CHECK_EQ(0, record.humidityTenths);
+	CHECK_EQ(-50, record.temperatureTenths);
+
+	// In range, the offset is applied as is
+	record = (TelemetryRecord) { .pin = 6, .status = DHTLIB_OK, .humidityTenths = 1000, .temperatureTenths = 0 };
+	sensors_calibrate(sensors_get(1), &record);
+	CHECK_EQ(970, record.humidityTenths);
+}
+
+int main() {
+	RUN_TEST(testDefaultTable);
+	RUN_TEST(testStoredTable);
+	RUN_TEST(testRejectedTables);
+	RUN_TEST(testCalibrate);
+	RUN_TEST(testCalibrateClampsHumidity);
+	return TEST_RESULT();
+}
@@ -0,0 +1,77 @@
+/*
+ * The stepper controller's PWM channels and pins as motors move in and out of microstepping.
+ */
+
+#include "common.h"
+#include "host.h"
+#include "stepper.h"
+#include "test.h"
+
+static const StepperConfig microConfigs[3] = {
+	{ .pins = { 16, 17, 18, 19 }, .mode = STEP_MICRO, .stepsPerRevolution = 200, .rpm = 60 },
+	{ .pins = { 21, 22, 23, 32 }, .mode = STEP_MICRO, .stepsPerRevolution = 200, .rpm = 60 },
+	{ .pins = { 12, 13, 14, 15 }, .mode = STEP_MICRO, .stepsPerRevolution = 200, .rpm = 60 }
+};
+
+static void _checkPwmPins(uint8_t firstChannel, const uint8_t pins[4]) {
+	for (int i = 0; i < 4; i++) {
+		CHECK_EQ(pins != NULL ? pins[i] : -1, host_pwm_pin(firstChannel + i));
+	}
+}
+
+/*
+ * Two motors microstep at once and a third doesn't fit, until one of them changes mode: its channels
+ * stop, its pins go back to plain outputs and the third motor gets the channels.
+ */
+static void testPwmChannelsFreed() {
+	static Stepper motors[3];
+	CHECK_EQ(ESP_OK, set_up(&motors[0], &microConfigs[0]));
+	CHECK_EQ(ESP_OK, set_up(&motors[1], &microConfigs[1]));
+	CHECK_EQ(ESP_ERR_NO_MEM, set_up(&motors[2], &microConfigs[2]));
+	_checkPwmPins(0, microConfigs[0].pins);
+	_checkPwmPins(4, microConfigs[1].pins);
+
+	StepperConfig half = microConfigs[0];
+	half.mode = STEP_HALF;
+	CHECK_EQ(ESP_OK, set_up(&motors[0], &half));
+	_checkPwmPins(0, NULL);
+	for (int i = 0; i < 4; i++) {
+		CHECK(host_pin_output(half.pins[i]));
+	}
+
+	CHECK_EQ(ESP_OK, set_up(&motors[2], &microConfigs[2]));
+	_checkPwmPins(0, microConfigs[2].pins);
+	_checkPwmPins(4, microConfigs[1].pins);
+
+	// Both microstepping motors give theirs back for the next test
+	StepperConfig wave = microConfigs[1];
+	wave.mode = STEP_WAVE;
+	CHECK_EQ(ESP_OK, set_up(&motors[1], &wave));
+	wave = microConfigs[2];
+	wave.mode = STEP_WAVE;
+	CHECK_EQ(ESP_OK, set_up(&motors[2], &wave));
+	_checkPwmPins(0, NULL);
+	_checkPwmPins(4, NULL);
+}
+
+/*
+ * A microstepping motor moved to other pins keeps its channels, and only the pins it left are let go.
+ */
+static void testMicrostepPinsMoved() {
+	static Stepper motor;
+	CHECK_EQ(ESP_OK, set_up(&motor, &microConfigs[0]));
+	_checkPwmPins(0, microConfigs[0].pins);
+
+	StepperConfig moved = microConfigs[0];
+	moved.pins[1] = 25;
+	moved.pins[3] = 26;
+	CHECK_EQ(ESP_OK, set_up(&motor, &moved));
+	_checkPwmPins(0, moved.pins);
+	_checkPwmPins(4, NULL);
+}
+
+int main() {
+	RUN_TEST(testPwmChannelsFreed);
+	RUN_TEST(testMicrostepPinsMoved);
+	return TEST_RESULT();
+}
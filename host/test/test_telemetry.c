@@ -0,0 +1,120 @@
+/*
+ * The CBOR telemetry records.
+ */
+
+#include <string.h>
+#include "telemetry.h"
+#include "test.h"
+
+static const TelemetryRecord example = {
+	.epochMillis = 1700000000000LL,
+	.humidityTenths = 655,
+	.temperatureTenths = -123,
+	.pin = 26,
+	.zone = 1,
+	.status = 0
+};
+
+static const TelemetryRecord extremes[] = {
+	{ .epochMillis = 0, .humidityTenths = 0, .temperatureTenths = 0, .pin = 0, .zone = 0, .status = 0 },
+	{ .epochMillis = INT64_MAX, .humidityTenths = INT16_MAX, .temperatureTenths = INT16_MAX,
+			.pin = TELEMETRY_ZONE_AGGREGATE, .zone = UINT8_MAX, .status = INT8_MAX },
+	{ .epochMillis = INT64_MIN, .humidityTenths = INT16_MIN, .temperatureTenths = INT16_MIN, .pin = 39, .zone = 7,
+			.status = INT8_MIN },
+	{ .epochMillis = -1, .humidityTenths = -24, .temperatureTenths = 23, .pin = 23, .zone = 24, .status = -25 }
+};
+
+#define EXTREMES (sizeof(extremes) / sizeof(extremes[0]))
+
+static bool _sameRecord(const TelemetryRecord *a, const TelemetryRecord *b) {
+	return a->epochMillis == b->epochMillis && a->humidityTenths == b->humidityTenths
+			&& a->temperatureTenths == b->temperatureTenths && a->pin == b->pin && a->zone == b->zone
+			&& a->status == b->status;
+}
+
+static void testEncoding() {
+	const uint8_t expected[] = {
+		0x87, 0x02, 0x18, 0x1a, 0x01, 0x00,
+		0x1b, 0x00, 0x00, 0x01, 0x8b, 0xcf, 0xe5, 0x68, 0x00,
+		0x19, 0x02, 0x8f,
+		0x38, 0x7a
+	};
+	uint8_t buffer[TELEMETRY_MAX_RECORD_SIZE];
+
+	CHECK_EQ(sizeof(expected), telemetry_encode(&example, buffer, sizeof(buffer)));
+	CHECK(memcmp(expected, buffer, sizeof(expected)) == 0);
+}
+
+static void testRoundTrip() {
+	uint8_t buffer[TELEMETRY_MAX_RECORD_SIZE];
+	TelemetryRecord record;
+
+	for (size_t i = 0; i < EXTREMES; i++) {
+		size_t length = telemetry_encode(&extremes[i], buffer, sizeof(buffer));
+		CHECK(length > 0 && length <= TELEMETRY_MAX_RECORD_SIZE);
+		memset(&record, 0xAA, sizeof(record));
+		CHECK(telemetry_decode(buffer, length, &record));
+		CHECK(_sameRecord(&extremes[i], &record));
+	}
+}
+
+/*
+ * Short buffers fail the encode, and every truncation, a trailing byte or another version fails the
+ * decode.
+ */
+static void testRejects() {
+	uint8_t buffer[TELEMETRY_MAX_RECORD_SIZE + 1];
+	TelemetryRecord record;
+
+	size_t length = telemetry_encode(&example, buffer, sizeof(buffer));
+	for (size_t size = 0; size < length; size++) {
+		CHECK_EQ(0, telemetry_encode(&example, buffer, size));
+	}
+
+	length = telemetry_encode(&example, buffer, sizeof(buffer));
+	for (size_t size = 0; size < length; size++) {
+		CHECK(!telemetry_decode(buffer, size, &record));
+	}
+	buffer[length] = 0x00;
+	CHECK(!telemetry_decode(buffer, length + 1, &record));
+
+	buffer[1] = TELEMETRY_VERSION + 1;
+	CHECK(!telemetry_decode(buffer, length, &record));
+	buffer[1] = TELEMETRY_VERSION;
+
+	// A pin of 256 doesn't fit the record
+	const uint8_t widePin[] = { 0x87, 0x02, 0x19, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
+	CHECK(!telemetry_decode(widePin, sizeof(widePin), &record));
+}
+
+static void testBatch() {
+	uint8_t buffer[EXTREMES * TELEMETRY_MAX_RECORD_SIZE + 1];
+	TelemetryRecord records[EXTREMES];
+	size_t count = 0;
+
+	size_t length = telemetry_encode_batch(extremes, EXTREMES, buffer, sizeof(buffer));
+	CHECK(length > 0);
+	CHECK(telemetry_decode_batch(buffer, length, records, EXTREMES, &count));
+	CHECK_EQ(EXTREMES, count);
+	for (size_t i = 0; i < EXTREMES; i++) {
+		CHECK(_sameRecord(&extremes[i], &records[i]));
+	}
+
+	CHECK(!telemetry_decode_batch(buffer, length, records, EXTREMES - 1, &count));
+	CHECK(!telemetry_decode_batch(buffer, length - 1, records, EXTREMES, &count));
+	CHECK_EQ(0, telemetry_encode_batch(extremes, EXTREMES, buffer, length - 1));
+
+	// An empty batch is a valid one
+	length = telemetry_encode_batch(extremes, 0, buffer, sizeof(buffer));
+	CHECK_EQ(1, length);
+	CHECK(telemetry_decode_batch(buffer, length, records, EXTREMES, &count));
+	CHECK_EQ(0, count);
+}
+
+int main() {
+	RUN_TEST(testEncoding);
+	RUN_TEST(testRoundTrip);
+	RUN_TEST(testRejects);
+	RUN_TEST(testBatch);
+	return TEST_RESULT();
+}
@@ -0,0 +1,126 @@
+/*
+ * Tenths stay exact all the way through: the DHT frame decode, the CBOR record and the JSON text.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "json_writer.h"
+#include "nvs.h"
+#include "reading_queue.h"
+#include "sampling.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "telemetry.h"
+#include "test.h"
+
+/*
+ * Every int16_t comes out as printf("%.1f") would print it, and reads back as the same tenths.
+ */
+static void testFormatTenths() {
+	char expected[16];
+	char text[JSON_TENTHS_SIZE];
+	int wrong = 0;
+
+	for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+		snprintf(expected, sizeof(expected), "%.1f", tenths / 10.0);
+		size_t length = json_format_tenths(tenths, text);
+		wrong += strcmp(expected, text) != 0 || length != strlen(text)
+				|| lround(strtod(text, NULL) * 10) != tenths;
+	}
+	CHECK_EQ(0, wrong);
+}
+
+static void testCheckDecoding() {
+	CHECK_EQ(0, checkDecoding());
+}
+
+/*
+ * Values at the edges of the DHT22's ranges, read off simulated sensors and passed on in both formats.
+ */
+static void testEndToEnd() {
+	static DhtSimSensor sensor;
+	const int16_t values[][2] = { { 0, 0 }, { 1000, 800 }, { 1, -1 }, { 999, -400 }, { 5, -5 }, { 123, -799 } };
+	uint8_t cbor[TELEMETRY_MAX_RECORD_SIZE];
+	char text[128], expected[128];
+
+	dht_sim_init(&sensor, 26, 0, 0);
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		sensor.humidityTenths = values[i][0];
+		sensor.temperatureTenths = values[i][1];
+		host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+		Reading reading = readPin(26);
+		CHECK_EQ(DHTLIB_OK, reading.status);
+		CHECK_EQ(values[i][0], reading.humidityTenths);
+		CHECK_EQ(values[i][1], reading.temperatureTenths);
+
+		TelemetryRecord record = {
+			.pin = 26,
+			.humidityTenths = reading.humidityTenths,
+			.temperatureTenths = reading.temperatureTenths
+		}, decoded;
+		size_t length = telemetry_encode(&record, cbor, sizeof(cbor));
+		CHECK(telemetry_decode(cbor, length, &decoded));
+		CHECK_EQ(values[i][0], decoded.humidityTenths);
+		CHECK_EQ(values[i][1], decoded.temperatureTenths);
+
+		JsonWriter json;
+		json_begin(&json, text, sizeof(text));
+		json_tenths(&json, "relative_humidity", decoded.humidityTenths);
+		json_tenths(&json, "temperature", decoded.temperatureTenths);
+		CHECK(json_end(&json));
+		snprintf(expected, sizeof(expected), "{\"relative_humidity\":%.1f,\"temperature\":%.1f}", values[i][0] / 10.0,
+				values[i][1] / 10.0);
+		CHECK(strcmp(expected, text) == 0);
+	}
+}
+
+/*
+ * A zone's average is rounded to the nearest tenth, halves away from zero, whichever side of zero it's
+ * on. Each zone is read once, so the filter passes the readings through as they are.
+ */
+static void testZoneAverageRounding() {
+	static DhtSimSensor sensors[7];
+	const int16_t values[7][2] = {
+		{ 1, -101 }, { 2, -102 },                  // zone 0: 1.5 and -101.5
+		{ 1000, -101 }, { 999, -102 }, { 999, -102 }, // zone 1: 999.33 and -101.67
+		{ 450, 215 }, { 451, 216 }                 // zone 2: 450.5 and 215.5
+	};
+	const int16_t averages[3][2] = { { 2, -102 }, { 999, -102 }, { 451, 216 } };
+	nvs_handle handle;
+	TelemetryRecord records[16];
+
+	host_nvs_erase_all();
+	nvs_open("sensors", NVS_READWRITE, &handle);
+	nvs_set_str(handle, "table", "26:0 27:0 25:1 33:1 32:1 4:2 5:2");
+	nvs_close(handle);
+	CHECK_EQ(ESP_OK, sensors_init());
+	sensor_health_init();
+	CHECK_EQ(ESP_OK, sampling_init());
+	for (int i = 0; i < 7; i++) {
+		dht_sim_init(&sensors[i], sensors_get(i)->pin, values[i][0], values[i][1]);
+	}
+
+	// Past the reading testEndToEnd left in the cache
+	host_advance(2 * DHTLIB_MIN_INTERVAL_MS * 1000);
+	CHECK_EQ(7 + 3, sample_readings());
+	CHECK_EQ(7 + 3, reading_queue_pop(records, 16));
+	for (int zone = 0; zone < 3; zone++) {
+		const TelemetryRecord *aggregate = &records[7 + zone];
+		CHECK_EQ(TELEMETRY_ZONE_AGGREGATE, aggregate->pin);
+		CHECK_EQ(zone, aggregate->zone);
+		CHECK_EQ(averages[zone][0], aggregate->humidityTenths);
+		CHECK_EQ(averages[zone][1], aggregate->temperatureTenths);
+	}
+}
+
+int main() {
+	RUN_TEST(testFormatTenths);
+	RUN_TEST(testCheckDecoding);
+	RUN_TEST(testEndToEnd);
+	RUN_TEST(testZoneAverageRounding);
+	return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+/*
+ * Built with CONFIG_TIME_WRAP_SOAK, so millis() and micros() wrap a minute after start and micros()
+ * again every 2^32 µs after that. Reads, the cache and a long move are run across the wraps.
+ */
+
+#include "common.h"
+#include "dht.h"
+#include "dht_sim.h"
+#include "host.h"
+#include "stepper.h"
+#include "stepper_sink.h"
+#include "test.h"
+
+static DhtSimSensor sensors[2];
+static const uint8_t pins[2] = { 26, 27 };
+
+// Moves the clock on until micros() is 'before' µs short of its next wrap
+static void _advanceToWrap(uint32_t before) {
+	uint32_t remaining = 0 - micros();
+	CHECK(remaining > before);
+	host_advance(remaining - before);
+}
+
+static void _checkReading(const DhtSimSensor *sensor, Reading reading) {
+	CHECK_EQ(DHTLIB_OK, reading.status);
+	CHECK_EQ(sensor->humidityTenths, reading.humidityTenths);
+	CHECK_EQ(sensor->temperatureTenths, reading.temperatureTenths);
+}
+
+static void testCountersWrap() {
+	_advanceToWrap(1500);
+	CHECK(millis() > UINT32_MAX - 2);
+	uint64_t millisBefore = millis64();
+	uint64_t microsBefore = micros64();
+	int64_t hostBefore = host_micros();
+
+	delayMicroseconds(2000);
+	CHECK_EQ(hostBefore + 2000, host_micros());
+	CHECK_EQ(500, micros());
+	CHECK_EQ(0, millis());
+	CHECK_EQ(microsBefore + 2000, micros64());
+	CHECK_EQ(millisBefore + 2, millis64());
+}
+
+static Reading asyncReading;
+
+static void _keepReading(uint8_t pin, Reading reading, void *arg) {
+	asyncReading = reading;
+}
+
+/*
+ * Frames that straddle a wrap decode, and the minimum interval and cache ages come out right.
+ */
+static void testReadsAcrossWrap() {
+	Reading readings[2];
+
+	for (int wrap = 0; wrap < 2; wrap++) {
+		// The wake pulse takes 10ms, so the frame itself is on the far side of the wrap
+		_advanceToWrap(11000);
+		readPins(pins, readings, 2);
+		_checkReading(&sensors[0], readings[0]);
+		_checkReading(&sensors[1], readings[1]);
+
+		// Still too soon just after the wrap, then fine from the cache
+		host_advance(1000 * 1000);
+		CHECK_EQ(DHTLIB_ERROR_TOO_SOON, readPin(pins[0]).status);
+		DhtCacheStats before = getCacheStats();
+		int frames = sensors[0].frames;
+		_checkReading(&sensors[0], getReading(pins[0], 1500));
+		CHECK_EQ(before.hits + 1, getCacheStats().hits);
+		CHECK_EQ(frames, sensors[0].frames);
+
+		// And stale once it's older than asked for
+		host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+		_checkReading(&sensors[0], getReading(pins[0], 1500));
+		CHECK_EQ(frames + 1, sensors[0].frames);
+
+		// The single-pin and interrupt-driven paths across the next wrap
+		_advanceToWrap(10100);
+		_checkReading(&sensors[1], readPin(pins[1]));
+		host_advance(DHTLIB_MIN_INTERVAL_MS * 1000);
+		_advanceToWrap(10100);
+		asyncReading.status = DHTLIB_ERROR_TIMEOUT;
+		CHECK_EQ(ESP_OK, readPinAsync(pins[0], _keepReading, NULL));
+		host_advance(20 * 1000);
+		_checkReading(&sensors[0], asyncReading);
+	}
+}
+
+/*
+ * A constant-speed move long enough to carry the controller's own 1/256 µs clock over its wrap
+ * (every 16.8s) as well as micros(), with every step on time.
+ */
+static void testStepperAcrossWrap() {
+	static Stepper motor;
+	static StepperSink sink;
+	StepperConfig config = { .pins = { 16, 17, 18, 19 }, .mode = STEP_HALF, .stepsPerRevolution = 200, .rpm = 60 };
+	Motion motion = { .steps = 8000, .direction = STEPPER_FORWARD, .maxStepsPerSecond = 400 };
+
+	stepper_sink_attach(&sink, config.pins, -1);
+	CHECK_EQ(ESP_OK, set_up(&motor, &config));
+	_advanceToWrap(10 * 1000 * 1000);
+	stepper_sink_clear(&sink);
+	CHECK_EQ(ESP_OK, start_motion(&motor, &motion, NULL, NULL));
+	host_advance(21 * 1000 * 1000);
+	CHECK(!in_motion(&motor));
+
+	CHECK(!sink.overflow);
+	// The tick that starts the move, then one state per step
+	CHECK_EQ(8001, sink.count);
+	int late = 0;
+	for (uint32_t i = 1; i < sink.count; i++) {
+		late += sink.states[i].micros - sink.states[i - 1].micros != 2500;
+	}
+	CHECK_EQ(0, late);
+	stepper_sink_detach_all();
+}
+
+int main() {
+	dht_sim_init(&sensors[0], pins[0], 512, -75);
+	dht_sim_init(&sensors[1], pins[1], 333, 291);
+	CHECK_EQ(ESP_OK, initAsyncReads());
+
+	RUN_TEST(testCountersWrap);
+	RUN_TEST(testReadsAcrossWrap);
+	RUN_TEST(testStepperAcrossWrap);
+	return TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+/*
+ * Timestamps from the cached clock offset, and the formatter's per-minute cache. Built twice, for
+ * local time and for CONFIG_TIMESTAMP_UTC.
+ */
+
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "timestamp.h"
+
+// 2019-05-04T12:34:56.789Z
+#define EPOCH_MILLIS 1556973296789LL
+
+#if CONFIG_TIMESTAMP_UTC
+#define EXPECT(local, utc) (utc)
+#else
+#define EXPECT(local, utc) (local)
+#endif
+
+static void _checkFormat(TimestampFormatter *formatter, int64_t epochMillis, const char *expected) {
+	char text[TIMESTAMP_TEXT_SIZE];
+	CHECK_EQ(strlen(expected), timestamp_format(formatter, epochMillis, text, sizeof(text)));
+	if (strcmp(expected, text) != 0) {
+		fprintf(stderr, "expected %s, got %s\n", expected, text);
+		CHECK(strcmp(expected, text) == 0);
+	}
+}
+
+/*
+ * Until the clock is set timestamps are since boot. Once it is, one capture of the offset makes them
+ * wall-clock time, and they carry on with esp_timer from there.
+ */
+static void testSyncedOnceClockSet() {
+	host_advance(1500 * 1000);
+	timestamp_init();
+	CHECK(!timestamp_synced());
+	CHECK(!timestamp_update());
+	CHECK_EQ(1500, timestamp_now());
+
+	host_set_epoch(EPOCH_MILLIS);
+	CHECK_EQ(1500, timestamp_now());
+	CHECK(timestamp_update());
+	CHECK(timestamp_synced());
+	CHECK_EQ(EPOCH_MILLIS, timestamp_now());
+	host_advance(2250 * 1000);
+	CHECK_EQ(EPOCH_MILLIS + 2250, timestamp_now());
+}
+
+static void testFormat() {
+	TimestampFormatter formatter = { 0 };
+	_checkFormat(&formatter, EPOCH_MILLIS, EXPECT("2019-05-04T08:34:56EDT", "2019-05-04T12:34:56Z"));
+	_checkFormat(&formatter, timestamp_now(), EXPECT("2019-05-04T08:34:59EDT", "2019-05-04T12:34:59Z"));
+}
+
+/*
+ * The next minute, hour, day and year are all worked out afresh, and so is the zone when daylight
+ * saving time starts.
+ */
+static void testRollover() {
+	TimestampFormatter formatter = { 0 };
+	_checkFormat(&formatter, EPOCH_MILLIS + 3000, EXPECT("2019-05-04T08:34:59EDT", "2019-05-04T12:34:59Z"));
+	_checkFormat(&formatter, EPOCH_MILLIS + 3211, EXPECT("2019-05-04T08:35:00EDT", "2019-05-04T12:35:00Z"));
+
+	// 2019-12-31T23:59:59Z
+	_checkFormat(&formatter, 1577836799000LL, EXPECT("2019-12-31T18:59:59EST", "2019-12-31T23:59:59Z"));
+	_checkFormat(&formatter, 1577836800000LL, EXPECT("2019-12-31T19:00:00EST", "2020-01-01T00:00:00Z"));
+
+	// 2019-03-10T06:59:59Z, a second before 2am EST
+	_checkFormat(&formatter, 1552201199999LL, EXPECT("2019-03-10T01:59:59EST", "2019-03-10T06:59:59Z"));
+	_checkFormat(&formatter, 1552201200000LL, EXPECT("2019-03-10T03:00:00EDT", "2019-03-10T07:00:00Z"));
+}
+
+/*
+ * Within a minute only the seconds are written; the date, hour and minute come from the cache until
+ * the minute changes. Spoiling the cached prefix shows which calls used it.
+ */
+static void testMinuteCache() {
+	TimestampFormatter formatter = { 0 };
+	char text[TIMESTAMP_TEXT_SIZE];
+	_checkFormat(&formatter, EPOCH_MILLIS, EXPECT("2019-05-04T08:34:56EDT", "2019-05-04T12:34:56Z"));
+
+	formatter.prefix[0] = 'X';
+	timestamp_format(&formatter, EPOCH_MILLIS + 1000, text, sizeof(text));
+	CHECK_EQ('X', text[0]);
+	CHECK(strcmp(EXPECT("019-05-04T08:34:57EDT", "019-05-04T12:34:57Z"), text + 1) == 0);
+
+	_checkFormat(&formatter, EPOCH_MILLIS + 4000, EXPECT("2019-05-04T08:35:00EDT", "2019-05-04T12:35:00Z"));
+	// Going back a minute misses too
+	_checkFormat(&formatter, EPOCH_MILLIS, EXPECT("2019-05-04T08:34:56EDT", "2019-05-04T12:34:56Z"));
+}
+
+static void testBufferTooSmall() {
+	TimestampFormatter formatter = { 0 };
+	const char *expected = EXPECT("2019-05-04T08:34:56EDT", "2019-05-04T12:34:56Z");
+	char text[TIMESTAMP_TEXT_SIZE];
+	CHECK_EQ(0, timestamp_format(&formatter, EPOCH_MILLIS, text, strlen(expected)));
+	CHECK_EQ(strlen(expected), timestamp_format(&formatter, EPOCH_MILLIS, text, strlen(expected) + 1));
+}
+
+int main() {
+	RUN_TEST(testSyncedOnceClockSet);
+	RUN_TEST(testFormat);
+	RUN_TEST(testRollover);
+	RUN_TEST(testMinuteCache);
+	RUN_TEST(testBufferTooSmall);
+	return TEST_RESULT();
+}
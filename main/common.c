@@ -1,40 +1,347 @@
 #include "common.h"
 #include "driver/gpio.h"
+#include "driver/timer.h"
+#include "driver/ledc.h"
+#include "rom/gpio.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/ledc_struct.h"
+#include "soc/timer_group_struct.h"
+#include "xtensa/hal.h"
 #include "esp_timer.h"
+#include "esp_pm.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/portmacro.h"
 
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpuFrequencyLock;
+#endif
+
+// All PWM channels share one high speed LEDC timer: 8 bit duty at 20 kHz, above hearing
+#define PWM_FREQUENCY_HZ 20000
+static bool pwmTimerReady = false;
+
+// The interval timer is hardware timer 0 of group 0, counting microseconds
+#define INTERVAL_TIMER_GROUP TIMER_GROUP_0
+#define INTERVAL_TIMER_INDEX TIMER_0
+#define INTERVAL_TIMER_DEV (INTERVAL_TIMER_GROUP == TIMER_GROUP_0 ? &TIMERG0 : &TIMERG1)
+#define INTERVAL_TIMER INTERVAL_TIMER_DEV->hw_timer[INTERVAL_TIMER_INDEX]
+// The alarm only fires when the counter reaches it, so it's never set closer than this ahead of the count
+#define INTERVAL_TIMER_MIN_US 10
+
+static IntervalCallback intervalCallback;
+static void *intervalArg;
+// What the alarm was last set to, which the callback may have asked for less than
+static volatile uint32_t intervalProgrammed = 0;
+
+/*
+ * Creates the power management lock. Call once at start up.
+ */
+esp_err_t initCommon() {
+#if CONFIG_PM_ENABLE
+	return esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "common", &cpuFrequencyLock);
+#else
+	return ESP_OK;
+#endif
+}
+
+/*
+ * Installs the per-pin GPIO ISR service. Its interrupt is allocated on the calling core, and every
+ * attachInterrupt() handler runs there, so call it from a task pinned to wherever they should run.
+ */
+esp_err_t initInterrupts() {
+	esp_err_t err = gpio_install_isr_service(0);
+	// Someone else may already have installed the ISR service, that's fine
+	if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+		return err;
+	}
+	return ESP_OK;
+}
+
 void pinModeOutput(uint8_t pin) {
 	gpio_set_pull_mode(pin, GPIO_PULLUP_DISABLE);
 	gpio_set_pull_mode(pin, GPIO_PULLDOWN_ENABLE);
 	gpio_set_direction(pin, GPIO_MODE_OUTPUT);
 }
 
-unsigned long IRAM_ATTR millis() {
-	return (unsigned long) (esp_timer_get_time() / 1000ULL);
+/*
+ * For some reason, gpio_config doesn't seem to work here. Interactions with the sensor start timing out.
+ */
+void pinModeInput(uint8_t pin) {
+	gpio_set_pull_mode(pin, GPIO_PULLUP_ENABLE);
+	gpio_set_pull_mode(pin, GPIO_PULLDOWN_DISABLE);
+	gpio_set_direction(pin, GPIO_MODE_INPUT);
 }
 
-unsigned long IRAM_ATTR micros() {
-	return (unsigned long) (esp_timer_get_time());
+void IRAM_ATTR digitalWrite(uint8_t pin, uint8_t val) {
+	if (val) {
+		if (pin < 32) {
+			GPIO.out_w1ts = ((uint32_t) 1 << pin);
+		} else if (pin < 34) {
+			GPIO.out1_w1ts.val = ((uint32_t) 1 << (pin - 32));
+		}
+	} else {
+		if (pin < 32) {
+			GPIO.out_w1tc = ((uint32_t) 1 << pin);
+		} else if (pin < 34) {
+			GPIO.out1_w1tc.val = ((uint32_t) 1 << (pin - 32));
+		}
+	}
 }
 
-void IRAM_ATTR delayMicroseconds(uint32_t us) {
-	uint32_t m = micros();
-	if (us) {
-		uint32_t e = (m + us);
-		if (m > e) { //overflow
-			while (micros() > e) {
-				NOP();
-			}
-		}
-		while (micros() < e) {
-			NOP();
+int IRAM_ATTR digitalRead(uint8_t pin) {
+	if (pin < 32) {
+		return (GPIO.in >> pin) & 0x1;
+	} else if (pin < 40) {
+		return (GPIO.in1.val >> (pin - 32)) & 0x1;
+	}
+	return 0;
+}
+
+/*
+ * Levels of every input pin at one instant, bit N is GPIO N.
+ */
+uint64_t IRAM_ATTR readInputs() {
+	return (uint64_t) GPIO.in | ((uint64_t) GPIO.in1.val << 32);
+}
+
+/*
+ * One write per register, and none at all for a bank with nothing to change.
+ */
+void IRAM_ATTR writePort(const PortMasks *masks) {
+	if (masks->setLow) {
+		GPIO.out_w1ts = masks->setLow;
+	}
+	if (masks->clearLow) {
+		GPIO.out_w1tc = masks->clearLow;
+	}
+	if (masks->setHigh) {
+		GPIO.out1_w1ts.val = masks->setHigh;
+	}
+	if (masks->clearHigh) {
+		GPIO.out1_w1tc.val = masks->clearHigh;
+	}
+}
+
+/*
+ * Hands 'pin' over to PWM 'channel' (0 to PWM_CHANNELS - 1), starting at a duty of 0.
+ */
+esp_err_t initPwm(uint8_t channel, uint8_t pin) {
+	if (!pwmTimerReady) {
+		ledc_timer_config_t timerConfig = {
+				.speed_mode = LEDC_HIGH_SPEED_MODE,
+				.duty_resolution = LEDC_TIMER_8_BIT,
+				.timer_num = LEDC_TIMER_0,
+				.freq_hz = PWM_FREQUENCY_HZ
+		};
+		esp_err_t err = ledc_timer_config(&timerConfig);
+		if (err != ESP_OK) {
+			return err;
 		}
+		pwmTimerReady = true;
+	}
+
+	ledc_channel_config_t channelConfig = {
+			.gpio_num = pin,
+			.speed_mode = LEDC_HIGH_SPEED_MODE,
+			.channel = channel,
+			.intr_type = LEDC_INTR_DISABLE,
+			.timer_sel = LEDC_TIMER_0,
+			.duty = 0,
+			.hpoint = 0
+	};
+	return ledc_channel_config(&channelConfig);
+}
+
+/*
+ * Takes effect at the start of the next PWM period. Writes the registers directly since the LEDC driver
+ * can't be used from an interrupt.
+ */
+void IRAM_ATTR setPwmDuty(uint8_t channel, uint8_t duty) {
+	// The duty register has 4 fractional bits
+	LEDC.channel_group[LEDC_HIGH_SPEED_MODE].channel[channel].duty.duty = (uint32_t) duty << 4;
+	LEDC.channel_group[LEDC_HIGH_SPEED_MODE].channel[channel].conf0.sig_out_en = 1;
+	LEDC.channel_group[LEDC_HIGH_SPEED_MODE].channel[channel].conf1.duty_start = 1;
+}
+
+/*
+ * Stops PWM 'channel' with its output HIGH and hands 'pin' back to its GPIO output register, so the
+ * channel can be given to another pin.
+ */
+esp_err_t stopPwm(uint8_t channel, uint8_t pin) {
+	esp_err_t err = ledc_stop(LEDC_HIGH_SPEED_MODE, channel, 1);
+	gpio_matrix_out(pin, SIG_GPIO_OUT_IDX, false, false);
+	return err;
+}
+
+/*
+ * Calls 'handler' on every edge of 'pin' until detachInterrupt() is called.
+ */
+esp_err_t attachInterrupt(uint8_t pin, InterruptHandler handler, void *arg) {
+	gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+	esp_err_t err = gpio_isr_handler_add(pin, handler, arg);
+	if (err != ESP_OK) {
+		return err;
+	}
+	return gpio_intr_enable(pin);
+}
+
+void detachInterrupt(uint8_t pin) {
+	gpio_intr_disable(pin);
+	gpio_isr_handler_remove(pin);
+	gpio_set_intr_type(pin, GPIO_INTR_DISABLE);
+}
+
+#if CONFIG_TIME_WRAP_SOAK
+// A minute short of 2^32 ms, which is also a whole number of 2^32 µs, so both short counters wrap a minute after boot
+#define TIME_OFFSET_MICROS (1000LL * 0x100000000LL - 60 * 1000000LL)
+#else
+#define TIME_OFFSET_MICROS 0
+#endif
+
+int64_t IRAM_ATTR micros64() {
+	return esp_timer_get_time() + TIME_OFFSET_MICROS;
+}
+
+int64_t IRAM_ATTR millis64() {
+	return micros64() / 1000;
+}
+
+uint32_t IRAM_ATTR millis() {
+	return (uint32_t) millis64();
+}
+
+uint32_t IRAM_ATTR micros() {
+	return (uint32_t) micros64();
+}
+
+void IRAM_ATTR delayMicroseconds(uint32_t us) {
+	int64_t end = micros64() + us;
+	while (micros64() < end) {
+		NOP();
 	}
 }
 
 void delay(uint32_t ms) {
 	vTaskDelay(ms / portTICK_PERIOD_MS);
 }
+
+/*
+ * The CPU's cycle counter, for timing short stretches of code. Wraps every ~18 s at 240 MHz.
+ */
+uint32_t IRAM_ATTR cycleCount() {
+	return xthal_get_ccount();
+}
+
+/*
+ * Timer callbacks run on the esp_timer task, not in an interrupt.
+ */
+esp_err_t createTimer(Timer *timer, TimerCallback callback, void *arg, const char *name) {
+	esp_timer_create_args_t timerArgs = {
+			.callback = callback,
+			.arg = arg,
+			.name = name
+	};
+	return esp_timer_create(&timerArgs, (esp_timer_handle_t *) timer);
+}
+
+esp_err_t startTimer(Timer timer, uint64_t us) {
+	return esp_timer_start_once((esp_timer_handle_t) timer, us);
+}
+
+esp_err_t startPeriodicTimer(Timer timer, uint64_t us) {
+	return esp_timer_start_periodic((esp_timer_handle_t) timer, us);
+}
+
+esp_err_t stopTimer(Timer timer) {
+	return esp_timer_stop((esp_timer_handle_t) timer);
+}
+
+static void IRAM_ATTR _intervalIsr(void *arg) {
+	INTERVAL_TIMER_DEV->int_clr_timers.val = 1 << INTERVAL_TIMER_INDEX;
+	uint32_t next = intervalCallback(intervalArg);
+	if (next == 0) {
+		// Leaving the alarm disarmed is enough. Touching the timer here could race with another core
+		// restarting it.
+		return;
+	}
+	// The counter reloaded to 0 when the alarm went off and has been counting through the callback.
+	// An alarm it has already passed wouldn't fire until the 64 bit counter wrapped.
+	INTERVAL_TIMER.update = 1;
+	uint32_t elapsed = INTERVAL_TIMER.cnt_low;
+	if (next < elapsed + INTERVAL_TIMER_MIN_US) {
+		next = elapsed + INTERVAL_TIMER_MIN_US;
+	}
+	INTERVAL_TIMER.alarm_high = 0;
+	INTERVAL_TIMER.alarm_low = next;
+	INTERVAL_TIMER.config.alarm_en = 1;
+	intervalProgrammed = next;
+}
+
+/*
+ * A hardware timer for work that needs better timing than esp_timer's task can give, e.g. stepping a
+ * motor. 'callback' runs in an IRAM interrupt, so it and everything it calls must be IRAM_ATTR. The
+ * timer runs off the APB clock, so hold the maximum CPU frequency while it's running. The interrupt is
+ * allocated on the calling core.
+ */
+esp_err_t initIntervalTimer(IntervalCallback callback, void *arg) {
+	intervalCallback = callback;
+	intervalArg = arg;
+
+	timer_config_t config = {
+			.alarm_en = TIMER_ALARM_EN,
+			.counter_en = TIMER_PAUSE,
+			.intr_type = TIMER_INTR_LEVEL,
+			.counter_dir = TIMER_COUNT_UP,
+			.auto_reload = TIMER_AUTORELOAD_EN,
+			.divider = 80 // 1 MHz at the 80 MHz APB clock
+	};
+	esp_err_t err = timer_init(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, &config);
+	if (err != ESP_OK) {
+		return err;
+	}
+	timer_set_counter_value(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, 0);
+	timer_enable_intr(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX);
+	return timer_isr_register(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, _intervalIsr, NULL, ESP_INTR_FLAG_IRAM, NULL);
+}
+
+/*
+ * Calls the callback after 'us', and after whatever it returns from then on.
+ */
+void startIntervalTimer(uint32_t us) {
+	timer_pause(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX);
+	timer_set_counter_value(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, 0);
+	timer_set_alarm_value(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, us);
+	timer_set_alarm(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX, TIMER_ALARM_EN);
+	intervalProgrammed = us;
+	timer_start(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX);
+}
+
+void stopIntervalTimer() {
+	timer_pause(INTERVAL_TIMER_GROUP, INTERVAL_TIMER_INDEX);
+}
+
+/*
+ * How long the interval that just ended actually was, in µs: the callback can be called later than it
+ * asked for, when it asked for less than the time it ran plus INTERVAL_TIMER_MIN_US.
+ */
+uint32_t IRAM_ATTR intervalTimerLast() {
+	return intervalProgrammed;
+}
+
+/*
+ * Keeps the CPU at its maximum frequency (and out of light sleep) until released. Holds nest, and both
+ * are safe to call from an interrupt.
+ */
+void IRAM_ATTR holdMaxCpuFrequency() {
+#if CONFIG_PM_ENABLE
+	esp_pm_lock_acquire(cpuFrequencyLock);
+#endif
+}
+
+void IRAM_ATTR releaseMaxCpuFrequency() {
+#if CONFIG_PM_ENABLE
+	esp_pm_lock_release(cpuFrequencyLock);
+#endif
+}
@@ -1,17 +1,94 @@
 #ifndef common_h
 #define common_h
 
+/*
+ * The thin layer between the application and the hardware: GPIO, interrupts, time, delays and
+ * timers. Nothing outside common.c (and the Wi-Fi glue in wifi.c and start-up in power_save.c)
+ * should need to talk to the ESP-IDF drivers or registers directly.
+ *
+ * host/common_posix.c implements the same calls on a simulated board for the Linux build.
+ */
+
 #include <stdint.h>
 #include "esp_attr.h"
+#include "esp_err.h"
 
 #define NOP() asm volatile ("nop")
 
+#define LOW 0
+#define HIGH 1
+
+#define NUM_PINS 40
+
 void pinModeOutput(uint8_t pin);
-unsigned long IRAM_ATTR millis();
-unsigned long IRAM_ATTR micros();
-void IRAM_ATTR delayMicroseconds(uint32_t us);
+void pinModeInput(uint8_t pin);
+void IRAM_ATTR digitalWrite(uint8_t pin, uint8_t val);
+int IRAM_ATTR digitalRead(uint8_t pin);
+uint64_t IRAM_ATTR readInputs();
+
+/*
+ * Pins to set and clear across both GPIO banks in one go: bit N of the low words is GPIO N, bit N of
+ * the high words is GPIO 32 + N. Build them with PIN_MASK_LOW/PIN_MASK_HIGH, at compile time if the
+ * pins are known.
+ */
+typedef struct PortMasks {
+	uint32_t setLow;
+	uint32_t clearLow;
+	uint32_t setHigh;
+	uint32_t clearHigh;
+} PortMasks;
+
+#define PIN_MASK_LOW(pin) ((pin) < 32 ? (uint32_t) 1 << ((pin) & 31) : 0)
+#define PIN_MASK_HIGH(pin) ((pin) >= 32 ? (uint32_t) 1 << ((pin) & 31) : 0)
+
+void IRAM_ATTR writePort(const PortMasks *masks);
+
+#define PWM_CHANNELS 8
+#define PWM_MAX_DUTY 255
+
+esp_err_t initPwm(uint8_t channel, uint8_t pin);
+void IRAM_ATTR setPwmDuty(uint8_t channel, uint8_t duty);
+esp_err_t stopPwm(uint8_t channel, uint8_t pin);
+
+typedef void (*InterruptHandler)(void *arg);
+
+esp_err_t initCommon();
+esp_err_t initInterrupts();
+esp_err_t attachInterrupt(uint8_t pin, InterruptHandler handler, void *arg);
+void detachInterrupt(uint8_t pin);
+
+/*
+ * Time since boot. The 64-bit versions never wrap, so use them for anything stored or compared against
+ * a deadline. millis() and micros() are their low 32 bits (wrapping after ~49.7 days and ~71.6 minutes),
+ * only for timing short stretches as 'micros() - start' in unsigned arithmetic, which stays right
+ * across a wrap.
+ */
+int64_t IRAM_ATTR micros64();
+int64_t IRAM_ATTR millis64();
+uint32_t IRAM_ATTR millis();
+uint32_t IRAM_ATTR micros();
 void delay(uint32_t ms);
 void IRAM_ATTR delayMicroseconds(uint32_t us);
+uint32_t IRAM_ATTR cycleCount();
+
+typedef void *Timer;
+typedef void (*TimerCallback)(void *arg);
+
+esp_err_t createTimer(Timer *timer, TimerCallback callback, void *arg, const char *name);
+esp_err_t startTimer(Timer timer, uint64_t us);
+esp_err_t startPeriodicTimer(Timer timer, uint64_t us);
+esp_err_t stopTimer(Timer timer);
+
+// Returns the microseconds until the next call, or 0 to stop. Runs in an interrupt.
+typedef uint32_t (*IntervalCallback)(void *arg);
+
+esp_err_t initIntervalTimer(IntervalCallback callback, void *arg);
+void startIntervalTimer(uint32_t us);
+void stopIntervalTimer();
+uint32_t IRAM_ATTR intervalTimerLast();
+
+void IRAM_ATTR holdMaxCpuFrequency();
+void IRAM_ATTR releaseMaxCpuFrequency();
 
 #endif
 
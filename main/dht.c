@@ -4,14 +4,14 @@
 
 #include "dht.h"
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/portmacro.h"
 #include "esp_log.h"
 #include "common.h"
-
-#define LOW 0
-#define HIGH 1
+#include "metrics.h"
 
 #define INPUT
 #define OUTPUT
@@ -20,54 +20,250 @@
 // used to disable and interrupt interrupts
 portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
 
-float _humOffset = 0.0;
-float _tempOffset = 0.0;
-uint32_t _lastRead = 0;
 bool _disableIRQ = false;
 
 static const char *DHT_TAG = "dht";
 
+/*
+ * The last good reading of each pin and when the wire was last used, so repeat requests are served
+ * from memory and no sensor is asked again within DHTLIB_MIN_INTERVAL_MS. Written from the timer task
+ * by async reads, so every access holds _cacheMux.
+ */
+typedef struct DhtCacheEntry {
+	Reading reading;
+	int64_t readingMillis;
+	int64_t wireMillis;
+	bool hasReading;
+	bool wireUsed;
+} DhtCacheEntry;
+
+static DhtCacheEntry _cache[NUM_PINS];
+static DhtCacheStats _cacheStats;
+static portMUX_TYPE _cacheMux = portMUX_INITIALIZER_UNLOCKED;
+
 uint8_t _bits[5];  // buffer to receive data
 int _readSensor(uint8_t pin);
 
 /*
- * For some reason, gpio_config doesn't seem to work here. Interactions with the sensor start timing out.
+ * High-pulse widths of every data bit seen on each pin, bucketed so the distance of a sensor's
+ * 0s and 1s from DHTLIB_BIT_THRESHOLD_US can be inspected. Counters saturate rather than wrap.
+ */
+static uint16_t _pulseHistogram[NUM_PINS][DHTLIB_HISTOGRAM_BUCKETS];
+
+static void IRAM_ATTR _recordPulse(uint8_t pin, uint32_t width) {
+	if (pin >= NUM_PINS) {
+		return;
+	}
+	uint32_t bucket = width / DHTLIB_HISTOGRAM_BUCKET_US;
+	if (bucket >= DHTLIB_HISTOGRAM_BUCKETS) {
+		bucket = DHTLIB_HISTOGRAM_BUCKETS - 1;
+	}
+	if (_pulseHistogram[pin][bucket] != UINT16_MAX) {
+		_pulseHistogram[pin][bucket]++;
+	}
+}
+
+void getPulseHistogram(uint8_t pin, uint16_t histogram[DHTLIB_HISTOGRAM_BUCKETS]) {
+	if (pin >= NUM_PINS) {
+		memset(histogram, 0, DHTLIB_HISTOGRAM_BUCKETS * sizeof(uint16_t));
+		return;
+	}
+	memcpy(histogram, _pulseHistogram[pin], sizeof(_pulseHistogram[pin]));
+}
+
+void resetPulseHistogram(uint8_t pin) {
+	if (pin < NUM_PINS) {
+		memset(_pulseHistogram[pin], 0, sizeof(_pulseHistogram[pin]));
+	}
+}
+
+void dumpPulseHistogram(uint8_t pin) {
+	uint16_t histogram[DHTLIB_HISTOGRAM_BUCKETS];
+	char line[DHTLIB_HISTOGRAM_BUCKETS * 7 + 1];
+	int length = 0;
+
+	getPulseHistogram(pin, histogram);
+	for (int i = 0; i < DHTLIB_HISTOGRAM_BUCKETS; i++) {
+		length += snprintf(line + length, sizeof(line) - length, " %u", histogram[i]);
+	}
+	ESP_LOGI(DHT_TAG, "Pin %d high pulse widths (%dus buckets, threshold %dus):%s", pin, DHTLIB_HISTOGRAM_BUCKET_US,
+			DHTLIB_BIT_THRESHOLD_US, line);
+}
+
+/*
+ * Turns the 5 raw bytes of a frame into a reading, validating the checksum. The DHT22 sends tenths
+ * already (a 16 bit humidity and a sign and magnitude temperature), so they are taken as they are.
  */
-void pinModeInput(uint8_t pin) {
-	gpio_set_pull_mode(pin, GPIO_PULLUP_ENABLE);
-	gpio_set_pull_mode(pin, GPIO_PULLDOWN_DISABLE);
-	gpio_set_direction(pin, GPIO_MODE_INPUT);
+Reading _decodeBits(uint8_t pin, const uint8_t bits[5]) {
+	Reading reading;
+
+	// TEST CHECKSUM
+	uint8_t sum = bits[0] + bits[1] + bits[2] + bits[3];
+	if (bits[4] != sum) {
+		ESP_LOGW(DHT_TAG, "Pin %d checksum failed!", pin);
+		reading.humidityTenths = DHTLIB_INVALID_VALUE;
+		reading.temperatureTenths = DHTLIB_INVALID_VALUE;
+		reading.status = DHTLIB_ERROR_CHECKSUM;
+		return reading;
+	}
+
+	reading.humidityTenths = (bits[0] << 8) | bits[1];
+	reading.temperatureTenths = ((bits[2] & 0x7F) << 8) | bits[3];
+
+	if (bits[2] & 0x80) { // negative temperature
+		reading.temperatureTenths = -reading.temperatureTenths;
+	}
+
+	reading.status = DHTLIB_OK;
+	return reading;
+}
+
+#if CONFIG_READING_FORMAT_BENCHMARK
+#define CHECK_HUMIDITY_MAX 1000
+#define CHECK_TEMPERATURE_MAX 800
+
+static void _encodeFrame(uint16_t humidity, uint16_t temperature, uint8_t bits[5]) {
+	bits[0] = humidity >> 8;
+	bits[1] = humidity;
+	bits[2] = temperature >> 8;
+	bits[3] = temperature;
+	bits[4] = bits[0] + bits[1] + bits[2] + bits[3];
 }
 
-void IRAM_ATTR digitalWrite(uint8_t pin, uint8_t val) {
-	if (val) {
-		if (pin < 32) {
-			GPIO.out_w1ts = ((uint32_t) 1 << pin);
-		} else if (pin < 34) {
-			GPIO.out1_w1ts.val = ((uint32_t) 1 << (pin - 32));
+// 'temperature' is the raw word, sign bit included; returns 1 if it doesn't decode to the expected values
+static int _checkFrame(uint16_t humidity, uint16_t temperature, int16_t temperatureTenths) {
+	uint8_t bits[5];
+
+	_encodeFrame(humidity, temperature, bits);
+	Reading reading = _decodeBits(0, bits);
+	return reading.status != DHTLIB_OK || reading.humidityTenths != humidity
+			|| reading.temperatureTenths != temperatureTenths;
+}
+
+// Returns how many of the 32 single data bit errors in the frame get past the checksum
+static int _checkBitErrors(uint16_t humidity, uint16_t temperature) {
+	uint8_t bits[5];
+	int failures = 0;
+
+	_encodeFrame(humidity, temperature, bits);
+	for (int bit = 0; bit < 32; bit++) {
+		bits[bit / 8] ^= 1 << (bit % 8);
+		if (_decodeBits(0, bits).status != DHTLIB_ERROR_CHECKSUM) {
+			failures++;
 		}
-	} else {
-		if (pin < 32) {
-			GPIO.out_w1tc = ((uint32_t) 1 << pin);
-		} else if (pin < 34) {
-			GPIO.out1_w1tc.val = ((uint32_t) 1 << (pin - 32));
+		bits[bit / 8] ^= 1 << (bit % 8);
+	}
+	return failures;
+}
+
+/*
+ * Decodes a frame for every pair of humidity (0 to 100.0%) and temperature magnitude (0 to 80.0°C,
+ * with the sign bit clear and set, so -0 too). A flipped bit changes the checksum by a power of two
+ * whatever the values are, so bit errors are only checked along each axis: every humidity and every
+ * signed temperature with all 32 data bits flipped in turn, which the checksum has to reject. Returns
+ * how many frames came out wrong.
+ */
+int checkDecoding() {
+	int failures = 0;
+	int frames = 0;
+
+	for (uint16_t humidity = 0; humidity <= CHECK_HUMIDITY_MAX; humidity++) {
+		for (uint16_t magnitude = 0; magnitude <= CHECK_TEMPERATURE_MAX; magnitude++) {
+			failures += _checkFrame(humidity, magnitude, magnitude);
+			failures += _checkFrame(humidity, 0x8000 | magnitude, -magnitude);
+			frames += 2;
 		}
 	}
+
+	// Every flipped bit is a checksum warning otherwise
+	esp_log_level_set(DHT_TAG, ESP_LOG_ERROR);
+	for (uint16_t humidity = 0; humidity <= CHECK_HUMIDITY_MAX; humidity++) {
+		failures += _checkBitErrors(humidity, 215);
+		frames += 32;
+	}
+	for (uint16_t magnitude = 0; magnitude <= CHECK_TEMPERATURE_MAX; magnitude++) {
+		failures += _checkBitErrors(555, magnitude);
+		failures += _checkBitErrors(555, 0x8000 | magnitude);
+		frames += 64;
+	}
+	esp_log_level_set(DHT_TAG, CONFIG_LOG_DEFAULT_LEVEL);
+
+	ESP_LOGI(DHT_TAG, "Decoding: %d of %d frames came out wrong", failures, frames);
+	return failures;
+}
+#endif
+
+static Reading _failedReading(int status) {
+	Reading reading = {
+		.humidityTenths = DHTLIB_INVALID_VALUE,
+		.temperatureTenths = DHTLIB_INVALID_VALUE,
+		.status = status
+	};
+	return reading;
 }
 
-int IRAM_ATTR digitalRead(uint8_t pin) {
-	if (pin < 32) {
-		return (GPIO.in >> pin) & 0x1;
-	} else if (pin < 40) {
-		return (GPIO.in1.val >> (pin - 32)) & 0x1;
+/*
+ * Returns true, and marks the wire as used now, if 'pin' may be read.
+ */
+static bool _claimWire(uint8_t pin) {
+	if (pin >= NUM_PINS) {
+		return false;
+	}
+	int64_t now = millis64();
+	bool claimed = false;
+	portENTER_CRITICAL(&_cacheMux);
+	DhtCacheEntry *entry = &_cache[pin];
+	if (!entry->wireUsed || now - entry->wireMillis >= DHTLIB_MIN_INTERVAL_MS) {
+		entry->wireUsed = true;
+		entry->wireMillis = now;
+		claimed = true;
+	} else {
+		_cacheStats.refused++;
 	}
-	return 0;
+	portEXIT_CRITICAL(&_cacheMux);
+	return claimed;
 }
 
+static void _storeReading(uint8_t pin, Reading reading) {
+	if (reading.status != DHTLIB_OK) {
+		return;
+	}
+	int64_t now = millis64();
+	portENTER_CRITICAL(&_cacheMux);
+	_cache[pin].reading = reading;
+	_cache[pin].readingMillis = now;
+	_cache[pin].hasReading = true;
+	portEXIT_CRITICAL(&_cacheMux);
+}
+
+static bool _cachedReading(uint8_t pin, uint32_t maxAgeMillis, Reading *reading) {
+	if (pin >= NUM_PINS) {
+		return false;
+	}
+	int64_t now = millis64();
+	bool hit = false;
+	portENTER_CRITICAL(&_cacheMux);
+	const DhtCacheEntry *entry = &_cache[pin];
+	if (entry->hasReading && now - entry->readingMillis <= maxAgeMillis) {
+		*reading = entry->reading;
+		hit = true;
+		_cacheStats.hits++;
+	} else {
+		_cacheStats.misses++;
+	}
+	portEXIT_CRITICAL(&_cacheMux);
+	return hit;
+}
 
+/*
+ * Reads 'pin' on the wire, or fails with DHTLIB_ERROR_TOO_SOON if it was read less than
+ * DHTLIB_MIN_INTERVAL_MS ago.
+ */
 Reading readPin(uint8_t pin) {
 	Reading reading;
-	_lastRead = millis();
+	if (!_claimWire(pin)) {
+		return _failedReading(DHTLIB_ERROR_TOO_SOON);
+	}
 
 	// READ VALUES
 	if (_disableIRQ) portENTER_CRITICAL_ISR(&mux);
@@ -75,31 +271,358 @@ Reading readPin(uint8_t pin) {
 	if (_disableIRQ) portEXIT_CRITICAL_ISR(&mux);
 
 	if (readValue != DHTLIB_OK) {
-		reading.humidity = DHTLIB_INVALID_VALUE;
-		reading.temperature = DHTLIB_INVALID_VALUE;
-		reading.status = readValue; // propagate error value
+		return _failedReading(readValue); // propagate error value
+	}
+
+	reading = _decodeBits(pin, _bits);
+	_storeReading(pin, reading);
+	return reading;
+}
+
+/*
+ * A reading of 'pin' no older than 'maxAgeMillis': from the cache if it has one, otherwise from
+ * the wire. Fails with DHTLIB_ERROR_TOO_SOON rather than read a sensor within DHTLIB_MIN_INTERVAL_MS.
+ */
+Reading getReading(uint8_t pin, uint32_t maxAgeMillis) {
+	Reading reading;
+	if (_cachedReading(pin, maxAgeMillis, &reading)) {
 		return reading;
 	}
+	return readPin(pin);
+}
 
-	reading.humidity = (_bits[0] * 256 + _bits[1]) * 0.1;
-	reading.temperature = ((_bits[2] & 0x7F) * 256 + _bits[3]) * 0.1;
+/*
+ * getReading() for several pins. Whatever isn't cached is read in one go with readPins().
+ */
+void getReadings(const uint8_t pins[], Reading readings[], uint8_t count, uint32_t maxAgeMillis) {
+	uint8_t missedPins[count];
+	uint8_t missedSlots[count];
+	Reading missedReadings[count];
+	uint8_t missed = 0;
 
-	if (_bits[2] & 0x80) { // negative temperature
-		reading.temperature = -reading.temperature;
+	for (uint8_t i = 0; i < count; i++) {
+		if (!_cachedReading(pins[i], maxAgeMillis, &readings[i])) {
+			missedPins[missed] = pins[i];
+			missedSlots[missed++] = i;
+		}
+	}
+	if (missed == 0) {
+		return;
+	}
+	readPins(missedPins, missedReadings, missed);
+	for (uint8_t i = 0; i < missed; i++) {
+		readings[missedSlots[i]] = missedReadings[i];
 	}
+}
 
-	reading.humidity += _humOffset;       // check overflow ???
-	reading.temperature += _tempOffset;
+DhtCacheStats getCacheStats() {
+	portENTER_CRITICAL(&_cacheMux);
+	DhtCacheStats stats = _cacheStats;
+	portEXIT_CRITICAL(&_cacheMux);
+	return stats;
+}
 
-	// TEST CHECKSUM
-	uint8_t sum = _bits[0] + _bits[1] + _bits[2] + _bits[3];
-	if (_bits[4] != sum) {
-		ESP_LOGW(DHT_TAG, "Pin %d checksum failed!", pin);
-		reading.status = DHTLIB_ERROR_CHECKSUM;
+/*
+ * State of one sensor's frame while all sensors are being sampled together.
+ * Rising edge 1 is the sensor's acknowledgement, rising edges 2-41 start the data bits,
+ * and the falling edge after each of those ends the bit (its width is the bit value).
+ */
+typedef struct DhtCapture {
+	uint8_t pin;
+	uint8_t level;
+	uint8_t rises;
+	uint8_t bitCount;
+	uint32_t riseMicros;
+	uint32_t lastEdgeMicros;
+	uint8_t bits[5];
+	int status;
+} DhtCapture;
+
+static void IRAM_ATTR _captureEdge(DhtCapture *capture, uint8_t level, uint32_t now) {
+	uint32_t previousEdgeMicros = capture->lastEdgeMicros;
+	capture->level = level;
+	capture->lastEdgeMicros = now;
+
+	if (level == HIGH) {
+		// The line may still be settling from the host's release; the acknowledgement is an 80us low
+		if (capture->rises == 0 && (now - previousEdgeMicros) < DHTLIB_BIT_THRESHOLD_US) {
+			return;
+		}
+		capture->rises++;
+		capture->riseMicros = now;
+		return;
 	}
 
-	reading.status = DHTLIB_OK;
-	return reading;
+	// Falling edges before the first data bit are the start of the response
+	if (capture->rises < 2) {
+		return;
+	}
+
+	uint32_t width = now - capture->riseMicros;
+	_recordPulse(capture->pin, width);
+	if (width > DHTLIB_BIT_THRESHOLD_US) {
+		capture->bits[capture->bitCount / 8] |= 128 >> (capture->bitCount % 8);
+	}
+
+	if (++capture->bitCount == 40) {
+		capture->status = DHTLIB_OK;
+	}
+}
+
+/*
+ * Wakes every sensor in 'pins' at once and samples all of the data lines in a single polling loop,
+ * so reading N sensors costs about as long as reading one. At most DHTLIB_MAX_PARALLEL pins.
+ */
+static void _capturePins(const uint8_t pins[], Reading readings[], uint8_t count) {
+	DhtCapture captures[DHTLIB_MAX_PARALLEL];
+	memset(captures, 0, sizeof(captures));
+
+	// REQUEST SAMPLE
+	METRIC_BEGIN(wakeStarted);
+	for (uint8_t i = 0; i < count; i++) {
+		pinModeOutput(pins[i]);
+		digitalWrite(pins[i], LOW);
+	}
+	delay(DHTLIB_DHT_WAKEUP);
+	for (uint8_t i = 0; i < count; i++) {
+		digitalWrite(pins[i], HIGH);
+		pinModeInput(pins[i]);
+	}
+	METRIC_END(METRIC_DHT_WAKE, wakeStarted);
+
+	uint32_t start = micros();
+	for (uint8_t i = 0; i < count; i++) {
+		captures[i].pin = pins[i];
+		captures[i].level = HIGH;
+		captures[i].lastEdgeMicros = start;
+		captures[i].status = DHTLIB_ERROR_TIMEOUT;
+	}
+
+	// CAPTURE EDGES ON ALL LINES UNTIL EVERY FRAME IS COMPLETE OR DEAD
+	if (_disableIRQ) portENTER_CRITICAL(&mux);
+	uint8_t pending = count;
+	while (pending > 0) {
+		uint64_t levels = readInputs();
+		uint32_t now = micros();
+		pending = 0;
+		for (uint8_t i = 0; i < count; i++) {
+			DhtCapture *capture = &captures[i];
+			if (capture->bitCount == 40 || (now - capture->lastEdgeMicros) > DHTLIB_EDGE_TIMEOUT_US) {
+				continue;
+			}
+			uint8_t level = (levels >> capture->pin) & 0x1;
+			if (level != capture->level) {
+				_captureEdge(capture, level, now);
+			}
+			pending++;
+		}
+		if ((now - start) > DHTLIB_FRAME_TIMEOUT_US) {
+			break;
+		}
+	}
+	if (_disableIRQ) portEXIT_CRITICAL(&mux);
+	METRIC_END(METRIC_DHT_CAPTURE, start);
+
+	for (uint8_t i = 0; i < count; i++) {
+		if (captures[i].status != DHTLIB_OK) {
+			ESP_LOGW(DHT_TAG, "Pin %d timed out after %d of 40 bits", captures[i].pin, captures[i].bitCount);
+			readings[i] = _failedReading(captures[i].status);
+			continue;
+		}
+		readings[i] = _decodeBits(captures[i].pin, captures[i].bits);
+		_storeReading(captures[i].pin, readings[i]);
+	}
+}
+
+/*
+ * Reads every pin in 'pins' on the wire, all at once. Results land in the matching slot of
+ * 'readings'; a pin read less than DHTLIB_MIN_INTERVAL_MS ago gets DHTLIB_ERROR_TOO_SOON.
+ */
+void readPins(const uint8_t pins[], Reading readings[], uint8_t count) {
+	while (count > DHTLIB_MAX_PARALLEL) {
+		readPins(pins, readings, DHTLIB_MAX_PARALLEL);
+		pins += DHTLIB_MAX_PARALLEL;
+		readings += DHTLIB_MAX_PARALLEL;
+		count -= DHTLIB_MAX_PARALLEL;
+	}
+
+	uint8_t wirePins[DHTLIB_MAX_PARALLEL];
+	uint8_t wireSlots[DHTLIB_MAX_PARALLEL];
+	Reading wireReadings[DHTLIB_MAX_PARALLEL];
+	uint8_t wired = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		if (_claimWire(pins[i])) {
+			wirePins[wired] = pins[i];
+			wireSlots[wired++] = i;
+		} else {
+			readings[i] = _failedReading(DHTLIB_ERROR_TOO_SOON);
+		}
+	}
+	if (wired == 0) {
+		return;
+	}
+	_capturePins(wirePins, wireReadings, wired);
+	for (uint8_t i = 0; i < wired; i++) {
+		readings[wireSlots[i]] = wireReadings[i];
+	}
+}
+
+/*
+ * Asynchronous reads: the wake pulse and the frame timeout are one-shot timers and the
+ * edges are timestamped by a GPIO interrupt, so nothing spins while the sensor is talking.
+ */
+typedef enum DhtAsyncPhase {
+	DHT_ASYNC_IDLE = 0,
+	DHT_ASYNC_WAKING,
+	DHT_ASYNC_CAPTURING
+} DhtAsyncPhase;
+
+typedef struct DhtAsyncRead {
+	DhtCapture capture;
+	Timer timer;
+	DhtCallback callback;
+	void *arg;
+	volatile DhtAsyncPhase phase;
+#if CONFIG_METRICS
+	uint32_t phaseMicros;
+#endif
+} DhtAsyncRead;
+
+static DhtAsyncRead _asyncReads[DHTLIB_MAX_PARALLEL];
+static portMUX_TYPE _asyncMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR _edgeIsr(void *arg) {
+	DhtCapture *capture = (DhtCapture *) arg;
+	uint8_t level = digitalRead(capture->pin);
+	if (capture->bitCount < 40 && level != capture->level) {
+		_captureEdge(capture, level, micros());
+	}
+}
+
+static void _asyncTimerCallback(void *arg) {
+	DhtAsyncRead *read = (DhtAsyncRead *) arg;
+	DhtCapture *capture = &read->capture;
+
+	if (read->phase == DHT_ASYNC_WAKING) {
+		// Edge timestamps need a fast CPU; between reads it is free to drop to the minimum frequency
+		holdMaxCpuFrequency();
+		read->phase = DHT_ASYNC_CAPTURING;
+		/*
+		 * The sensor answers 20-40us after the line is released, sooner than attaching the handler
+		 * reliably takes, so attach first. The line already counts as high, so the release itself
+		 * isn't taken for an edge.
+		 */
+		capture->level = HIGH;
+		capture->lastEdgeMicros = micros();
+		attachInterrupt(capture->pin, _edgeIsr, capture);
+		digitalWrite(capture->pin, HIGH);
+		pinModeInput(capture->pin);
+#if CONFIG_METRICS
+		metrics_record(METRIC_DHT_WAKE, capture->lastEdgeMicros - read->phaseMicros);
+		read->phaseMicros = capture->lastEdgeMicros;
+#endif
+		startTimer(read->timer, DHTLIB_FRAME_TIMEOUT_US);
+		return;
+	}
+
+	detachInterrupt(capture->pin);
+	releaseMaxCpuFrequency();
+	METRIC_END(METRIC_DHT_CAPTURE, read->phaseMicros);
+
+	Reading reading;
+	if (capture->status == DHTLIB_OK) {
+		reading = _decodeBits(capture->pin, capture->bits);
+		_storeReading(capture->pin, reading);
+	} else {
+		ESP_LOGW(DHT_TAG, "Pin %d timed out after %d of 40 bits", capture->pin, capture->bitCount);
+		reading = _failedReading(capture->status);
+	}
+
+	DhtCallback callback = read->callback;
+	void *callbackArg = read->arg;
+	read->phase = DHT_ASYNC_IDLE;
+	callback(capture->pin, reading, callbackArg);
+}
+
+/*
+ * Needs initInterrupts() to have been called first (for the GPIO ISR service). The edges are
+ * timestamped on the core that called it.
+ */
+esp_err_t initAsyncReads() {
+	for (int i = 0; i < DHTLIB_MAX_PARALLEL; i++) {
+		esp_err_t err = createTimer(&_asyncReads[i].timer, _asyncTimerCallback, &_asyncReads[i], "dht");
+		if (err != ESP_OK) {
+			return err;
+		}
+	}
+	return ESP_OK;
+}
+
+/*
+ * Starts reading 'pin' and returns immediately. 'callback' is invoked from the timer task
+ * once the frame is complete or has timed out, so it should only hand the reading off (e.g. to a queue).
+ * Fails with ESP_ERR_INVALID_STATE if the pin is already being read or was read less than
+ * DHTLIB_MIN_INTERVAL_MS ago. Every pin has a line of its own, so any number of reads can be
+ * started together without their frames getting in each other's way.
+ */
+esp_err_t readPinAsync(uint8_t pin, DhtCallback callback, void *arg) {
+	DhtAsyncRead *read = NULL;
+	bool busy = false;
+
+	portENTER_CRITICAL(&_asyncMux);
+	for (int i = 0; i < DHTLIB_MAX_PARALLEL; i++) {
+		if (_asyncReads[i].phase != DHT_ASYNC_IDLE && _asyncReads[i].capture.pin == pin) {
+			busy = true;
+		}
+		if (read == NULL && _asyncReads[i].phase == DHT_ASYNC_IDLE) {
+			read = &_asyncReads[i];
+		}
+	}
+	if (busy) {
+		read = NULL;
+	}
+	// The pin goes in with the phase, so a second read of it started meanwhile finds the slot busy
+	if (read != NULL) {
+		read->phase = DHT_ASYNC_WAKING;
+		memset(&read->capture, 0, sizeof(read->capture));
+		read->capture.pin = pin;
+		read->capture.status = DHTLIB_ERROR_TIMEOUT;
+	}
+	portEXIT_CRITICAL(&_asyncMux);
+
+	if (read == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!_claimWire(pin)) {
+		read->phase = DHT_ASYNC_IDLE;
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	read->callback = callback;
+	read->arg = arg;
+#if CONFIG_METRICS
+	read->phaseMicros = micros();
+#endif
+
+	// REQUEST SAMPLE
+	pinModeOutput(pin);
+	digitalWrite(pin, LOW);
+	startTimer(read->timer, DHTLIB_DHT_WAKEUP * 1000);
+	return ESP_OK;
+}
+
+/*
+ * getReading() without blocking: a reading of 'pin' no older than 'maxAgeMillis' is handed to
+ * 'callback' straight away (on the calling task) if the cache has one, otherwise the pin is read with
+ * readPinAsync(), and fails like it does.
+ */
+esp_err_t getReadingAsync(uint8_t pin, uint32_t maxAgeMillis, DhtCallback callback, void *arg) {
+	Reading reading;
+	if (_cachedReading(pin, maxAgeMillis, &reading)) {
+		callback(pin, reading, arg);
+		return ESP_OK;
+	}
+	return readPinAsync(pin, callback, arg);
 }
 
 int _readSensor(uint8_t pin) {
@@ -115,24 +638,24 @@ int _readSensor(uint8_t pin) {
 	// REQUEST SAMPLE
 
 	pinModeOutput(pin);
-	gpio_set_level(pin, LOW);
+	digitalWrite(pin, LOW);
 	delay(DHTLIB_DHT_WAKEUP);
-	gpio_set_level(pin, HIGH);
+	digitalWrite(pin, HIGH);
 	pinModeInput(pin);
 	delayMicroseconds(40);
 
 	// GET ACKNOWLEDGE or TIMEOUT
-	uint16_t loopCnt = DHTLIB_TIMEOUT;
-	while (gpio_get_level(pin) == LOW) {
-		if (--loopCnt == 0) {
+	uint32_t t = micros();
+	while (digitalRead(pin) == LOW) {
+		if ((micros() - t) > DHTLIB_TIMEOUT_US) {
 			ESP_LOGW(DHT_TAG, "Pin %d failed while waiting for acknowledgement (sensor didn't pull high)", pin);
 			return DHTLIB_ERROR_TIMEOUT;
 		}
 	}
 
-	loopCnt = DHTLIB_TIMEOUT;
-	while (gpio_get_level(pin) == HIGH) {
-		if (--loopCnt == 0) {
+	t = micros();
+	while (digitalRead(pin) == HIGH) {
+		if ((micros() - t) > DHTLIB_TIMEOUT_US) {
 			ESP_LOGW(DHT_TAG, "Pin %d failed while waiting for sensor response (sensor stayed high)", pin);
 			return DHTLIB_ERROR_TIMEOUT;
 		}
@@ -140,25 +663,25 @@ int _readSensor(uint8_t pin) {
 
 	// READ THE OUTPUT - 40 BITS => 5 BYTES
 	for (uint8_t i = 40; i != 0; i--) {
-		loopCnt = DHTLIB_TIMEOUT;
-		while (gpio_get_level(pin) == LOW) {
-			if (--loopCnt == 0) {
+		t = micros();
+		while (digitalRead(pin) == LOW) {
+			if ((micros() - t) > DHTLIB_TIMEOUT_US) {
 				ESP_LOGW(DHT_TAG, "Pin %d failed while reading data", pin);
 				return DHTLIB_ERROR_TIMEOUT;
 			}
 		}
 
-		uint32_t t = micros();
-
-		loopCnt = DHTLIB_TIMEOUT;
-		while (gpio_get_level(pin) == HIGH) {
-			if (--loopCnt == 0) {
+		t = micros();
+		while (digitalRead(pin) == HIGH) {
+			if ((micros() - t) > DHTLIB_TIMEOUT_US) {
 				ESP_LOGW(DHT_TAG, "Pin %d timed out while waiting for sensor to pull low after data transmission", pin);
 				return DHTLIB_ERROR_TIMEOUT;
 			}
 		}
+		uint32_t width = micros() - t;
+		_recordPulse(pin, width);
 
-		if ((micros() - t) > 40) {
+		if (width > DHTLIB_BIT_THRESHOLD_US) {
 			_bits[idx] |= mask;
 		}
 		mask >>= 1;
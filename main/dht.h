@@ -8,26 +8,65 @@
 #define DHTLIB_OK                0
 #define DHTLIB_ERROR_CHECKSUM   -1
 #define DHTLIB_ERROR_TIMEOUT    -2
+#define DHTLIB_ERROR_TOO_SOON   -3
 #define DHTLIB_INVALID_VALUE    -999
 
 #define DHTLIB_DHT_WAKEUP       10
 
-// max timeout is 100usec.
-// For a 16Mhz proc that is max 1600 clock cycles
-// loops using TIMEOUT use at least 4 clock cycli
-// so 100 us takes max 400 loops
-// so by dividing F_CPU by 40000 we "fail" as fast as possible
-#define DHTLIB_TIMEOUT (240000000L/40000)
+// A DHT22 must be left alone for this long between reads
+#define DHTLIB_MIN_INTERVAL_MS  2000
 
+// Timeouts are in microseconds of esp_timer time, so they hold whatever frequency
+// the CPU has been scaled to. The longest level the sensor holds during a frame is
+// 80us; a line that doesn't change for DHTLIB_TIMEOUT_US is treated as dead.
+// A whole frame (response + 40 bits) takes a bit over 5ms.
+#define DHTLIB_TIMEOUT_US       100
+#define DHTLIB_FRAME_TIMEOUT_US 6000
+#define DHTLIB_EDGE_TIMEOUT_US  200
+
+// A data bit is a 1 if its high pulse is longer than this (nominally 26-28us for a 0, 70us for a 1)
+#define DHTLIB_BIT_THRESHOLD_US 40
+
+#define DHTLIB_HISTOGRAM_BUCKETS  12
+#define DHTLIB_HISTOGRAM_BUCKET_US 8
+
+#define DHTLIB_MAX_PARALLEL     8
+
+#include <stdbool.h>
 #include <stdint.h>
+#include "esp_err.h"
 
+// Both values in tenths (% RH and °C), exactly as the sensor sends them
 typedef struct reading {
-	float humidity;
-	float temperature;
+	int16_t humidityTenths;
+	int16_t temperatureTenths;
 	int status;
 } Reading;
 
+typedef struct DhtCacheStats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t refused;
+} DhtCacheStats;
+
 Reading readPin(uint8_t pin);
+void readPins(const uint8_t pins[], Reading readings[], uint8_t count);
+Reading getReading(uint8_t pin, uint32_t maxAgeMillis);
+void getReadings(const uint8_t pins[], Reading readings[], uint8_t count, uint32_t maxAgeMillis);
+DhtCacheStats getCacheStats();
+#if CONFIG_READING_FORMAT_BENCHMARK
+int checkDecoding();
+#endif
+
+typedef void (*DhtCallback)(uint8_t pin, Reading reading, void *arg);
+
+void getPulseHistogram(uint8_t pin, uint16_t histogram[DHTLIB_HISTOGRAM_BUCKETS]);
+void resetPulseHistogram(uint8_t pin);
+void dumpPulseHistogram(uint8_t pin);
+
+esp_err_t initAsyncReads();
+esp_err_t readPinAsync(uint8_t pin, DhtCallback callback, void *arg);
+esp_err_t getReadingAsync(uint8_t pin, uint32_t maxAgeMillis, DhtCallback callback, void *arg);
 
 #endif
 
@@ -0,0 +1,79 @@
+#include "filter.h"
+#include "dht.h"
+
+#include <stdlib.h>
+
+#define WINDOW CONFIG_FILTER_MEDIAN_WINDOW
+
+_Static_assert(WINDOW >= 1 && WINDOW <= FILTER_MAX_MEDIAN_WINDOW, "CONFIG_FILTER_MEDIAN_WINDOW is out of range");
+
+// Insertion sort of at most FILTER_MAX_MEDIAN_WINDOW values, cheaper than qsort at this size
+static int16_t _median(const int16_t window[], uint8_t count) {
+	int16_t sorted[FILTER_MAX_MEDIAN_WINDOW];
+	for (int i = 0; i < count; i++) {
+		int16_t value = window[i];
+		int j = i;
+		while (j > 0 && sorted[j - 1] > value) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = value;
+	}
+	return sorted[count / 2];
+}
+
+static int16_t _average(int32_t *average, int16_t value) {
+	*average += (((int32_t) value << 8) - *average) * CONFIG_FILTER_EWMA_PERCENT / 100;
+	return (*average + 128) >> 8;
+}
+
+/*
+ * Smooths a healthy record in place. Failed readings are left alone and don't disturb the window.
+ */
+void filter_smooth(SensorFilter *filter, TelemetryRecord *record) {
+	if (record->status != DHTLIB_OK) {
+		return;
+	}
+
+	filter->humidityWindow[filter->windowNext] = record->humidityTenths;
+	filter->temperatureWindow[filter->windowNext] = record->temperatureTenths;
+	filter->windowNext = (filter->windowNext + 1) % WINDOW;
+	if (filter->windowCount < WINDOW) {
+		filter->windowCount++;
+	}
+	int16_t humidity = _median(filter->humidityWindow, filter->windowCount);
+	int16_t temperature = _median(filter->temperatureWindow, filter->windowCount);
+
+	// Start the average at the first value rather than ramping up from zero
+	if (!filter->smoothing) {
+		filter->humidityAverage = (int32_t) humidity << 8;
+		filter->temperatureAverage = (int32_t) temperature << 8;
+		filter->smoothing = true;
+	}
+	record->humidityTenths = _average(&filter->humidityAverage, humidity);
+	record->temperatureTenths = _average(&filter->temperatureAverage, temperature);
+}
+
+/*
+ * Returns true, and remembers the record as the last one reported, if the record should be
+ * published. The heartbeat goes by the record's own timestamp, so it holds across deep sleep.
+ */
+bool filter_should_report(SensorFilter *filter, const TelemetryRecord *record) {
+	filter->samples++;
+	bool report = !filter->reported
+			|| record->status != filter->reportedStatus
+			|| record->epochMillis - filter->reportedMillis >= (int64_t) CONFIG_FILTER_HEARTBEAT_SEC * 1000;
+	if (!report && record->status == DHTLIB_OK) {
+		report = abs(record->humidityTenths - filter->reportedHumidity) >= CONFIG_FILTER_HUMIDITY_DEADBAND
+				|| abs(record->temperatureTenths - filter->reportedTemperature) >= CONFIG_FILTER_TEMPERATURE_DEADBAND;
+	}
+	if (report) {
+		filter->reported = true;
+		filter->reportedStatus = record->status;
+		filter->reportedHumidity = record->humidityTenths;
+		filter->reportedTemperature = record->temperatureTenths;
+		filter->reportedMillis = record->epochMillis;
+		filter->reports++;
+	}
+	return report;
+}
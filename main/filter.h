@@ -0,0 +1,47 @@
+#ifndef filter_h
+#define filter_h
+
+/*
+ * Per-sensor smoothing and change-driven reporting, so an incubator that sits at the same
+ * temperature all day doesn't publish the same numbers every sampling period.
+ *
+ * filter_smooth() runs a healthy reading through a median of the last CONFIG_FILTER_MEDIAN_WINDOW
+ * readings, which throws away single-sample spikes, and then an exponentially weighted moving
+ * average (CONFIG_FILTER_EWMA_PERCENT of each new value). filter_should_report() then decides if
+ * the smoothed reading is worth publishing: it is when either value has moved by the deadband since
+ * the last report, when the sensor's status changed, or when nothing has been reported for
+ * CONFIG_FILTER_HEARTBEAT_SEC.
+ *
+ * A zeroed SensorFilter is ready to use, so the state can live in RTC memory across deep sleep.
+ * Not thread safe; a filter belongs to the sampling stage.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "telemetry.h"
+
+#define FILTER_MAX_MEDIAN_WINDOW 9
+
+typedef struct SensorFilter {
+	int16_t humidityWindow[FILTER_MAX_MEDIAN_WINDOW];
+	int16_t temperatureWindow[FILTER_MAX_MEDIAN_WINDOW];
+	uint8_t windowCount;
+	uint8_t windowNext;
+	bool smoothing;
+	int32_t humidityAverage; // tenths, scaled by 256
+	int32_t temperatureAverage;
+	bool reported;
+	int8_t reportedStatus;
+	int16_t reportedHumidity;
+	int16_t reportedTemperature;
+	int64_t reportedMillis;
+	uint32_t samples;
+	uint32_t reports;
+} SensorFilter;
+
+void filter_smooth(SensorFilter *filter, TelemetryRecord *record);
+bool filter_should_report(SensorFilter *filter, const TelemetryRecord *record);
+
+#endif
+
+// END OF FILE
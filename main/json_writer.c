@@ -0,0 +1,215 @@
+#include "json_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/*
+ * Keys are NULL for array elements. All output goes through _putChar, which stops writing once only
+ * the byte reserved for the terminator is left and flags the overflow.
+ */
+
+static void _putChar(JsonWriter *writer, char c) {
+	if (writer->length + 1 >= writer->size) {
+		writer->overflow = true;
+		return;
+	}
+	writer->buffer[writer->length++] = c;
+}
+
+static void _putString(JsonWriter *writer, const char *s) {
+	while (*s) {
+		_putChar(writer, *s++);
+	}
+}
+
+static void _putUnsigned(JsonWriter *writer, uint32_t value) {
+	char digits[10];
+	int count = 0;
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (count) {
+		_putChar(writer, digits[--count]);
+	}
+}
+
+static void _putEscaped(JsonWriter *writer, const char *s) {
+	static const char hex[] = "0123456789abcdef";
+
+	_putChar(writer, '"');
+	for (; *s; s++) {
+		char c = *s;
+		if (c == '"' || c == '\\') {
+			_putChar(writer, '\\');
+			_putChar(writer, c);
+		} else if ((unsigned char) c < 0x20) {
+			_putString(writer, "\\u00");
+			_putChar(writer, hex[(c >> 4) & 0xF]);
+			_putChar(writer, hex[c & 0xF]);
+		} else {
+			_putChar(writer, c);
+		}
+	}
+	_putChar(writer, '"');
+}
+
+/*
+ * Writes the separator and key that go in front of every value.
+ */
+static void _putKey(JsonWriter *writer, const char *key) {
+	if (writer->length > 0) {
+		char previous = writer->buffer[writer->length - 1];
+		if (previous != '{' && previous != '[') {
+			_putChar(writer, ',');
+		}
+	}
+	if (key) {
+		_putEscaped(writer, key);
+		_putChar(writer, ':');
+	}
+}
+
+void json_begin(JsonWriter *writer, char *buffer, size_t size) {
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->length = 0;
+	writer->overflow = false;
+	_putChar(writer, '{');
+}
+
+/*
+ * Closes the document and NUL-terminates it. Returns false if anything had to be dropped.
+ */
+bool json_end(JsonWriter *writer) {
+	_putChar(writer, '}');
+	if (writer->size > 0) {
+		writer->buffer[writer->length] = '\0';
+	}
+	return !writer->overflow;
+}
+
+void json_begin_object(JsonWriter *writer, const char *key) {
+	_putKey(writer, key);
+	_putChar(writer, '{');
+}
+
+void json_end_object(JsonWriter *writer) {
+	_putChar(writer, '}');
+}
+
+void json_begin_array(JsonWriter *writer, const char *key) {
+	_putKey(writer, key);
+	_putChar(writer, '[');
+}
+
+void json_end_array(JsonWriter *writer) {
+	_putChar(writer, ']');
+}
+
+void json_string(JsonWriter *writer, const char *key, const char *value) {
+	_putKey(writer, key);
+	_putEscaped(writer, value);
+}
+
+void json_int(JsonWriter *writer, const char *key, int32_t value) {
+	_putKey(writer, key);
+	if (value < 0) {
+		_putChar(writer, '-');
+		_putUnsigned(writer, -(uint32_t) value);
+	} else {
+		_putUnsigned(writer, value);
+	}
+}
+
+void json_uint(JsonWriter *writer, const char *key, uint32_t value) {
+	_putKey(writer, key);
+	_putUnsigned(writer, value);
+}
+
+/*
+ * A value in tenths with exactly one decimal, e.g. -10.3, without going through a float.
+ */
+void json_tenths(JsonWriter *writer, const char *key, int16_t tenths) {
+	char text[JSON_TENTHS_SIZE];
+
+	json_format_tenths(tenths, text);
+	_putKey(writer, key);
+	_putString(writer, text);
+}
+
+/*
+ * Writes 'tenths' as a NUL-terminated decimal with one digit after the point and returns its length.
+ * Gives the same text as printf("%.1f", tenths / 10.0) for every int16_t.
+ */
+size_t json_format_tenths(int16_t tenths, char text[JSON_TENTHS_SIZE]) {
+	char *cursor = text;
+	uint32_t magnitude = tenths;
+	if (tenths < 0) {
+		*cursor++ = '-';
+		magnitude = -(int32_t) tenths;
+	}
+
+	char digits[4];
+	int count = 0;
+	uint32_t whole = magnitude / 10;
+	do {
+		digits[count++] = '0' + whole % 10;
+		whole /= 10;
+	} while (whole);
+	while (count) {
+		*cursor++ = digits[--count];
+	}
+	*cursor++ = '.';
+	*cursor++ = '0' + magnitude % 10;
+	*cursor = '\0';
+	return cursor - text;
+}
+
+void json_bool(JsonWriter *writer, const char *key, bool value) {
+	_putKey(writer, key);
+	_putString(writer, value ? "true" : "false");
+}
+
+#if CONFIG_READING_FORMAT_BENCHMARK
+
+// Keeps the timed loops from being optimised away
+static volatile size_t sink;
+
+/*
+ * Checks json_format_tenths() against snprintf("%.1f") of the float for every int16_t, and logs the
+ * nanoseconds each takes per value. Run once at start up.
+ */
+void benchmark_tenths() {
+	static const char *TAG = "json_writer";
+	char expected[16];
+	char text[JSON_TENTHS_SIZE];
+	uint32_t mismatches = 0;
+
+	for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+		snprintf(expected, sizeof(expected), "%.1f", tenths / 10.0f);
+		json_format_tenths(tenths, text);
+		if (strcmp(expected, text) != 0) {
+			if (mismatches++ == 0) {
+				ESP_LOGE(TAG, "%d tenths formatted as %s rather than %s", tenths, text, expected);
+			}
+		}
+	}
+
+	int64_t started = esp_timer_get_time();
+	for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+		sink = snprintf(expected, sizeof(expected), "%.1f", tenths / 10.0f);
+	}
+	int64_t floatMicros = esp_timer_get_time() - started;
+
+	started = esp_timer_get_time();
+	for (int32_t tenths = INT16_MIN; tenths <= INT16_MAX; tenths++) {
+		sink = json_format_tenths(tenths, text);
+	}
+	int64_t tenthsMicros = esp_timer_get_time() - started;
+
+	ESP_LOGI(TAG, "Tenths: %u of 65536 values differ from snprintf, %lld ns each with snprintf of a float, %lld ns with json_format_tenths",
+			mismatches, (long long) (floatMicros * 1000 / 65536), (long long) (tenthsMicros * 1000 / 65536));
+}
+#endif
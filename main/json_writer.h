@@ -0,0 +1,44 @@
+#ifndef json_writer_h
+#define json_writer_h
+
+/*
+ * A streaming JSON writer that formats straight into a caller-supplied buffer. It never allocates;
+ * once the buffer is full further writes are dropped and json_end() reports the overflow.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Room for any int16_t in tenths ("-3276.8") and the terminator
+#define JSON_TENTHS_SIZE 8
+
+typedef struct JsonWriter {
+	char *buffer;
+	size_t size;
+	size_t length;
+	bool overflow;
+} JsonWriter;
+
+void json_begin(JsonWriter *writer, char *buffer, size_t size);
+bool json_end(JsonWriter *writer);
+
+void json_begin_object(JsonWriter *writer, const char *key);
+void json_end_object(JsonWriter *writer);
+void json_begin_array(JsonWriter *writer, const char *key);
+void json_end_array(JsonWriter *writer);
+
+void json_string(JsonWriter *writer, const char *key, const char *value);
+void json_int(JsonWriter *writer, const char *key, int32_t value);
+void json_uint(JsonWriter *writer, const char *key, uint32_t value);
+void json_tenths(JsonWriter *writer, const char *key, int16_t tenths);
+void json_bool(JsonWriter *writer, const char *key, bool value);
+
+size_t json_format_tenths(int16_t tenths, char text[JSON_TENTHS_SIZE]);
+#if CONFIG_READING_FORMAT_BENCHMARK
+void benchmark_tenths();
+#endif
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,171 @@
+#include "metrics.h"
+
+#if CONFIG_METRICS
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+/*
+ * Values below 4 get a bucket each; above that, bucket 4 * (octave - 1) + the two bits after the
+ * leading one. Anything from 2^25 up lands in the last bucket.
+ */
+#define BUCKETS 96
+// Room for the application's tasks and the system's, with some to spare
+#define MAX_TASKS 32
+
+typedef struct Histogram {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t buckets[BUCKETS];
+} Histogram;
+
+static const char *spanNames[METRIC_SPANS] = {
+	"dht_wake_us",
+	"dht_capture_us",
+	"serialize_us",
+	"publish_us",
+	"step_cycles",
+	"sample_us"
+};
+
+static portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+static Histogram histograms[METRIC_SPANS];
+
+static inline uint32_t IRAM_ATTR _bucket(uint32_t value) {
+	if (value < 4) {
+		return value;
+	}
+	uint32_t octave = 31 - __builtin_clz(value);
+	uint32_t bucket = 4 * (octave - 1) + ((value >> (octave - 2)) & 3);
+	return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+// The smallest value that lands in 'bucket'
+static uint32_t _bucketValue(uint32_t bucket) {
+	if (bucket < 4) {
+		return bucket;
+	}
+	uint32_t octave = bucket / 4 + 1;
+	return (4 + bucket % 4) << (octave - 2);
+}
+
+void IRAM_ATTR metrics_record(MetricSpan span, uint32_t value) {
+	Histogram *histogram = &histograms[span];
+	uint32_t bucket = _bucket(value);
+
+	portENTER_CRITICAL_ISR(&metricsMux);
+	if (histogram->count == 0 || value < histogram->min) {
+		histogram->min = value;
+	}
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+	histogram->count++;
+	histogram->buckets[bucket]++;
+	portEXIT_CRITICAL_ISR(&metricsMux);
+}
+
+static uint32_t _percentile(const Histogram *histogram, uint32_t percent) {
+	// The rank of the percentile, rounded up so p99 of a few samples is the largest one
+	uint32_t rank = (histogram->count * (uint64_t) percent + 99) / 100;
+	uint32_t seen = 0;
+	for (uint32_t bucket = 0; bucket < BUCKETS; bucket++) {
+		seen += histogram->buckets[bucket];
+		if (seen >= rank && seen > 0) {
+			uint32_t value = _bucketValue(bucket);
+			if (value < histogram->min) {
+				return histogram->min;
+			}
+			return value > histogram->max ? histogram->max : value;
+		}
+	}
+	return histogram->max;
+}
+
+static void _writeSpans(JsonWriter *json) {
+	static Histogram histogram;
+
+	json_begin_object(json, "spans");
+	for (int span = 0; span < METRIC_SPANS; span++) {
+		portENTER_CRITICAL(&metricsMux);
+		histogram = histograms[span];
+		memset(&histograms[span], 0, sizeof(histograms[span]));
+		portEXIT_CRITICAL(&metricsMux);
+
+		// [count, min, p50, p99, max]
+		json_begin_array(json, spanNames[span]);
+		json_uint(json, NULL, histogram.count);
+		json_uint(json, NULL, histogram.min);
+		json_uint(json, NULL, _percentile(&histogram, 50));
+		json_uint(json, NULL, _percentile(&histogram, 99));
+		json_uint(json, NULL, histogram.max);
+		json_end_array(json);
+	}
+	json_end_object(json);
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static const char *TAG = "metrics";
+
+/*
+ * CPU use of each task since the last document, as a percentage of both cores, and its unused stack.
+ * FreeRTOS won't give a partial list, so with more than MAX_TASKS tasks it's left empty (and logged).
+ */
+static void _writeTasks(JsonWriter *json) {
+	static TaskStatus_t tasks[MAX_TASKS];
+	static struct {
+		UBaseType_t number;
+		uint32_t runtime;
+	} previous[MAX_TASKS];
+	static uint32_t previousTotal = 0;
+	uint32_t total;
+
+	UBaseType_t running = uxTaskGetNumberOfTasks();
+	if (running > MAX_TASKS) {
+		ESP_LOGW(TAG, "%u tasks, more than the %d there is room for; leaving the task list out", running, MAX_TASKS);
+	}
+	UBaseType_t count = uxTaskGetSystemState(tasks, MAX_TASKS, &total);
+	uint32_t elapsed = (total - previousTotal) * portNUM_PROCESSORS;
+	previousTotal = total;
+
+	json_begin_object(json, "tasks");
+	for (UBaseType_t i = 0; i < count; i++) {
+		uint32_t runtime = tasks[i].ulRunTimeCounter;
+		for (int j = 0; j < MAX_TASKS; j++) {
+			if (previous[j].number == tasks[i].xTaskNumber) {
+				runtime -= previous[j].runtime;
+				break;
+			}
+		}
+		// [cpu %, stack bytes never used]
+		json_begin_array(json, tasks[i].pcTaskName);
+		json_uint(json, NULL, elapsed > 0 ? (uint64_t) runtime * 100 / elapsed : 0);
+		json_uint(json, NULL, tasks[i].usStackHighWaterMark);
+		json_end_array(json);
+	}
+	json_end_object(json);
+
+	memset(previous, 0, sizeof(previous));
+	for (UBaseType_t i = 0; i < count; i++) {
+		previous[i].number = tasks[i].xTaskNumber;
+		previous[i].runtime = tasks[i].ulRunTimeCounter;
+	}
+}
+#endif
+
+void metrics_write(JsonWriter *json) {
+	json_uint(json, "uptime_s", esp_timer_get_time() / 1000000);
+	json_uint(json, "heap_free", esp_get_free_heap_size());
+	json_uint(json, "heap_min", esp_get_minimum_free_heap_size());
+	_writeSpans(json);
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	_writeTasks(json);
+#endif
+}
+
+#endif
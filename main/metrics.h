@@ -0,0 +1,45 @@
+#ifndef metrics_h
+#define metrics_h
+
+/*
+ * Hot-path timing, built only with CONFIG_METRICS. Each span is a fixed set of log-linear buckets in
+ * static memory (four per power of two, so a percentile is within 25%), which a METRIC_END costs a
+ * few dozen cycles to update and which is safe from interrupts and either core.
+ *
+ * metrics_write() puts every span's count, min, p50, p99 and max, the per-task CPU use, and the free
+ * and minimum-ever free heap into one JSON document, then starts the spans over. Without
+ * CONFIG_METRICS the macros expand to nothing.
+ */
+
+#include <stdint.h>
+#include "common.h"
+#include "json_writer.h"
+
+typedef enum MetricSpan {
+	METRIC_DHT_WAKE = 0,   // µs the wake pulse actually took
+	METRIC_DHT_CAPTURE,    // µs from releasing the line to the end of the frame
+	METRIC_SERIALIZE,      // µs building a message body
+	METRIC_PUBLISH,        // µs in esp_mqtt_client_publish
+	METRIC_STEP,           // CPU cycles in a step interrupt that stepped a motor
+	METRIC_SAMPLE,         // µs reading, smoothing and queueing every sensor once
+	METRIC_SPANS
+} MetricSpan;
+
+#if CONFIG_METRICS
+#define METRIC_BEGIN(start) uint32_t start = micros()
+#define METRIC_END(span, start) metrics_record(span, micros() - (start))
+#define METRIC_BEGIN_CYCLES(start) uint32_t start = cycleCount()
+#define METRIC_END_CYCLES(span, start) metrics_record(span, cycleCount() - (start))
+#else
+#define METRIC_BEGIN(start)
+#define METRIC_END(span, start)
+#define METRIC_BEGIN_CYCLES(start)
+#define METRIC_END_CYCLES(span, start)
+#endif
+
+void IRAM_ATTR metrics_record(MetricSpan span, uint32_t value);
+void metrics_write(JsonWriter *json);
+
+#endif
+
+// END OF FILE
@@ -1,226 +1,69 @@
 #include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
-#include "freertos/queue.h"
 
-#include "esp_wifi.h"
 #include "esp_log.h"
-#include "esp_event_loop.h"
 #include "esp_pm.h"
 #include "esp_system.h"
-#include "esp_event_loop.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 
 #include "nvs_flash.h"
+#if CONFIG_STATIC_ALLOCATION_CHECK
+#include "esp_heap_trace.h"
+#endif
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 
-#include "lwip/sockets.h"
-#include "lwip/dns.h"
-#include "lwip/netdb.h"
-#include "lwip/err.h"
-#include "lwip/apps/sntp.h"
-
-#include "mqtt_client.h"
-
 #include "driver/gpio.h"
 
 #include "dht.h"
 
-#include "soc/timer_group_struct.h"
-#include "soc/timer_group_reg.h"
-
-#include "cJSON.h"
+#include "json_writer.h"
+#include "telemetry.h"
+#include "reading_buffer.h"
+#include "reading_queue.h"
+#include "scheduler.h"
+#include "timestamp.h"
+#include "metrics.h"
+#include "sensors.h"
+#include "sensor_health.h"
+#include "sampling.h"
+#include "publish.h"
+#include "wifi.h"
 
 #include "stepper.h"
 #include "common.h"
 
-/*set the ssid and password via "make menuconfig"*/
-#define DEFAULT_SSID CONFIG_WIFI_SSID
-#define DEFAULT_PWD CONFIG_WIFI_PASSWORD
-
-#define DEFAULT_LISTEN_INTERVAL CONFIG_WIFI_LISTEN_INTERVAL
-
-#if CONFIG_POWER_SAVE_MIN_MODEM
-#define DEFAULT_PS_MODE WIFI_PS_MIN_MODEM
-#elif CONFIG_POWER_SAVE_MAX_MODEM
-#define DEFAULT_PS_MODE WIFI_PS_MAX_MODEM
-#elif CONFIG_POWER_SAVE_NONE
-#define DEFAULT_PS_MODE WIFI_PS_NONE
-#else
-#define DEFAULT_PS_MODE WIFI_PS_NONE
-#endif /*CONFIG_POWER_SAVE_MODEM*/
-
 #define ESP_INTR_FLAG_DEFAULT 0
 
-#define LOW 0
-#define HIGH 1
-
 static const char *TAG = "power_save";
-static EventGroupHandle_t wifi_event_group;
-const static int CONNECTED_BIT = BIT0;
-
-// Throttle sensor reads to avoid polling too frequently
-const unsigned int MIN_SENSOR_READ_MILLIS = 2500;
-
-int pins[4] = { GPIO_NUM_17, GPIO_NUM_5, GPIO_NUM_18, GPIO_NUM_19 };
 
-typedef struct MqttMessage {
-  char topic[128];
-  char body[128];
-  bool retained;
-} MqttMessage;
+// How often the sensors are sampled; the DHT layer refuses to read any of them more often than every 2 s
+#define SAMPLE_PERIOD_MILLIS 5000
 
-MqttMessage mqttMessage;
 TaskHandle_t stepperTask;
-static struct tm timeinfo;
-static char strftime_buf[64];
-static char measurement[6];
-
-static void obtain_time(void);
-static void initialize_sntp(void);
-
-
-esp_mqtt_client_handle_t client;
-
-static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
-	esp_mqtt_client_handle_t client = event->client;
-	int msg_id;
-	switch (event->event_id) {
-	case MQTT_EVENT_CONNECTED:
-		ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-		msg_id = esp_mqtt_client_publish(client, "/topic/qos1", "data_3", 0, 1, 0);
-		ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-
-		msg_id = esp_mqtt_client_subscribe(client, "/topic/qos0", 0);
-		ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-		msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
-		ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-		msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
-		ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
-		break;
-	case MQTT_EVENT_DISCONNECTED:
-		ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-		break;
-
-	case MQTT_EVENT_SUBSCRIBED:
-		ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-		msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-		ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-		break;
-	case MQTT_EVENT_UNSUBSCRIBED:
-		ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-		break;
-	case MQTT_EVENT_PUBLISHED:
-		ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-		break;
-	case MQTT_EVENT_DATA:
-		ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-		printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-		printf("DATA=%.*s\r\n", event->data_len, event->data);
-		break;
-	case MQTT_EVENT_ERROR:
-		ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
-		break;
-	default:
-		ESP_LOGI(TAG, "Other event id:%d", event->event_id);
-		break;
-	}
-	return ESP_OK;
-}
-
-static esp_err_t event_handler(void *ctx, system_event_t *event) {
-	switch (event->event_id) {
-	case SYSTEM_EVENT_STA_START:
-		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_START");
-		ESP_ERROR_CHECK(esp_wifi_connect());
-		break;
-	case SYSTEM_EVENT_STA_GOT_IP:
-		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_GOT_IP");
-		ESP_LOGI(TAG, "got IP:%s\n", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
-		xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
-		break;
-	case SYSTEM_EVENT_STA_DISCONNECTED:
-		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
-		ESP_ERROR_CHECK(esp_wifi_connect());
-		xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
-		break;
-	default:
-		break;
-	}
-	return ESP_OK;
-}
+TaskHandle_t publishTask;
+TaskHandle_t sampleTask;
+TaskHandle_t schedulerTask;
+// Told by each task that sets up hardware once it has
+static TaskHandle_t setupTask;
 
-/*init wifi as sta and set power save mode*/
-static void wifi_power_save(void) {
-	tcpip_adapter_init();
-	wifi_event_group = xEventGroupCreate();
-	ESP_ERROR_CHECK(esp_event_loop_init(event_handler, NULL));
-
-	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-	wifi_config_t wifi_config = {
-			.sta = {
-					.ssid = DEFAULT_SSID,
-					.password =	DEFAULT_PWD,
-					.listen_interval = DEFAULT_LISTEN_INTERVAL,
-			},
-	};
-	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-
-	ESP_LOGI(TAG, "start the Wi-Fi SSID:[%s]", CONFIG_WIFI_SSID);
-	ESP_ERROR_CHECK(esp_wifi_start());
-
-	ESP_LOGI(TAG, "Waiting for wifi");
-	xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, false, true, portMAX_DELAY);
-
-	ESP_LOGI(TAG, "esp_wifi_set_ps().");
-	esp_wifi_set_ps(DEFAULT_PS_MODE);
-}
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+/*
+ * Kept in RTC memory across deep sleep (wifi.c keeps the access point and lease). The system time
+ * itself keeps running on the RTC timer while asleep, so SNTP is only needed now and then.
+ */
+typedef struct WakeState {
+	uint32_t wakes;
+	uint32_t lastAwakeMillis;
+	uint32_t lastWakeToPublishMillis;
+} WakeState;
 
-static void mqtt_app_start(void)
-{
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = CONFIG_BROKER_URL,
-        .event_handle = mqtt_event_handler,
-        // .user_context = (void *)your_context
-    };
-
-#if CONFIG_BROKER_URL_FROM_STDIN
-    char line[128];
-
-    if (strcmp(mqtt_cfg.uri, "FROM_STDIN") == 0) {
-        int count = 0;
-        printf("Please enter url of mqtt broker\n");
-        while (count < 128) {
-            int c = fgetc(stdin);
-            if (c == '\n') {
-                line[count] = '\0';
-                break;
-            } else if (c > 0 && c < 127) {
-                line[count] = c;
-                ++count;
-            }
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-        }
-        mqtt_cfg.uri = line;
-        printf("Broker url: %s\n", line);
-    } else {
-        ESP_LOGE(TAG, "Configuration mismatch: wrong broker url");
-        abort();
-    }
-#endif /* CONFIG_BROKER_URL_FROM_STDIN */
-
-    client = esp_mqtt_client_init(&mqtt_cfg);
-    esp_mqtt_client_start(client);
-}
+static RTC_DATA_ATTR WakeState wakeState;
+#endif
 
 /*
  * Didn't look too closely at what this stuff does, copied it from the power_save example
@@ -249,128 +92,144 @@ void start_up_stuff() {
 #endif // CONFIG_PM_ENABLE
 }
 
-static void obtain_time(void) {
-	ESP_LOGI(TAG, "Waiting in 'obtain_time' for Wi-Fi to be connected");
-	EventBits_t bits = xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, false, true, portMAX_DELAY);
-	if ((bits & CONNECTED_BIT) == 0) {
-		ESP_LOGE(TAG, "Wi-Fi is not connected, failed to obtain_time");
-	} else {
-		ESP_LOGI(TAG, "    Wi-Fi is connected!");
-	}
-	initialize_sntp();
-
-	// wait for time to be set
-	time_t now = 0;
-	struct tm timeinfo = { 0 };
-	int retry = 0;
-	const int retry_count = 10;
-	while (timeinfo.tm_year < (2019 - 1900) && ++retry < retry_count) {
-		ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-		vTaskDelay(2000 / portTICK_PERIOD_MS);
-		time(&now);
-		localtime_r(&now, &timeinfo);
-	}
-
-	// Set timezone to Eastern Standard Time and print local time
-	setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0", 1);
-	tzset();
+static void notify_stepper(void *arg) {
+	xTaskNotifyGive(stepperTask);
 }
 
-static void initialize_sntp(void) {
-	ESP_LOGI(TAG, "Initializing SNTP");
-	sntp_setoperatingmode(SNTP_OPMODE_POLL);
-	sntp_setservername(0, "ca.pool.ntp.org");
-	sntp_init();
-}
+static Job rotateJob = { .name = "rotate", .function = notify_stepper };
 
-void get_time(struct tm * timeinfo) {
-	time_t now;
-	time(&now);
-	localtime_r(&now, timeinfo);
-	// Is time set? If not, tm_year will be (1970 - 1900).
-	if (timeinfo->tm_year < (2019 - 1900)) {
-		ESP_LOGI(TAG, "Time is not set yet. Connecting to WiFi and getting time over NTP.");
-		obtain_time();
-		// update 'now' variable with current time
-		time(&now);
-	}
+#if CONFIG_STEPPER_MODE_WAVE
+#define STEPPER_MODE STEP_WAVE
+#elif CONFIG_STEPPER_MODE_FULL
+#define STEPPER_MODE STEP_FULL
+#elif CONFIG_STEPPER_MODE_MICRO
+#define STEPPER_MODE STEP_MICRO
+#else
+#define STEPPER_MODE STEP_HALF
+#endif
 
-	localtime_r(&now, timeinfo);
+static const StepperConfig trayConfigs[] = {
+	{
+		.pins = { CONFIG_STEPPER_PIN_1, CONFIG_STEPPER_PIN_2, CONFIG_STEPPER_PIN_3, CONFIG_STEPPER_PIN_4 },
+		.mode = STEPPER_MODE,
+		.stepsPerRevolution = CONFIG_STEPPER_STEPS_PER_REV,
+		.rpm = CONFIG_STEPPER_RPM
+	},
+#if CONFIG_STEPPER_SECOND_TRAY
+	{
+		.pins = { CONFIG_STEPPER_TRAY2_PIN_1, CONFIG_STEPPER_TRAY2_PIN_2, CONFIG_STEPPER_TRAY2_PIN_3, CONFIG_STEPPER_TRAY2_PIN_4 },
+		.mode = STEPPER_MODE,
+		.stepsPerRevolution = CONFIG_STEPPER_STEPS_PER_REV,
+		.rpm = CONFIG_STEPPER_RPM
+	},
+#endif
+};
+
+#define NUM_TRAYS (sizeof(trayConfigs) / sizeof(trayConfigs[0]))
+
+static Stepper trays[NUM_TRAYS];
+static Stepper *trayMotors[NUM_TRAYS];
+
+static void IRAM_ATTR rotation_done(void *arg) {
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	vTaskNotifyGiveFromISR(stepperTask, &higherPriorityTaskWoken);
+	if (higherPriorityTaskWoken) {
+		portYIELD_FROM_ISR();
+	}
 }
 
-void publish_mqtt_message(MqttMessage message) {
-	esp_mqtt_client_publish(client, message.topic, message.body, 0, 1, message.retained);
+static esp_err_t set_up_trays() {
+	for (int i = 0; i < NUM_TRAYS; i++) {
+		esp_err_t err = set_up(&trays[i], &trayConfigs[i]);
+		if (err != ESP_OK) {
+			return err;
+		}
+		trayMotors[i] = &trays[i];
+	}
+	return ESP_OK;
 }
 
+/*
+ * A rotation takes far longer than a scheduler job should, so rotateJob just wakes this task up.
+ * Every tray turns together, and the next rotation is scheduled 10 s after they're all done.
+ */
 void vTaskCode(void * pvParameters) {
-	unsigned long currentMillis;
-	unsigned long lastRotation = 0;
-	MqttMessage message;
+	// static: a batched-mode body is too big for this task's stack
+	static MqttMessage message;
+	JsonWriter json;
 	strncpy(message.topic, "/stepper", sizeof("/stepper"));
+	message.length = 0;
 	message.retained = true;
 
-	struct tm timeinfo;
-	char strftime_buf[64];
+	static TimestampFormatter timestamps;
+	char strftime_buf[TIMESTAMP_TEXT_SIZE];
 
-	cJSON * root = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "status", cJSON_CreateString("initialized"));
-	cJSON_AddItemToObject(root, "timestamp", cJSON_CreateString("initialized"));
+	// Setting up the first tray puts the step interrupt on this task's core
+	ESP_ERROR_CHECK(set_up_trays());
+#if CONFIG_STEPPER_BENCHMARK
+	benchmark_stepper(&trays[0]);
+#endif
+	xTaskNotifyGive(setupTask);
 
 	while (1) {
-		currentMillis = millis();
-		if (currentMillis - lastRotation >= 10000) {
-			lastRotation = currentMillis;
-
-			get_time(&timeinfo);
-			strftime(strftime_buf, sizeof(strftime_buf), "%FT%T%Z", &timeinfo);
-			cJSON_ReplaceItemInObject(root, "timestamp", cJSON_CreateString(strftime_buf));
-
-			cJSON_ReplaceItemInObject(root, "status", cJSON_CreateString("turning"));
-			cJSON_PrintPreallocated(root, message.body, 128, false);
-			publish_mqtt_message(message);
-
-			rotate(pins);
-
-			strncpy(message.topic, "/stepper", sizeof("/stepper"));
-			cJSON_ReplaceItemInObject(root, "status", cJSON_CreateString("stopped"));
-			cJSON_PrintPreallocated(root, message.body, 128, false);
-			publish_mqtt_message(message);
-			delay(10 * 1000);
-			ESP_LOGI(TAG, "Delay over");
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		timestamp_format(&timestamps, timestamp_now(), strftime_buf, sizeof(strftime_buf));
+
+		json_begin(&json, message.body, sizeof(message.body));
+		json_string(&json, "status", "turning");
+		json_string(&json, "timestamp", strftime_buf);
+		publish_json_message(&message, &json);
+
+		// The steps come from a timer interrupt, this task just sleeps until they're done. Two turns,
+		// up to speed in half a second.
+		int64_t started = millis64();
+		int turning = 0;
+		hold_motion(trayMotors, NUM_TRAYS);
+		for (int i = 0; i < NUM_TRAYS; i++) {
+			Motion rotation = {
+				.steps = 2 * revolution_steps(&trays[i]),
+				.direction = STEPPER_FORWARD,
+				.acceleration = 2 * step_rate(&trays[i])
+			};
+			if (start_motion(&trays[i], &rotation, rotation_done, NULL) == ESP_OK) {
+				turning++;
+			}
 		}
+		release_motion(trayMotors, NUM_TRAYS);
+		while (turning-- > 0) {
+			ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+		}
+		ESP_LOGI(TAG, "Rotation took %u ms", (uint32_t) (millis64() - started));
+
+		timestamp_format(&timestamps, timestamp_now(), strftime_buf, sizeof(strftime_buf));
+		json_begin(&json, message.body, sizeof(message.body));
+		json_string(&json, "status", "stopped");
+		json_string(&json, "timestamp", strftime_buf);
+		publish_json_message(&message, &json);
+
+		scheduler_add(&rotateJob, 10 * 1000 * 1000);
 	}
 }
 
-void vTaskMonitorHeap(void * pvParameters) {
-	unsigned long currentMillis;
-	unsigned long lastReport = 0;
-	MqttMessage message;
+static void report_heap(void *arg) {
+	static MqttMessage message;
+	JsonWriter json;
 	strncpy(message.topic, "heap", sizeof("heap"));
+	message.length = 0;
 	message.retained = true;
 
-	struct tm timeinfo;
-	char strftime_buf[64];
+	static TimestampFormatter timestamps;
+	char strftime_buf[TIMESTAMP_TEXT_SIZE];
 	char free_heap_buffer[32];
 
-	cJSON * root = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "free_heap", cJSON_CreateString("initialized"));
-	cJSON_AddItemToObject(root, "timestamp", cJSON_CreateString("initialized"));
+	timestamp_format(&timestamps, timestamp_now(), strftime_buf, sizeof(strftime_buf));
 
-	while (1) {
-		currentMillis = millis();
-		if (currentMillis - lastReport >= 60 * 1000) {
-			lastReport = currentMillis;
-
-			get_time(&timeinfo);
-			strftime(strftime_buf, sizeof(strftime_buf), "%FT%T%Z", &timeinfo);
-			cJSON_ReplaceItemInObject(root, "timestamp", cJSON_CreateString(strftime_buf));
-
-			sprintf(free_heap_buffer, "%u", xPortGetFreeHeapSize());
-			cJSON_ReplaceItemInObject(root, "free_heap", cJSON_CreateString(free_heap_buffer));
-			cJSON_PrintPreallocated(root, message.body, 128, false);
-			publish_mqtt_message(message);
-		}
-	}
+	sprintf(free_heap_buffer, "%u", xPortGetFreeHeapSize());
+	json_begin(&json, message.body, sizeof(message.body));
+	json_string(&json, "free_heap", free_heap_buffer);
+	json_string(&json, "timestamp", strftime_buf);
+	publish_json_message(&message, &json);
 }
 
 char * task_state_to_string(eTaskState taskState) {
@@ -390,28 +249,322 @@ char * task_state_to_string(eTaskState taskState) {
 	return "UNKNOWN STATE!";
 }
 
-void publish_reading(uint8_t pin, Reading reading) {
-	get_time(&timeinfo);
-	strftime(strftime_buf, 64, "%FT%T%Z", &timeinfo);
-	cJSON * root = cJSON_CreateObject();
-	cJSON_AddItemToObject(root, "timestamp", cJSON_CreateString(strftime_buf));
-
-	sprintf(mqttMessage.topic, "humidity/%d", pin);
-	snprintf(measurement, 6, "%.2f", reading.humidity);
-	cJSON_AddItemToObject(root, "relative_humidity", cJSON_CreateString(measurement));
-	cJSON_PrintPreallocated(root, mqttMessage.body, 128, false);
-	cJSON_DeleteItemFromObject(root, "relative_humidity");
-	publish_mqtt_message(mqttMessage);
-
-	sprintf(mqttMessage.topic, "temperature/%d", pin);
-	snprintf(measurement, 6, "%.2f", reading.temperature);
-	cJSON_AddItemToObject(root, "temperature", cJSON_CreateString(measurement));
-	cJSON_PrintPreallocated(root, mqttMessage.body, 128, false);
-	publish_mqtt_message(mqttMessage);
-
-	cJSON_Delete(root);
-	ESP_LOGI(TAG, "Reading: Status %d Humidity: %f Temperature: %f", reading.status, reading.humidity, reading.temperature);
+void vTaskPublish(void * pvParameters) {
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		publish_queued();
+	}
+}
+
+static void sample_job(void *arg) {
+	// Readings stamped with the time since boot would be no use to anyone
+	if (!timestamp_synced()) {
+		ESP_LOGI(TAG, "Time is not set yet, skipping this sample");
+		return;
+	}
+	xTaskNotifyGive(sampleTask);
+}
+
+static Job sampleJob = { .name = "sample", .function = sample_job, .periodMicros = SAMPLE_PERIOD_MILLIS * 1000 };
+
+/*
+ * The sensors are read on their own task so the capture can be pinned away from Wi-Fi. It installs
+ * the GPIO interrupt service itself, so the edge interrupts run on its core too.
+ */
+void vTaskSample(void * pvParameters) {
+	ESP_ERROR_CHECK(initInterrupts());
+	ESP_ERROR_CHECK(sampling_init());
+	xTaskNotifyGive(setupTask);
+
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#if CONFIG_TASK_TOPOLOGY_MEASURE
+		sampling_measure_start(sampleJob.periodMicros);
+#endif
+		if (sample_readings() > 0 && publishTask != NULL) {
+			xTaskNotifyGive(publishTask);
+		}
+	}
+}
+
+/*
+ * Every long-lived task, placed by the "Task topology" settings. With CONFIG_STATIC_ALLOCATION their
+ * stacks and control blocks are static instead of coming from the heap.
+ */
+typedef struct TaskPlan {
+	TaskFunction_t function;
+	const char *name;
+	uint32_t stackSize;
+	UBaseType_t priority;
+	BaseType_t core;
+	TaskHandle_t *handle;
+#if CONFIG_STATIC_ALLOCATION
+	StackType_t *stack;
+	StaticTask_t *buffer;
+#endif
+} TaskPlan;
+
+#define TASK_CORE(core) ((core) < 0 ? tskNO_AFFINITY : (core))
+
+#if CONFIG_STATIC_ALLOCATION
+static StackType_t sampleStack[CONFIG_TASK_SAMPLE_STACK];
+static StackType_t motionStack[CONFIG_TASK_MOTION_STACK];
+static StackType_t schedulerStack[CONFIG_TASK_SCHEDULER_STACK];
+static StackType_t publishStack[CONFIG_TASK_PUBLISH_STACK];
+static StaticTask_t taskBuffers[4];
+#define TASK_MEMORY(stackBuffer, index) .stack = stackBuffer, .buffer = &taskBuffers[index]
+#else
+#define TASK_MEMORY(stackBuffer, index)
+#endif
+
+static const TaskPlan taskPlan[] = {
+	{ .function = vTaskSample, .name = "SAMPLE", .stackSize = CONFIG_TASK_SAMPLE_STACK, .priority = CONFIG_TASK_SAMPLE_PRIORITY,
+			.core = TASK_CORE(CONFIG_TASK_SAMPLE_CORE), .handle = &sampleTask, TASK_MEMORY(sampleStack, 0) },
+	{ .function = vTaskCode, .name = "ROTATE_EGGS", .stackSize = CONFIG_TASK_MOTION_STACK, .priority = CONFIG_TASK_MOTION_PRIORITY,
+			.core = TASK_CORE(CONFIG_TASK_MOTION_CORE), .handle = &stepperTask, TASK_MEMORY(motionStack, 1) },
+	{ .function = scheduler_task, .name = "SCHEDULER", .stackSize = CONFIG_TASK_SCHEDULER_STACK, .priority = CONFIG_TASK_SCHEDULER_PRIORITY,
+			.core = TASK_CORE(CONFIG_TASK_SCHEDULER_CORE), .handle = &schedulerTask, TASK_MEMORY(schedulerStack, 2) },
+	{ .function = vTaskPublish, .name = "PUBLISH", .stackSize = CONFIG_TASK_PUBLISH_STACK, .priority = CONFIG_TASK_PUBLISH_PRIORITY,
+			.core = TASK_CORE(CONFIG_TASK_PUBLISH_CORE), .handle = &publishTask, TASK_MEMORY(publishStack, 3) },
+};
+
+#define NUM_TASKS (sizeof(taskPlan) / sizeof(taskPlan[0]))
+
+static esp_err_t start_tasks() {
+	for (int i = 0; i < NUM_TASKS; i++) {
+		const TaskPlan *plan = &taskPlan[i];
+#if CONFIG_STATIC_ALLOCATION
+		*plan->handle = xTaskCreateStaticPinnedToCore(plan->function, plan->name, plan->stackSize, NULL, plan->priority,
+				plan->stack, plan->buffer, plan->core);
+		if (*plan->handle == NULL) {
+			return ESP_FAIL;
+		}
+#else
+		if (xTaskCreatePinnedToCore(plan->function, plan->name, plan->stackSize, NULL, plan->priority, plan->handle,
+				plan->core) != pdPASS) {
+			return ESP_ERR_NO_MEM;
+		}
+#endif
+	}
+	return ESP_OK;
+}
+
+static void update_clock(void *arg) {
+	timestamp_update();
+}
+
+#if CONFIG_STATIC_ALLOCATION_CHECK
+static heap_trace_record_t heapTraceRecords[CONFIG_STATIC_ALLOCATION_CHECK_RECORDS];
+
+/*
+ * From here on nothing of ours should touch the heap, so trace whatever is allocated and not freed.
+ */
+static void start_heap_check() {
+	ESP_ERROR_CHECK(heap_trace_init_standalone(heapTraceRecords, CONFIG_STATIC_ALLOCATION_CHECK_RECORDS));
+	ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_LEAKS));
+}
+
+/*
+ * Wi-Fi, lwIP and the MQTT client allocate and free as they go, so a few allocations are always in
+ * flight. One report holding more than the last is heap creep, and gets dumped with its callers.
+ */
+static void check_heap() {
+	static size_t previousHeld = 0;
+	size_t held = heap_trace_get_count();
+
+	if (held >= CONFIG_STATIC_ALLOCATION_CHECK_RECORDS) {
+		ESP_LOGE(TAG, "Heap check: the trace is full, %u allocations since start-up are still held", held);
+		heap_trace_dump();
+	} else if (held > previousHeld) {
+		ESP_LOGE(TAG, "Heap check: %u allocations since start-up are still held, up from %u", held, previousHeld);
+		heap_trace_dump();
+	} else {
+		ESP_LOGI(TAG, "Heap check: %u allocations since start-up are still held", held);
+	}
+	previousHeld = held;
+}
+#endif
+
+static void report_tasks(void *arg) {
+	for (int i = 0; i < NUM_TASKS; i++) {
+		TaskHandle_t task = *taskPlan[i].handle;
+		ESP_LOGI(TAG, "%s (core %d, priority %u) is %s with %u of %u bytes of stack used at most", taskPlan[i].name,
+				taskPlan[i].core == tskNO_AFFINITY ? -1 : taskPlan[i].core, taskPlan[i].priority,
+				task_state_to_string(eTaskGetState(task)), taskPlan[i].stackSize - uxTaskGetStackHighWaterMark(task),
+				taskPlan[i].stackSize);
+	}
+	sampling_log_stats();
+	for (int i = 0; i < sensors_count(); i++) {
+		dumpPulseHistogram(sensors_get(i)->pin);
+	}
+	ESP_LOGI(TAG, "MQTT: %s, %d publishes awaiting a PUBACK", publish_connected() ? "connected" : "disconnected",
+			publish_unacked());
+	ReadingQueueStats queueStats = reading_queue_stats();
+	ESP_LOGI(TAG, "Reading queue: %u of %u queued, %u pushed, %u popped, %u dropped", queueStats.queued,
+			queueStats.capacity, queueStats.pushed, queueStats.popped, queueStats.dropped);
+#if CONFIG_STORE_AND_FORWARD
+	ReadingBufferStats bufferStats = reading_buffer_stats();
+	ESP_LOGI(TAG, "Store-and-forward: %u of %u buffered, %u spilled to NVS, %u dropped", bufferStats.buffered,
+			bufferStats.capacity, bufferStats.spilled, bufferStats.dropped);
+#endif
+	uint32_t quarantined = 0;
+	uint64_t wastedMicros = 0;
+	for (int i = 0; i < sensors_count(); i++) {
+		const SensorHealth *health = sensor_health_get(i);
+		quarantined += health->state == SENSOR_QUARANTINED;
+		wastedMicros += health->wastedMicros;
+	}
+	ESP_LOGI(TAG, "Sensor health: %u of %u quarantined, %u ms spent on failed reads", quarantined,
+			sensors_count(), (uint32_t) (wastedMicros / 1000));
+	DhtCacheStats cacheStats = getCacheStats();
+	ESP_LOGI(TAG, "Reading cache: %u hits, %u misses, %u reads refused as too soon", cacheStats.hits,
+			cacheStats.misses, cacheStats.refused);
+	scheduler_dump_stats();
+#if CONFIG_STATIC_ALLOCATION_CHECK
+	check_heap();
+#endif
+}
+
+#if CONFIG_METRICS
+/*
+ * Publishes the metrics document on its own; it's bigger than any other message.
+ */
+static void publish_metrics(void *arg) {
+	static char body[1280];
+	JsonWriter json;
+
+	json_begin(&json, body, sizeof(body));
+	metrics_write(&json);
+	if (!json_end(&json)) {
+		ESP_LOGW(TAG, "Metrics don't fit in %d bytes, dropping them", sizeof(body));
+		return;
+	}
+	publish_mqtt("metrics", body, 0, false);
+}
+
+static Job metricsJob = { .name = "metrics", .function = publish_metrics, .periodMicros = CONFIG_METRICS_PERIOD_SEC * 1000000ULL };
+#endif
+
+/*
+ * Publishes every sensor's health, retained, so a dead sensor shows up without digging through logs.
+ */
+static void publish_health(void *arg) {
+	static char body[SENSORS_MAX * 192];
+	JsonWriter json;
+
+	json_begin(&json, body, sizeof(body));
+	sensor_health_write(&json);
+	if (!json_end(&json)) {
+		ESP_LOGW(TAG, "Sensor health doesn't fit in %d bytes, dropping it", sizeof(body));
+		return;
+	}
+	publish_mqtt("health", body, 0, true);
+}
+
+static Job healthJob = { .name = "health", .function = publish_health, .periodMicros = CONFIG_SENSOR_HEALTH_PERIOD_SEC * 1000000ULL };
+static Job heapJob = { .name = "heap", .function = report_heap, .periodMicros = 60 * 1000 * 1000 };
+static Job reportJob = { .name = "report", .function = report_tasks, .periodMicros = 60 * 1000 * 1000 };
+static Job clockJob = { .name = "clock", .function = update_clock, .periodMicros = 10 * 1000 * 1000 };
+
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+static void publish_wake_stats() {
+	static MqttMessage message;
+	JsonWriter json;
+	strncpy(message.topic, "wake", sizeof(message.topic));
+	message.length = 0;
+	message.retained = true;
+
+	json_begin(&json, message.body, sizeof(message.body));
+	json_uint(&json, "wakes", wakeState.wakes);
+	json_uint(&json, "awake_ms", wakeState.lastAwakeMillis);
+	json_uint(&json, "wake_to_publish_ms", wakeState.lastWakeToPublishMillis);
+	publish_json_message(&message, &json);
+}
+
+/*
+ * One duty cycle: connect using whatever the last wake left in RTC memory, sample every sensor, wait
+ * for the broker to acknowledge the readings and go back to deep sleep. The stepper isn't driven in
+ * this mode. Never returns; the next wake starts over in app_main.
+ */
+static void deep_sleep_cycle() {
+	TickType_t connectTimeout = CONFIG_DEEP_SLEEP_CONNECT_TIMEOUT_MS / portTICK_PERIOD_MS;
+	// Every so often do the full scan, DHCP and SNTP sync anyway, in case the network moved on
+	bool refresh = wakeState.wakes % CONFIG_DEEP_SLEEP_REFRESH_WAKES == 0;
+	wakeState.wakes++;
+	if (refresh) {
+		wifi_forget_cache();
+	}
+	ESP_LOGI(TAG, "Wake %u, the last one was awake for %u ms and took %u ms to publish", wakeState.wakes,
+			wakeState.lastAwakeMillis, wakeState.lastWakeToPublishMillis);
+
+	start_up_stuff();
+	ESP_ERROR_CHECK(sensors_init());
+	sensor_health_init();
+	timestamp_init();
+	ESP_ERROR_CHECK(initCommon());
+	ESP_ERROR_CHECK(initInterrupts());
+#if CONFIG_STORE_AND_FORWARD
+	reading_buffer_init();
+#endif
+	ESP_ERROR_CHECK(sampling_init());
+
+	bool connected = wifi_connect(connectTimeout);
+	if (connected) {
+		wifi_cache_connection();
+		if (!timestamp_synced() || refresh) {
+			// The clock keeps running while asleep, so usually this just corrects the drift in the background
+			timestamp_start_sync();
+		}
+		publish_start();
+		int64_t connectStarted = millis64();
+		while (!publish_connected() && millis64() - connectStarted < CONFIG_DEEP_SLEEP_CONNECT_TIMEOUT_MS) {
+			delay(10);
+		}
+		connected = publish_connected();
+	} else {
+		ESP_LOGW(TAG, "Couldn't connect within %d ms, forgetting the cached access point and lease",
+				CONFIG_DEEP_SLEEP_CONNECT_TIMEOUT_MS);
+		wifi_forget_cache();
+	}
+
+	if (connected) {
+		publish_wake_stats();
+	}
+	// Only the very first wake has to wait for SNTP
+	int64_t syncStarted = millis64();
+	while (connected && !timestamp_update() && millis64() - syncStarted < CONFIG_DEEP_SLEEP_CONNECT_TIMEOUT_MS) {
+		delay(100);
+	}
+	if (timestamp_synced()) {
+		sample_readings();
+	}
+	publish_queued();
+	if (connected && refresh) {
+		publish_health(NULL);
+	}
+
+	int64_t publishStarted = millis64();
+	while (connected && publish_unacked() > 0 && millis64() - publishStarted < CONFIG_DEEP_SLEEP_CONNECT_TIMEOUT_MS) {
+		delay(10);
+	}
+	wakeState.lastWakeToPublishMillis = esp_timer_get_time() / 1000;
+	ESP_LOGI(TAG, "Published %s %u ms after waking", publish_unacked() == 0 ? "everything" : "some readings",
+			wakeState.lastWakeToPublishMillis);
+
+	publish_stop();
+	wifi_stop();
+
+	int64_t awakeMicros = esp_timer_get_time();
+	wakeState.lastAwakeMillis = awakeMicros / 1000;
+	int64_t sleepMicros = (int64_t) CONFIG_DEEP_SLEEP_INTERVAL_SEC * 1000000 - awakeMicros;
+	if (sleepMicros < 1000000) {
+		sleepMicros = 1000000;
+	}
+	ESP_LOGI(TAG, "Awake for %u ms, sleeping for %lld ms", wakeState.lastAwakeMillis, sleepMicros / 1000);
+	esp_sleep_enable_timer_wakeup(sleepMicros);
+	esp_deep_sleep_start();
 }
+#endif
 
 void app_main() {
 	ESP_LOGI(TAG, "[APP] Startup..");
@@ -425,91 +578,52 @@ void app_main() {
 	esp_log_level_set("TRANSPORT", ESP_LOG_VERBOSE);
 	esp_log_level_set("OUTBOX", ESP_LOG_VERBOSE);
 
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+	deep_sleep_cycle();
+#endif
+
 	start_up_stuff();
-	wifi_power_save();
-	mqtt_app_start();
+	ESP_ERROR_CHECK(sensors_init());
+	sensor_health_init();
+	wifi_connect(portMAX_DELAY);
+	publish_start();
 
 	ESP_LOGI(TAG, "Everything is all set up.");
 
-	set_up(pins);
-
-	// Invoke initially to set up SNTP
-	get_time(&timeinfo);
-
-	unsigned long currentMillis;
-	unsigned long lastSensorReadMillis = 0;
-	unsigned long lastTaskReport = 0;
-
-	xTaskCreate(vTaskCode, "ROTATE_EGGS", 3072, NULL, 2, &stepperTask);
-	xTaskCreate(vTaskMonitorHeap, "MONITOR_HEAP", 3072, NULL, 1, NULL);
-
-	Reading reading;
-	Reading averageReading;
-
-	while (1) {
-		currentMillis = millis();
-		if (currentMillis - lastSensorReadMillis >= MIN_SENSOR_READ_MILLIS * 2) {
-			lastSensorReadMillis = currentMillis;
-
-			int num_samples = 0;
-			averageReading.temperature = 0;
-			averageReading.humidity = 0;
-
-			reading = readPin(GPIO_NUM_26);
-			if (reading.status == DHTLIB_OK) {
-				publish_reading(GPIO_NUM_26, reading);
-				num_samples++;
-				averageReading.status = DHTLIB_OK;
-				averageReading.temperature += reading.temperature;
-				averageReading.humidity += reading.humidity;
-			}
-
-			reading = readPin(GPIO_NUM_27);
-			if (reading.status == DHTLIB_OK) {
-				publish_reading(GPIO_NUM_27, reading);
-				num_samples++;
-				averageReading.status = DHTLIB_OK;
-				averageReading.temperature += reading.temperature;
-				averageReading.humidity += reading.humidity;
-			}
-
-			reading = readPin(GPIO_NUM_25);
-			if (reading.status == DHTLIB_OK) {
-				publish_reading(GPIO_NUM_25, reading);
-				num_samples++;
-				averageReading.status = DHTLIB_OK;
-				averageReading.temperature += reading.temperature;
-				averageReading.humidity += reading.humidity;
-			}
-
-			reading = readPin(GPIO_NUM_33);
-			if (reading.status == DHTLIB_OK) {
-				publish_reading(GPIO_NUM_33, reading);
-				num_samples++;
-				averageReading.status = DHTLIB_OK;
-				averageReading.temperature += reading.temperature;
-				averageReading.humidity += reading.humidity;
-			}
-
-			if (num_samples > 0) {
-				averageReading.temperature /= num_samples;
-				averageReading.humidity /= num_samples;
-				publish_reading(255, averageReading);
-				ESP_LOGI(TAG, "The average (over %d samples) is: %.2f%cC and %.2f%%", num_samples, averageReading.temperature, 0x00B0, averageReading.humidity);
-			} else {
-				averageReading.status = DHTLIB_INVALID_VALUE;
-			}
-		}
+	ESP_ERROR_CHECK(initCommon());
+#if CONFIG_STORE_AND_FORWARD
+	reading_buffer_init();
+#endif
 
-		if (currentMillis - lastTaskReport >= 60000) {
-			lastTaskReport = currentMillis;
-			eTaskState stepperTaskState = eTaskGetState(stepperTask);
-			UBaseType_t highWaterMark = uxTaskGetStackHighWaterMark(stepperTask);
-			ESP_LOGI(TAG, "The task state is: %s with a high water mark of %d used", task_state_to_string(stepperTaskState), 3072 - highWaterMark);
-		}
+	// Readings wait for the clock, but nothing blocks on it
+	timestamp_init();
+	timestamp_start_sync();
+#if CONFIG_TIMESTAMP_BENCHMARK
+	benchmark_timestamps();
+#endif
+#if CONFIG_READING_FORMAT_BENCHMARK
+	checkDecoding();
+	benchmark_tenths();
+#endif
 
-		TIMERG0.wdt_wprotect = TIMG_WDT_WKEY_VALUE;
-		TIMERG0.wdt_feed = 1;
-		TIMERG0.wdt_wprotect = 0;
-	}
+	ESP_ERROR_CHECK(scheduler_init());
+	// The sample and motion tasks set up their interrupts on their own cores; wait until they have
+	setupTask = xTaskGetCurrentTaskHandle();
+	ESP_ERROR_CHECK(start_tasks());
+	ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+
+	// Nothing polls from here on: the jobs run off esp_timer and everything else blocks
+	ESP_ERROR_CHECK(scheduler_add(&clockJob, 0));
+	ESP_ERROR_CHECK(scheduler_add(&sampleJob, 0));
+	ESP_ERROR_CHECK(scheduler_add(&rotateJob, 10 * 1000 * 1000));
+	ESP_ERROR_CHECK(scheduler_add(&heapJob, 60 * 1000 * 1000));
+	ESP_ERROR_CHECK(scheduler_add(&reportJob, 60 * 1000 * 1000));
+	ESP_ERROR_CHECK(scheduler_add(&healthJob, healthJob.periodMicros));
+#if CONFIG_METRICS
+	ESP_ERROR_CHECK(scheduler_add(&metricsJob, metricsJob.periodMicros));
+#endif
+#if CONFIG_STATIC_ALLOCATION_CHECK
+	start_heap_check();
+#endif
 }
@@ -0,0 +1,420 @@
+#include "publish.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/portmacro.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "common.h"
+#include "dht.h"
+#include "metrics.h"
+#include "reading_buffer.h"
+#include "reading_queue.h"
+#include "timestamp.h"
+
+static const char *TAG = "publish";
+
+#if CONFIG_PUBLISH_MODE_BATCHED
+#define PUBLISH_BATCH_SIZE (CONFIG_BATCH_MAX_READINGS + SENSOR_ZONES_MAX)
+#else
+#define PUBLISH_BATCH_SIZE 8
+#endif
+
+// Only the publishing stage uses these
+static MqttMessage mqttMessage;
+#if !CONFIG_PAYLOAD_FORMAT_CBOR
+static TimestampFormatter publishTimestamps;
+static char strftime_buf[TIMESTAMP_TEXT_SIZE];
+#if !CONFIG_PUBLISH_MODE_BATCHED
+static char measurement[JSON_TENTHS_SIZE];
+#endif
+#endif
+
+static esp_mqtt_client_handle_t client;
+static volatile bool mqttConnected = false;
+
+/*
+ * QoS 1 messages handed to the client that the broker hasn't acknowledged yet, by msg_id, so only our
+ * own publishes are counted. The MQTT task can handle a PUBACK before esp_mqtt_client_publish() has
+ * returned its msg_id, so an entry goes up on publish and down on PUBACK (in either order) and is
+ * outstanding while it's positive.
+ */
+#define MAX_TRACKED_PUBLISHES 32
+
+typedef struct TrackedPublish {
+	int msgId;
+	int8_t pending;
+} TrackedPublish;
+
+static TrackedPublish trackedPublishes[MAX_TRACKED_PUBLISHES];
+static int unackedPublishes = 0;
+static portMUX_TYPE publishMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void track_publish(int msgId, int8_t change) {
+	TrackedPublish *entry = NULL;
+
+	portENTER_CRITICAL(&publishMux);
+	for (int i = 0; i < MAX_TRACKED_PUBLISHES; i++) {
+		TrackedPublish *tracked = &trackedPublishes[i];
+		if (tracked->pending != 0 && tracked->msgId == msgId) {
+			entry = tracked;
+			break;
+		}
+		if (entry == NULL && tracked->pending == 0) {
+			entry = tracked;
+		}
+	}
+	if (entry != NULL) {
+		bool wasPending = entry->pending > 0;
+		entry->msgId = msgId;
+		entry->pending += change;
+		unackedPublishes += (entry->pending > 0) - wasPending;
+	}
+	portEXIT_CRITICAL(&publishMux);
+
+	if (entry == NULL) {
+		ESP_LOGW(TAG, "More than %d publishes in flight, not tracking msg_id %d", MAX_TRACKED_PUBLISHES, msgId);
+	}
+}
+
+/*
+ * QoS 1 publishes the broker hasn't acknowledged yet.
+ */
+int publish_unacked() {
+	portENTER_CRITICAL(&publishMux);
+	int unacked = unackedPublishes;
+	portEXIT_CRITICAL(&publishMux);
+	return unacked;
+}
+
+bool publish_connected() {
+	return mqttConnected;
+}
+
+static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
+	switch (event->event_id) {
+	case MQTT_EVENT_CONNECTED:
+		ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+		mqttConnected = true;
+		break;
+	case MQTT_EVENT_DISCONNECTED:
+		ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+		mqttConnected = false;
+		break;
+
+	case MQTT_EVENT_SUBSCRIBED:
+		ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+		break;
+	case MQTT_EVENT_UNSUBSCRIBED:
+		ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
+		break;
+	case MQTT_EVENT_PUBLISHED:
+		ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+		track_publish(event->msg_id, -1);
+		break;
+	case MQTT_EVENT_DATA:
+		ESP_LOGI(TAG, "MQTT_EVENT_DATA");
+		printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
+		printf("DATA=%.*s\r\n", event->data_len, event->data);
+		break;
+	case MQTT_EVENT_ERROR:
+		ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+		break;
+	default:
+		ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+		break;
+	}
+	return ESP_OK;
+}
+
+/*
+ * Starts the MQTT client, which connects (and reconnects) to the broker in the background;
+ * publish_connected() says when it's up.
+ */
+void publish_start()
+{
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .uri = CONFIG_BROKER_URL,
+        .event_handle = mqtt_event_handler,
+        // .user_context = (void *)your_context
+    };
+
+#if CONFIG_BROKER_URL_FROM_STDIN
+    char line[128];
+
+    if (strcmp(mqtt_cfg.uri, "FROM_STDIN") == 0) {
+        int count = 0;
+        printf("Please enter url of mqtt broker\n");
+        while (count < 128) {
+            int c = fgetc(stdin);
+            if (c == '\n') {
+                line[count] = '\0';
+                break;
+            } else if (c > 0 && c < 127) {
+                line[count] = c;
+                ++count;
+            }
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        mqtt_cfg.uri = line;
+        printf("Broker url: %s\n", line);
+    } else {
+        ESP_LOGE(TAG, "Configuration mismatch: wrong broker url");
+        abort();
+    }
+#endif /* CONFIG_BROKER_URL_FROM_STDIN */
+
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    esp_mqtt_client_start(client);
+}
+
+void publish_stop() {
+	if (client != NULL) {
+		esp_mqtt_client_stop(client);
+	}
+}
+
+/*
+ * Returns false if the MQTT client refused the message (e.g. it isn't connected). 'length' is 0 for a
+ * NUL-terminated body.
+ */
+bool publish_mqtt(const char *topic, const char *body, int length, bool retained) {
+	METRIC_BEGIN(started);
+	int msg_id = esp_mqtt_client_publish(client, topic, body, length, 1, retained);
+	METRIC_END(METRIC_PUBLISH, started);
+	if (msg_id < 0) {
+		return false;
+	}
+	track_publish(msg_id, 1);
+	return true;
+}
+
+bool publish_mqtt_message(const MqttMessage *message) {
+	return publish_mqtt(message->topic, message->body, message->length, message->retained);
+}
+
+/*
+ * A message that doesn't fit is dropped with a warning and counts as handled, since retrying it can't help.
+ */
+bool publish_json_message(const MqttMessage *message, JsonWriter *json) {
+	if (!json_end(json)) {
+		ESP_LOGW(TAG, "Message for %s doesn't fit in %d bytes, dropping it", message->topic, (int) sizeof(message->body));
+		return true;
+	}
+	return publish_mqtt_message(message);
+}
+
+#if CONFIG_PUBLISH_MODE_BATCHED
+/*
+ * How many of 'records' go in the next batch: up to CONFIG_BATCH_MAX_READINGS sensor readings and, in
+ * slots of their own, up to SENSOR_ZONES_MAX zone aggregates. With 'sameCycle' the batch also stops
+ * at the first record from another sampling cycle.
+ */
+static int batch_entries(const TelemetryRecord records[], int count, bool sameCycle) {
+	int readings = 0;
+	int aggregates = 0;
+	int entries = 0;
+
+	for (; entries < count; entries++) {
+		if (sameCycle && records[entries].epochMillis != records[0].epochMillis) {
+			break;
+		}
+		if (records[entries].pin == TELEMETRY_ZONE_AGGREGATE) {
+			if (aggregates++ == SENSOR_ZONES_MAX) {
+				break;
+			}
+		} else if (readings++ == CONFIG_BATCH_MAX_READINGS) {
+			break;
+		}
+	}
+	return entries;
+}
+
+/*
+ * Publishes records on the "readings" topic, at most CONFIG_BATCH_MAX_READINGS sensors plus the zone
+ * aggregates per message (see batch_entries()). Every sensor goes out with its zone and status (failed sensors without
+ * values); each zone's aggregate goes in "zones". Returns how many records made it into the MQTT client.
+ */
+int publish_records(const TelemetryRecord records[], int count) {
+	int published = 0;
+	strncpy(mqttMessage.topic, "readings", sizeof(mqttMessage.topic));
+	mqttMessage.retained = false;
+
+	while (published < count) {
+		const TelemetryRecord *batch = &records[published];
+
+#if CONFIG_PAYLOAD_FORMAT_CBOR
+		int entries = batch_entries(batch, count - published, false);
+		METRIC_BEGIN(serializeStarted);
+		mqttMessage.length = telemetry_encode_batch(batch, entries, (uint8_t *) mqttMessage.body, sizeof(mqttMessage.body));
+		METRIC_END(METRIC_SERIALIZE, serializeStarted);
+		if (mqttMessage.length == 0) {
+			ESP_LOGW(TAG, "Batch of %d records doesn't fit in a message, dropping it", entries);
+		} else if (!publish_mqtt_message(&mqttMessage)) {
+			break;
+		}
+#else
+		// A JSON batch carries a single timestamp, so it never spans sampling cycles
+		int entries = batch_entries(batch, count - published, true);
+
+		JsonWriter json;
+		METRIC_BEGIN(serializeStarted);
+		timestamp_format(&publishTimestamps, batch[0].epochMillis, strftime_buf, sizeof(strftime_buf));
+		mqttMessage.length = 0;
+		json_begin(&json, mqttMessage.body, sizeof(mqttMessage.body));
+		json_string(&json, "timestamp", strftime_buf);
+		json_begin_array(&json, "readings");
+		for (int i = 0; i < entries; i++) {
+			if (batch[i].pin == TELEMETRY_ZONE_AGGREGATE) {
+				continue;
+			}
+			json_begin_object(&json, NULL);
+			json_uint(&json, "pin", batch[i].pin);
+			json_uint(&json, "zone", batch[i].zone);
+			json_int(&json, "status", batch[i].status);
+			if (batch[i].status == DHTLIB_OK) {
+				json_tenths(&json, "relative_humidity", batch[i].humidityTenths);
+				json_tenths(&json, "temperature", batch[i].temperatureTenths);
+			}
+			json_end_object(&json);
+		}
+		json_end_array(&json);
+		json_begin_array(&json, "zones");
+		for (int i = 0; i < entries; i++) {
+			if (batch[i].pin == TELEMETRY_ZONE_AGGREGATE && batch[i].status == DHTLIB_OK) {
+				json_begin_object(&json, NULL);
+				json_uint(&json, "zone", batch[i].zone);
+				json_tenths(&json, "relative_humidity", batch[i].humidityTenths);
+				json_tenths(&json, "temperature", batch[i].temperatureTenths);
+				json_end_object(&json);
+			}
+		}
+		json_end_array(&json);
+		METRIC_END(METRIC_SERIALIZE, serializeStarted);
+		if (!publish_json_message(&mqttMessage, &json)) {
+			break;
+		}
+#endif
+		published += entries;
+	}
+	return published;
+}
+#else
+/*
+ * Puts "<kind>/<pin>", or "<kind>/zone/<zone>" for an aggregate, in the message topic.
+ */
+static void record_topic(const char *kind, const TelemetryRecord *record) {
+	if (record->pin == TELEMETRY_ZONE_AGGREGATE) {
+		sprintf(mqttMessage.topic, "%s/zone/%d", kind, record->zone);
+	} else {
+		sprintf(mqttMessage.topic, "%s/%d", kind, record->pin);
+	}
+}
+
+#if CONFIG_PAYLOAD_FORMAT_CBOR
+/*
+ * One binary message per reading carrying both values, instead of a JSON message for each.
+ */
+static bool publish_record(const TelemetryRecord *record) {
+	record_topic("telemetry", record);
+	mqttMessage.retained = false;
+	METRIC_BEGIN(serializeStarted);
+	mqttMessage.length = telemetry_encode(record, (uint8_t *) mqttMessage.body, sizeof(mqttMessage.body));
+	METRIC_END(METRIC_SERIALIZE, serializeStarted);
+	if (mqttMessage.length == 0) {
+		ESP_LOGW(TAG, "Telemetry record for pin %d doesn't fit in a message, dropping it", record->pin);
+		return true;
+	}
+	return publish_mqtt_message(&mqttMessage);
+}
+#else
+static bool publish_record(const TelemetryRecord *record) {
+	JsonWriter json;
+	METRIC_BEGIN(serializeStarted);
+	timestamp_format(&publishTimestamps, record->epochMillis, strftime_buf, sizeof(strftime_buf));
+	mqttMessage.length = 0;
+	mqttMessage.retained = false;
+
+	record_topic("humidity", record);
+	json_format_tenths(record->humidityTenths, measurement);
+	json_begin(&json, mqttMessage.body, sizeof(mqttMessage.body));
+	json_string(&json, "timestamp", strftime_buf);
+	json_string(&json, "relative_humidity", measurement);
+	METRIC_END(METRIC_SERIALIZE, serializeStarted);
+	if (!publish_json_message(&mqttMessage, &json)) {
+		return false;
+	}
+
+#if CONFIG_METRICS
+	serializeStarted = micros();
+#endif
+	record_topic("temperature", record);
+	json_format_tenths(record->temperatureTenths, measurement);
+	json_begin(&json, mqttMessage.body, sizeof(mqttMessage.body));
+	json_string(&json, "timestamp", strftime_buf);
+	json_string(&json, "temperature", measurement);
+	METRIC_END(METRIC_SERIALIZE, serializeStarted);
+	return publish_json_message(&mqttMessage, &json);
+}
+#endif
+
+/*
+ * Publishes each healthy reading on its own topics, and each zone aggregate on its zone's. Returns how many records
+ * were dealt with before the MQTT client refused one.
+ */
+int publish_records(const TelemetryRecord records[], int count) {
+	for (int i = 0; i < count; i++) {
+		if (records[i].status == DHTLIB_OK && !publish_record(&records[i])) {
+			return i;
+		}
+	}
+	return count;
+}
+#endif
+
+#if CONFIG_STORE_AND_FORWARD
+/*
+ * Publishes buffered readings oldest first, a bounded number of batches per call so a long backlog
+ * doesn't flood the MQTT outbox. Stops as soon as the client refuses a message; whatever wasn't
+ * published stays buffered for the next call.
+ */
+static void drain_readings() {
+	TelemetryRecord records[PUBLISH_BATCH_SIZE];
+
+	for (int batch = 0; batch < CONFIG_STORE_AND_FORWARD_DRAIN_BATCHES && mqttConnected; batch++) {
+		size_t count = reading_buffer_peek(records, PUBLISH_BATCH_SIZE);
+		if (count == 0) {
+			return;
+		}
+		int published = publish_records(records, count);
+		reading_buffer_consume(published);
+		if (published < count) {
+			return;
+		}
+	}
+}
+#endif
+
+/*
+ * Takes everything the sampling stage queued and publishes it, or buffers it when store-and-forward
+ * is on.
+ */
+void publish_queued() {
+	TelemetryRecord records[PUBLISH_BATCH_SIZE];
+	size_t count;
+
+	while ((count = reading_queue_pop(records, PUBLISH_BATCH_SIZE)) > 0) {
+#if CONFIG_STORE_AND_FORWARD
+		for (int i = 0; i < count; i++) {
+			reading_buffer_append(&records[i]);
+		}
+#else
+		publish_records(records, count);
+#endif
+	}
+#if CONFIG_STORE_AND_FORWARD
+	drain_readings();
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef publish_h
+#define publish_h
+
+/*
+ * The publishing stage: the MQTT client and everything that turns records into messages on it. It
+ * only talks to the network through the ESP-IDF MQTT client (Wi-Fi is wifi.h's), so it builds and
+ * runs off-device too.
+ *
+ * publish_queued() takes whatever the sampling stage queued and publishes it, or buffers it when
+ * store-and-forward is on. Only the publishing stage (the PUBLISH task, or the deep sleep cycle)
+ * publishes; the connection state and the count of unacknowledged publishes can be read from any
+ * task.
+ */
+
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "json_writer.h"
+#include "sensors.h"
+#include "telemetry.h"
+
+#if CONFIG_PUBLISH_MODE_BATCHED
+// Room for the timestamp, a full batch of readings and, on top of them, every zone's aggregate
+#define MQTT_BODY_SIZE (96 + CONFIG_BATCH_MAX_READINGS * 80 + SENSOR_ZONES_MAX * 64)
+#else
+#define MQTT_BODY_SIZE 128
+#endif
+
+typedef struct MqttMessage {
+	char topic[128];
+	char body[MQTT_BODY_SIZE];
+	int length; // 0 when body is a NUL-terminated string
+	bool retained;
+} MqttMessage;
+
+void publish_start();
+void publish_stop();
+bool publish_connected();
+int publish_unacked();
+
+bool publish_mqtt(const char *topic, const char *body, int length, bool retained);
+bool publish_mqtt_message(const MqttMessage *message);
+bool publish_json_message(const MqttMessage *message, JsonWriter *json);
+int publish_records(const TelemetryRecord records[], int count);
+void publish_queued();
+
+#endif
+
+// END OF FILE
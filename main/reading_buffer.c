@@ -0,0 +1,233 @@
+#include "reading_buffer.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#if CONFIG_STORE_AND_FORWARD
+
+#define READING_BUFFER_MAGIC 0x52424632 // "RBF2", bumped whenever TelemetryRecord changes
+#define CAPACITY CONFIG_STORE_AND_FORWARD_CAPACITY
+#define SPILL_CHUNK (CAPACITY / 2)
+
+static const char *TAG = "reading_buffer";
+
+/*
+ * Everything here is in RTC slow memory and is not cleared on a deep sleep wake or a software reset,
+ * so the header is validated before it's trusted.
+ */
+typedef struct ReadingBufferState {
+	uint32_t magic;
+	uint16_t head;
+	uint16_t count;
+	uint32_t dropped;
+	uint32_t spillFirst;  // sequence number of the oldest spilled chunk
+	uint32_t spillNext;   // sequence number the next spilled chunk will get
+	uint16_t spillOffset; // records of the oldest spilled chunk that have already been consumed
+	uint16_t spillCount;  // records in the oldest spilled chunk (0 if not loaded)
+	uint32_t spilledRecords;
+} ReadingBufferState;
+
+static RTC_NOINIT_ATTR ReadingBufferState state;
+static RTC_NOINIT_ATTR TelemetryRecord ring[CAPACITY];
+
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+// The oldest spilled chunk while it's being drained, and scratch space while spilling
+static TelemetryRecord spillChunk[SPILL_CHUNK];
+
+static void _spillKey(uint32_t sequence, char key[16]) {
+	snprintf(key, 16, "spill%u", sequence);
+}
+
+static void _forgetSpilled(uint32_t count, bool lost) {
+	if (count > state.spilledRecords) {
+		count = state.spilledRecords;
+	}
+	state.spilledRecords -= count;
+	if (lost) {
+		state.dropped += count;
+	}
+}
+
+static bool _writeSpill(uint32_t sequence, const TelemetryRecord *records, size_t count) {
+	nvs_handle handle;
+	char key[16];
+	_spillKey(sequence, key);
+
+	if (nvs_open("readings", NVS_READWRITE, &handle) != ESP_OK) {
+		return false;
+	}
+	esp_err_t err = nvs_set_blob(handle, key, records, count * sizeof(TelemetryRecord));
+	if (err == ESP_OK) {
+		err = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	return err == ESP_OK;
+}
+
+static void _eraseSpill(uint32_t sequence) {
+	nvs_handle handle;
+	char key[16];
+	_spillKey(sequence, key);
+
+	if (nvs_open("readings", NVS_READWRITE, &handle) == ESP_OK) {
+		nvs_erase_key(handle, key);
+		nvs_commit(handle);
+		nvs_close(handle);
+	}
+}
+
+/*
+ * Loads the oldest spilled chunk into spillChunk, discarding (and counting as dropped) chunks that
+ * can't be read back.
+ */
+static bool _loadSpill() {
+	nvs_handle handle;
+	char key[16];
+
+	if (nvs_open("readings", NVS_READONLY, &handle) != ESP_OK) {
+		return false;
+	}
+	while (state.spillFirst != state.spillNext) {
+		size_t length = sizeof(spillChunk);
+		_spillKey(state.spillFirst, key);
+		if (nvs_get_blob(handle, key, spillChunk, &length) == ESP_OK && length > 0 && length % sizeof(TelemetryRecord) == 0) {
+			state.spillCount = length / sizeof(TelemetryRecord);
+			break;
+		}
+		ESP_LOGW(TAG, "Spilled chunk %u is unreadable, skipping it", state.spillFirst);
+		_forgetSpilled(SPILL_CHUNK - state.spillOffset, true);
+		state.spillFirst++;
+		state.spillOffset = 0;
+	}
+	nvs_close(handle);
+	return state.spillCount > 0;
+}
+
+static void _releaseOldestSpill() {
+	_eraseSpill(state.spillFirst);
+	state.spillFirst++;
+	state.spillOffset = 0;
+	state.spillCount = 0;
+}
+
+/*
+ * Moves the oldest half of the ring to NVS to make room, dropping the oldest spilled chunk first if
+ * all of the NVS chunks are in use.
+ */
+static bool _spillOldest() {
+	if (state.spillNext - state.spillFirst >= CONFIG_STORE_AND_FORWARD_NVS_BLOBS) {
+		if (state.spillCount > 0 || _loadSpill()) {
+			_forgetSpilled(state.spillCount - state.spillOffset, true);
+			_releaseOldestSpill();
+		}
+	}
+
+	for (int i = 0; i < SPILL_CHUNK; i++) {
+		spillChunk[i] = ring[(state.head + i) % CAPACITY];
+	}
+	// spillChunk no longer holds the oldest chunk, it gets reloaded on the next peek
+	state.spillCount = 0;
+	if (!_writeSpill(state.spillNext, spillChunk, SPILL_CHUNK)) {
+		ESP_LOGW(TAG, "Couldn't spill readings to NVS");
+		return false;
+	}
+
+	state.spillNext++;
+	state.spilledRecords += SPILL_CHUNK;
+	state.head = (state.head + SPILL_CHUNK) % CAPACITY;
+	state.count -= SPILL_CHUNK;
+	return true;
+}
+#endif
+
+void reading_buffer_init() {
+	if (state.magic != READING_BUFFER_MAGIC || state.head >= CAPACITY || state.count > CAPACITY) {
+		memset(&state, 0, sizeof(state));
+		state.magic = READING_BUFFER_MAGIC;
+		return;
+	}
+	// Cached spill chunk contents don't survive a reset
+	state.spillCount = 0;
+	ESP_LOGI(TAG, "Recovered %u buffered and %u spilled readings (%u dropped so far)", state.count, state.spilledRecords,
+			state.dropped);
+}
+
+void reading_buffer_append(const TelemetryRecord *record) {
+	if (state.count == CAPACITY) {
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+		if (!_spillOldest())
+#endif
+		{
+			state.head = (state.head + 1) % CAPACITY;
+			state.count--;
+			state.dropped++;
+		}
+	}
+
+	ring[(state.head + state.count) % CAPACITY] = *record;
+	state.count++;
+}
+
+/*
+ * Copies up to 'max' of the oldest records into 'records' without removing them.
+ * Spilled records are older than anything in the ring, so they come back first.
+ */
+size_t reading_buffer_peek(TelemetryRecord records[], size_t max) {
+	size_t count = 0;
+
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+	if (state.spillFirst != state.spillNext) {
+		if (state.spillCount == 0 && !_loadSpill()) {
+			return 0;
+		}
+		while (count < max && state.spillOffset + count < state.spillCount) {
+			records[count] = spillChunk[state.spillOffset + count];
+			count++;
+		}
+		return count;
+	}
+#endif
+
+	while (count < max && count < state.count) {
+		records[count] = ring[(state.head + count) % CAPACITY];
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Removes the 'count' oldest records, i.e. the ones the last peek returned (or a prefix of them).
+ */
+void reading_buffer_consume(size_t count) {
+#if CONFIG_STORE_AND_FORWARD_NVS_SPILL
+	if (state.spillFirst != state.spillNext && state.spillCount > 0) {
+		state.spillOffset += count;
+		_forgetSpilled(count, false);
+		if (state.spillOffset >= state.spillCount) {
+			_releaseOldestSpill();
+		}
+		return;
+	}
+#endif
+
+	if (count > state.count) {
+		count = state.count;
+	}
+	state.head = (state.head + count) % CAPACITY;
+	state.count -= count;
+}
+
+ReadingBufferStats reading_buffer_stats() {
+	ReadingBufferStats stats = {
+			.buffered = state.count,
+			.spilled = state.spilledRecords,
+			.dropped = state.dropped,
+			.capacity = CAPACITY
+	};
+	return stats;
+}
+
+#endif // CONFIG_STORE_AND_FORWARD
@@ -0,0 +1,35 @@
+#ifndef reading_buffer_h
+#define reading_buffer_h
+
+/*
+ * Store-and-forward buffer for readings taken while Wi-Fi or the broker is unreachable.
+ *
+ * Records live in a fixed ring in RTC slow memory (CONFIG_STORE_AND_FORWARD_CAPACITY entries), so they
+ * survive deep sleep and software resets. When the ring fills, the oldest records are either dropped
+ * or, with CONFIG_STORE_AND_FORWARD_NVS_SPILL, moved to NVS in chunks of half the ring, up to
+ * CONFIG_STORE_AND_FORWARD_NVS_BLOBS chunks. Anything beyond that is dropped and counted.
+ *
+ * Records come back oldest first through peek/consume, so a caller only removes what it actually
+ * managed to publish. Not thread safe; use from a single task.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "telemetry.h"
+
+typedef struct ReadingBufferStats {
+	uint32_t buffered;
+	uint32_t spilled;
+	uint32_t dropped;
+	uint32_t capacity;
+} ReadingBufferStats;
+
+void reading_buffer_init();
+void reading_buffer_append(const TelemetryRecord *record);
+size_t reading_buffer_peek(TelemetryRecord records[], size_t max);
+void reading_buffer_consume(size_t count);
+ReadingBufferStats reading_buffer_stats();
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,97 @@
+#include "reading_queue.h"
+#include "esp_attr.h"
+
+#define CAPACITY CONFIG_READING_QUEUE_CAPACITY
+
+_Static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CONFIG_READING_QUEUE_CAPACITY must be a power of two");
+
+/*
+ * The counters only ever go up and are used modulo CAPACITY, which stays right across their wrap
+ * because CAPACITY is a power of two. Each one has a single writer:
+ *
+ *  - claimed: producer, bumped before it starts writing a slot
+ *  - published: producer, bumped once the slot is written
+ *  - consumed: consumer
+ *
+ * So [consumed, published) is readable, and with drop-oldest a slot the consumer copied is only
+ * trustworthy if the producer hadn't claimed it again by the time the copy finished.
+ */
+static TelemetryRecord ring[CAPACITY];
+static uint32_t claimed = 0;
+static uint32_t published = 0;
+static uint32_t consumed = 0;
+
+static uint32_t producerDropped = 0;
+static uint32_t consumerDropped = 0;
+
+#define LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_ACQUIRE)
+#define STORE(counter, value) __atomic_store_n(&(counter), (value), __ATOMIC_RELEASE)
+
+/*
+ * Producer only. Returns false if the record was dropped.
+ */
+bool reading_queue_push(const TelemetryRecord *record) {
+	uint32_t head = published;
+#if CONFIG_READING_QUEUE_DROP_NEWEST
+	if (head - LOAD(consumed) >= CAPACITY) {
+		STORE(producerDropped, producerDropped + 1);
+		return false;
+	}
+#endif
+	STORE(claimed, head + 1);
+	// The claim has to be visible before the slot starts changing
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	ring[head % CAPACITY] = *record;
+	STORE(published, head + 1);
+	return true;
+}
+
+/*
+ * Consumer only. Copies up to 'max' of the oldest records into 'records' and removes them.
+ */
+size_t reading_queue_pop(TelemetryRecord records[], size_t max) {
+	size_t count = 0;
+	uint32_t tail = consumed;
+
+	while (count < max) {
+		uint32_t head = LOAD(published);
+		if (head == tail) {
+			break;
+		}
+		if (head - tail > CAPACITY) {
+			// Overwritten before we got to them
+			STORE(consumerDropped, consumerDropped + head - tail - CAPACITY);
+			tail = head - CAPACITY;
+		}
+
+		records[count] = ring[tail % CAPACITY];
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		tail++;
+		if (LOAD(claimed) - (tail - 1) > CAPACITY) {
+			// The producer came round again and overwrote it while we were copying
+			STORE(consumerDropped, consumerDropped + 1);
+			continue;
+		}
+		count++;
+	}
+
+	STORE(consumed, tail);
+	return count;
+}
+
+/*
+ * Safe from either side, but only a snapshot.
+ */
+ReadingQueueStats reading_queue_stats() {
+	uint32_t head = LOAD(published);
+	uint32_t tail = LOAD(consumed);
+	uint32_t queued = head - tail;
+	ReadingQueueStats stats = {
+		.queued = queued > CAPACITY ? CAPACITY : queued,
+		.pushed = head,
+		.popped = tail - LOAD(consumerDropped),
+		.dropped = LOAD(producerDropped) + LOAD(consumerDropped),
+		.capacity = CAPACITY
+	};
+	return stats;
+}
@@ -0,0 +1,33 @@
+#ifndef reading_queue_h
+#define reading_queue_h
+
+/*
+ * Fixed-capacity ring of stamped records between the sampling stage (the only producer) and the
+ * publishing stage (the only consumer). Neither side takes a lock or blocks, so a slow MQTT publish
+ * never holds up a sensor read.
+ *
+ * When the ring is full, CONFIG_READING_QUEUE_DROP_OLDEST overwrites the oldest record (the consumer
+ * notices and skips it) and CONFIG_READING_QUEUE_DROP_NEWEST refuses the new one. Either way the loss
+ * is counted.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "telemetry.h"
+
+typedef struct ReadingQueueStats {
+	uint32_t queued;
+	uint32_t pushed;
+	uint32_t popped;
+	uint32_t dropped;
+	uint32_t capacity;
+} ReadingQueueStats;
+
+bool reading_queue_push(const TelemetryRecord *record);
+size_t reading_queue_pop(TelemetryRecord records[], size_t max);
+ReadingQueueStats reading_queue_stats();
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,321 @@
+#include "sampling.h"
+#include "freertos/FreeRTOS.h"
+#if CONFIG_DHT_ASYNC_READS
+#include "freertos/queue.h"
+#endif
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "common.h"
+#include "dht.h"
+#include "filter.h"
+#include "metrics.h"
+#include "reading_queue.h"
+#include "sensor_health.h"
+#include "sensors.h"
+#include "telemetry.h"
+#include "timestamp.h"
+
+static const char *TAG = "sampling";
+
+#if CONFIG_FILTER_READINGS
+// One per sensor, by registry index, then one per zone aggregate. In RTC memory so deep sleep doesn't
+// reset the deadband and heartbeat.
+static RTC_DATA_ATTR SensorFilter filters[SENSORS_MAX + SENSOR_ZONES_MAX];
+#endif
+
+#if CONFIG_DHT_ASYNC_READS
+typedef struct PinReading {
+	uint8_t pin;
+	Reading reading;
+	uint32_t finishedMicros;
+	uint32_t group;
+} PinReading;
+
+/*
+ * Completed reads, tagged with the group that started them. A read that outlives its group's wait
+ * still lands here later and is told apart by its tag. Room for a whole group of cached readings on
+ * top of every read that can be in flight.
+ */
+#define READING_QUEUE_LENGTH (2 * DHTLIB_MAX_PARALLEL)
+
+static QueueHandle_t readingQueue;
+static uint32_t readGroup;
+
+static void create_reading_queue() {
+#if CONFIG_STATIC_ALLOCATION
+	static uint8_t storage[READING_QUEUE_LENGTH * sizeof(PinReading)];
+	static StaticQueue_t buffer;
+	readingQueue = xQueueCreateStatic(READING_QUEUE_LENGTH, sizeof(PinReading), storage, &buffer);
+#else
+	readingQueue = xQueueCreate(READING_QUEUE_LENGTH, sizeof(PinReading));
+#endif
+}
+
+static void queue_reading(uint8_t pin, Reading reading, void *arg) {
+	PinReading pinReading = {
+		.pin = pin,
+		.reading = reading,
+		.finishedMicros = micros(),
+		.group = (uint32_t) (uintptr_t) arg
+	};
+	xQueueSend(readingQueue, &pinReading, 0);
+}
+
+/*
+ * Kicks off a read on up to DHTLIB_MAX_PARALLEL sensors and blocks on the queue until they have all
+ * reported, leaving the CPU to other tasks while the sensors are talking. Results of earlier groups
+ * that came in after their wait was over are thrown away.
+ */
+static void read_sensors_async_group(const uint8_t pins[], Reading readings[], uint32_t elapsedMicros[], size_t count) {
+	int outstanding = 0;
+	uint32_t group = ++readGroup;
+	uint32_t started = micros();
+	PinReading pinReading;
+
+	while (xQueueReceive(readingQueue, &pinReading, 0) == pdTRUE) {
+		ESP_LOGW(TAG, "Dropping a late reading of pin %d", pinReading.pin);
+	}
+	for (int i = 0; i < count; i++) {
+		readings[i].humidityTenths = DHTLIB_INVALID_VALUE;
+		readings[i].temperatureTenths = DHTLIB_INVALID_VALUE;
+		readings[i].status = DHTLIB_ERROR_TIMEOUT;
+		elapsedMicros[i] = 0;
+		if (getReadingAsync(pins[i], DHTLIB_MIN_INTERVAL_MS, queue_reading, (void *) (uintptr_t) group) == ESP_OK) {
+			outstanding++;
+		} else {
+			readings[i].status = DHTLIB_ERROR_TOO_SOON;
+		}
+	}
+
+	while (outstanding > 0 && xQueueReceive(readingQueue, &pinReading, 100 / portTICK_PERIOD_MS) == pdTRUE) {
+		if (pinReading.group != group) {
+			ESP_LOGW(TAG, "Dropping a late reading of pin %d", pinReading.pin);
+			continue;
+		}
+		outstanding--;
+		for (int i = 0; i < count; i++) {
+			if (pins[i] == pinReading.pin) {
+				readings[i] = pinReading.reading;
+				elapsedMicros[i] = pinReading.finishedMicros - started;
+			}
+		}
+	}
+	// Whatever never reported held the cycle up until now
+	for (int i = 0; i < count; i++) {
+		if (readings[i].status == DHTLIB_ERROR_TIMEOUT && elapsedMicros[i] == 0) {
+			elapsedMicros[i] = micros() - started;
+		}
+	}
+}
+
+/*
+ * Reads the sensors on 'pins', as many at a time as there are async read slots, along with how long
+ * each one took.
+ */
+static void read_sensors_async(const uint8_t pins[], Reading readings[], uint32_t elapsedMicros[], size_t count) {
+	for (size_t first = 0; first < count; first += DHTLIB_MAX_PARALLEL) {
+		size_t group = count - first < DHTLIB_MAX_PARALLEL ? count - first : DHTLIB_MAX_PARALLEL;
+		read_sensors_async_group(&pins[first], &readings[first], &elapsedMicros[first], group);
+	}
+}
+#endif
+
+/*
+ * Sets up the reading queue and async read slots when reads are asynchronous; nothing otherwise. Call
+ * it on the task that samples, after initInterrupts().
+ */
+esp_err_t sampling_init() {
+#if CONFIG_DHT_ASYNC_READS
+	create_reading_queue();
+	return initAsyncReads();
+#else
+	return ESP_OK;
+#endif
+}
+
+#if CONFIG_TASK_TOPOLOGY_MEASURE
+// How far each sample started from one period after the last, and how the reads went, since boot
+typedef struct SamplingStats {
+	uint32_t samples;
+	uint32_t reads;
+	uint32_t timeouts;
+	uint32_t maxJitterMicros;
+	uint64_t totalJitterMicros;
+} SamplingStats;
+
+static SamplingStats samplingStats;
+
+/*
+ * Call as each sample starts, with the period it's meant to start on.
+ */
+void sampling_measure_start(uint64_t periodMicros) {
+	static int64_t lastStarted = 0;
+	int64_t started = micros64();
+	int64_t interval = started - lastStarted;
+	lastStarted = started;
+
+	// A skipped sample isn't jitter
+	if (interval > periodMicros * 3 / 2) {
+		return;
+	}
+	uint32_t jitter = interval > periodMicros ? interval - periodMicros : periodMicros - interval;
+	samplingStats.samples++;
+	samplingStats.totalJitterMicros += jitter;
+	if (jitter > samplingStats.maxJitterMicros) {
+		samplingStats.maxJitterMicros = jitter;
+	}
+}
+#endif
+
+/*
+ * Logs how sampling has gone since boot.
+ */
+void sampling_log_stats() {
+#if CONFIG_TASK_TOPOLOGY_MEASURE
+	SamplingStats stats = samplingStats;
+	ESP_LOGI(TAG, "Since boot %u of %u reads timed out (%u.%u%%), sample jitter avg %u us max %u us", stats.timeouts,
+			stats.reads, stats.reads > 0 ? stats.timeouts * 100 / stats.reads : 0,
+			stats.reads > 0 ? stats.timeouts * 1000 / stats.reads % 10 : 0,
+			stats.samples > 0 ? (uint32_t) (stats.totalJitterMicros / stats.samples) : 0, stats.maxJitterMicros);
+#endif
+#if CONFIG_FILTER_READINGS
+	uint32_t samples = 0;
+	uint32_t reports = 0;
+	for (int i = 0; i < SENSORS_MAX + SENSOR_ZONES_MAX; i++) {
+		samples += filters[i].samples;
+		reports += filters[i].reports;
+	}
+	ESP_LOGI(TAG, "Filtering: %u of %u readings reported", reports, samples);
+#endif
+}
+
+/*
+ * The nearest tenth to sum / samples, halves away from zero, below freezing as well as above.
+ */
+static int16_t _averageTenths(int32_t sum, int samples) {
+	return (sum + (sum < 0 ? -samples : samples) / 2) / samples;
+}
+
+static void to_record(const Sensor *sensor, Reading reading, int64_t epochMillis, TelemetryRecord *record) {
+	record->pin = sensor->pin;
+	record->status = reading.status;
+	record->epochMillis = epochMillis;
+	record->humidityTenths = reading.humidityTenths;
+	record->temperatureTenths = reading.temperatureTenths;
+	sensors_calibrate(sensor, record);
+}
+
+/*
+ * Reads every sensor that isn't sitting out a quarantine, and tells sensor_health how each read went.
+ * Quarantined sensors get SENSOR_STATUS_QUARANTINED.
+ */
+static void read_sensors(Reading readings[]) {
+	uint8_t duePins[SENSORS_MAX];
+	uint8_t dueSensors[SENSORS_MAX];
+	Reading dueReadings[SENSORS_MAX];
+	uint32_t elapsedMicros[SENSORS_MAX];
+	size_t numDue = 0;
+
+	for (size_t i = 0; i < sensors_count(); i++) {
+		readings[i].humidityTenths = DHTLIB_INVALID_VALUE;
+		readings[i].temperatureTenths = DHTLIB_INVALID_VALUE;
+		readings[i].status = SENSOR_STATUS_QUARANTINED;
+		if (sensor_health_due(i)) {
+			duePins[numDue] = sensors_get(i)->pin;
+			dueSensors[numDue++] = i;
+		}
+	}
+	if (numDue == 0) {
+		return;
+	}
+
+#if CONFIG_DHT_ASYNC_READS
+	read_sensors_async(duePins, dueReadings, elapsedMicros, numDue);
+#else
+	// Anything read for another consumer since the last sample is reused rather than read again
+	uint32_t started = micros();
+	getReadings(duePins, dueReadings, numDue, DHTLIB_MIN_INTERVAL_MS);
+	// The sensors are read together, so one that fails holds the rest up for the whole read
+	uint32_t readMicros = micros() - started;
+	for (size_t i = 0; i < numDue; i++) {
+		elapsedMicros[i] = readMicros;
+	}
+#endif
+
+	for (size_t i = 0; i < numDue; i++) {
+		readings[dueSensors[i]] = dueReadings[i];
+		sensor_health_record(dueSensors[i], dueReadings[i].status, elapsedMicros[i]);
+	}
+}
+
+/*
+ * Reads every healthy sensor in the registry and queues the calibrated readings, plus an aggregate per
+ * zone, stamped with the current time, for publish_queued(). With CONFIG_FILTER_READINGS the readings
+ * are smoothed first, and only the ones that changed enough (or are due a heartbeat) are queued.
+ * Returns how many records were queued.
+ */
+int sample_readings() {
+	METRIC_BEGIN(sampleStarted);
+	size_t numSensors = sensors_count();
+	uint8_t numZones = sensors_zones();
+	Reading readings[SENSORS_MAX];
+	int zoneSamples[SENSOR_ZONES_MAX] = { 0 };
+	int32_t humiditySums[SENSOR_ZONES_MAX] = { 0 };
+	int32_t temperatureSums[SENSOR_ZONES_MAX] = { 0 };
+
+	read_sensors(readings);
+	int64_t now = timestamp_now();
+	TelemetryRecord cycle[SENSORS_MAX + SENSOR_ZONES_MAX];
+
+	for (int i = 0; i < numSensors; i++) {
+		to_record(sensors_get(i), readings[i], now, &cycle[i]);
+#if CONFIG_TASK_TOPOLOGY_MEASURE
+		samplingStats.reads++;
+		if (readings[i].status == DHTLIB_ERROR_TIMEOUT) {
+			samplingStats.timeouts++;
+		}
+#endif
+#if CONFIG_FILTER_READINGS
+		filter_smooth(&filters[i], &cycle[i]);
+#endif
+		if (cycle[i].status == DHTLIB_OK) {
+			ESP_LOGI(TAG, "Reading: Pin %d Zone %d Humidity: %.1f Temperature: %.1f", cycle[i].pin, cycle[i].zone,
+					cycle[i].humidityTenths / 10.0f, cycle[i].temperatureTenths / 10.0f);
+			zoneSamples[cycle[i].zone]++;
+			humiditySums[cycle[i].zone] += cycle[i].humidityTenths;
+			temperatureSums[cycle[i].zone] += cycle[i].temperatureTenths;
+		}
+	}
+
+	// Aggregates are never smoothed themselves, they are made of smoothed readings already
+	int records = numSensors;
+	for (uint8_t zone = 0; zone < numZones; zone++) {
+		int samples = zoneSamples[zone];
+		if (samples == 0) {
+			continue;
+		}
+		TelemetryRecord *aggregate = &cycle[records++];
+		aggregate->pin = TELEMETRY_ZONE_AGGREGATE;
+		aggregate->zone = zone;
+		aggregate->status = DHTLIB_OK;
+		aggregate->epochMillis = now;
+		aggregate->humidityTenths = _averageTenths(humiditySums[zone], samples);
+		aggregate->temperatureTenths = _averageTenths(temperatureSums[zone], samples);
+		ESP_LOGI(TAG, "Zone %d average (over %d samples) is: %.1f%cC and %.1f%%", zone, samples,
+				aggregate->temperatureTenths / 10.0f, 0x00B0, aggregate->humidityTenths / 10.0f);
+	}
+
+	int queued = 0;
+	for (int i = 0; i < records; i++) {
+#if CONFIG_FILTER_READINGS
+		int filter = cycle[i].pin == TELEMETRY_ZONE_AGGREGATE ? SENSORS_MAX + cycle[i].zone : i;
+		if (!filter_should_report(&filters[filter], &cycle[i])) {
+			continue;
+		}
+#endif
+		reading_queue_push(&cycle[i]);
+		queued++;
+	}
+	METRIC_END(METRIC_SAMPLE, sampleStarted);
+	return queued;
+}
@@ -0,0 +1,26 @@
+#ifndef sampling_h
+#define sampling_h
+
+/*
+ * The sampling stage: reads every healthy sensor in the registry, calibrates and (with
+ * CONFIG_FILTER_READINGS) smooths the readings, works out each zone's aggregate and queues whatever is
+ * worth reporting for the publishing stage (publish.h). It never waits on the network, and builds and
+ * runs off-device too.
+ *
+ * Only the sampling stage (the SAMPLE task, or the deep sleep cycle) calls these, after sensors_init()
+ * and sensor_health_init().
+ */
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t sampling_init();
+int sample_readings();
+#if CONFIG_TASK_TOPOLOGY_MEASURE
+void sampling_measure_start(uint64_t periodMicros);
+#endif
+void sampling_log_stats();
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,125 @@
+#include "scheduler.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "scheduler";
+
+static QueueHandle_t dueJobs;
+static Job *jobs[SCHEDULER_MAX_JOBS];
+static uint8_t jobCount = 0;
+
+/*
+ * Runs on the esp_timer task, so it only hands the job over. A job that is still pending from its
+ * last deadline has missed this one.
+ *
+ * Periodic jobs are re-armed for their next deadline on the fixed grid start + n * periodMicros
+ * rather than with a periodic timer started from here, which would shift the whole schedule by how
+ * late this first callback ran. Deadlines the callback itself was too late for count as missed.
+ */
+static void _timerCallback(void *arg) {
+	Job *job = arg;
+	job->dueDeadline = job->nextDeadline;
+	if (job->periodic) {
+		int64_t now = esp_timer_get_time();
+		job->nextDeadline += job->periodMicros;
+		while (job->nextDeadline <= now) {
+			job->nextDeadline += job->periodMicros;
+			job->stats.missed++;
+		}
+		startTimer(job->timer, job->nextDeadline - now);
+	}
+	if (job->pending) {
+		job->stats.missed++;
+		return;
+	}
+	job->pending = true;
+	xQueueSend(dueJobs, &job, 0);
+}
+
+/*
+ * Runs the next due job, waiting up to 'ticks' for one to come due. Returns whether one ran.
+ */
+bool scheduler_run_due(TickType_t ticks) {
+	Job *job;
+	if (xQueueReceive(dueJobs, &job, ticks) != pdTRUE) {
+		return false;
+	}
+
+	int64_t started = esp_timer_get_time();
+	uint32_t lateness = started > job->dueDeadline ? started - job->dueDeadline : 0;
+	job->function(job->arg);
+	uint32_t runMicros = esp_timer_get_time() - started;
+
+	job->stats.runs++;
+	job->stats.totalLatenessMicros += lateness;
+	if (lateness > job->stats.maxLatenessMicros) {
+		job->stats.maxLatenessMicros = lateness;
+	}
+	if (runMicros > job->stats.maxRunMicros) {
+		job->stats.maxRunMicros = runMicros;
+	}
+	job->pending = false;
+	return true;
+}
+
+/*
+ * Runs due jobs one at a time. The caller starts it as a task after scheduler_init(), so it can be
+ * placed (core, priority, stack) along with the application's other tasks.
+ */
+void scheduler_task(void *pvParameters) {
+	while (1) {
+		scheduler_run_due(portMAX_DELAY);
+	}
+}
+
+esp_err_t scheduler_init() {
+#if CONFIG_STATIC_ALLOCATION
+	static uint8_t queueStorage[SCHEDULER_MAX_JOBS * sizeof(Job *)];
+	static StaticQueue_t queueBuffer;
+	dueJobs = xQueueCreateStatic(SCHEDULER_MAX_JOBS, sizeof(Job *), queueStorage, &queueBuffer);
+#else
+	dueJobs = xQueueCreate(SCHEDULER_MAX_JOBS, sizeof(Job *));
+	if (dueJobs == NULL) {
+		return ESP_ERR_NO_MEM;
+	}
+#endif
+	return ESP_OK;
+}
+
+/*
+ * Runs the job after 'delayMicros' and then, for periodic jobs, every periodMicros after that.
+ * Adding a job that has already run (or been cancelled) arms it again.
+ */
+esp_err_t scheduler_add(Job *job, uint64_t delayMicros) {
+	if (job->timer == NULL) {
+		if (jobCount >= SCHEDULER_MAX_JOBS) {
+			return ESP_ERR_NO_MEM;
+		}
+		esp_err_t err = createTimer(&job->timer, _timerCallback, job, job->name);
+		if (err != ESP_OK) {
+			return err;
+		}
+		jobs[jobCount++] = job;
+	}
+
+	job->nextDeadline = esp_timer_get_time() + delayMicros;
+	job->periodic = job->periodMicros > 0;
+	return startTimer(job->timer, delayMicros);
+}
+
+esp_err_t scheduler_cancel(Job *job) {
+	job->periodic = false;
+	return stopTimer(job->timer);
+}
+
+void scheduler_dump_stats() {
+	for (int i = 0; i < jobCount; i++) {
+		const JobStats *stats = &jobs[i]->stats;
+		ESP_LOGI(TAG, "%s: %u runs, %u missed, lateness avg %u us max %u us, longest run %u us", jobs[i]->name,
+				stats->runs, stats->missed, stats->runs > 0 ? (uint32_t) (stats->totalLatenessMicros / stats->runs) : 0,
+				stats->maxLatenessMicros, stats->maxRunMicros);
+	}
+}
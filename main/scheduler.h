@@ -0,0 +1,65 @@
+#ifndef scheduler_h
+#define scheduler_h
+
+/*
+ * Periodic and one-shot jobs driven by esp_timer instead of tasks polling millis().
+ *
+ * A timer only marks its job as due; the job itself runs on the scheduler task, one at a time, so
+ * jobs may block (on I/O, MQTT, the DHT reads) without holding up the timer service. Between jobs
+ * every task is blocked, which lets the idle task run and, with CONFIG_FREERTOS_USE_TICKLESS_IDLE,
+ * put the chip into light sleep. Work that takes longer than a job should (e.g. a stepper rotation)
+ * belongs in its own task, with the job just notifying it.
+ *
+ * A periodic job's deadlines stay on the grid of its first one plus whole periods, however late any
+ * run is. Each job keeps how late it started relative to its deadline and how many times it was
+ * still queued or running when the next deadline came round (a missed deadline; that run is skipped).
+ *
+ * scheduler_task() runs the jobs as they come due, for good; scheduler_run_due() runs just the next
+ * one, for a caller with a loop of its own (the host tests).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "common.h"
+
+#define SCHEDULER_MAX_JOBS 8
+
+typedef void (*JobFunction)(void *arg);
+
+typedef struct JobStats {
+	uint32_t runs;
+	uint32_t missed;
+	uint32_t maxLatenessMicros;
+	uint64_t totalLatenessMicros;
+	uint32_t maxRunMicros;
+} JobStats;
+
+/*
+ * Owned by the caller and must outlive the scheduler (i.e. static). Only name, function, arg and
+ * periodMicros (0 for a one-shot job) are set by the caller.
+ */
+typedef struct Job {
+	const char *name;
+	JobFunction function;
+	void *arg;
+	uint64_t periodMicros;
+
+	Timer timer;
+	volatile bool periodic;      // cleared by scheduler_cancel() so the callback stops re-arming
+	volatile bool pending;
+	int64_t nextDeadline;
+	int64_t dueDeadline;
+	JobStats stats;
+} Job;
+
+esp_err_t scheduler_init();
+void scheduler_task(void *pvParameters);
+bool scheduler_run_due(TickType_t ticks);
+esp_err_t scheduler_add(Job *job, uint64_t delayMicros);
+esp_err_t scheduler_cancel(Job *job);
+void scheduler_dump_stats();
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,120 @@
+#include "sensor_health.h"
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "dht.h"
+#include "sensors.h"
+
+static const char *TAG = "sensor_health";
+
+static RTC_DATA_ATTR SensorHealth health[SENSORS_MAX];
+
+/*
+ * Call once the registry is loaded. Keeps what was learned before a deep sleep for every sensor that
+ * is still on the same pin.
+ */
+void sensor_health_init() {
+	for (size_t i = 0; i < sensors_count(); i++) {
+		uint8_t pin = sensors_get(i)->pin;
+		if (health[i].pin != pin) {
+			memset(&health[i], 0, sizeof(health[i]));
+			health[i].pin = pin;
+		}
+	}
+}
+
+/*
+ * Whether sensor 'index' should be read this cycle. Call exactly once per sensor per cycle; a
+ * quarantined sensor counts down to its next retry.
+ */
+bool sensor_health_due(size_t index) {
+	SensorHealth *sensor = &health[index];
+	if (sensor->state != SENSOR_QUARANTINED || sensor->skipCycles == 0) {
+		return true;
+	}
+	sensor->skipCycles--;
+	sensor->skipped++;
+	return false;
+}
+
+/*
+ * Records how a read of sensor 'index' went and how long it took. Refused reads (too soon) say
+ * nothing about the sensor and are ignored.
+ */
+void sensor_health_record(size_t index, int status, uint32_t elapsedMicros) {
+	SensorHealth *sensor = &health[index];
+	if (status == DHTLIB_ERROR_TOO_SOON) {
+		return;
+	}
+
+	sensor->attempts++;
+	if (status == DHTLIB_OK) {
+		sensor->successes++;
+		sensor->consecutiveFailures = 0;
+		if (sensor->state == SENSOR_QUARANTINED) {
+			ESP_LOGI(TAG, "Pin %d is out of quarantine", sensor->pin);
+			sensor->state = SENSOR_HEALTHY;
+			sensor->backoffCycles = 0;
+		}
+		return;
+	}
+
+	if (status == DHTLIB_ERROR_CHECKSUM) {
+		sensor->checksumErrors++;
+	} else {
+		sensor->timeouts++;
+	}
+	sensor->wastedMicros += elapsedMicros;
+	if (sensor->consecutiveFailures < UINT8_MAX) {
+		sensor->consecutiveFailures++;
+	}
+
+	if (sensor->state == SENSOR_QUARANTINED) {
+		// A failed retry: wait twice as long for the next one
+		sensor->backoffCycles *= 2;
+		if (sensor->backoffCycles > CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF) {
+			sensor->backoffCycles = CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF;
+		}
+		sensor->skipCycles = sensor->backoffCycles;
+	} else if (sensor->consecutiveFailures >= CONFIG_SENSOR_QUARANTINE_FAILURES) {
+		ESP_LOGW(TAG, "Pin %d failed %d times in a row, quarantining it", sensor->pin, sensor->consecutiveFailures);
+		sensor->state = SENSOR_QUARANTINED;
+		sensor->quarantines++;
+		sensor->backoffCycles = 1;
+		sensor->skipCycles = 1;
+	}
+}
+
+const SensorHealth *sensor_health_get(size_t index) {
+	return &health[index];
+}
+
+// The success rate in tenths of a percent, rounded to nearest
+static int16_t _successPermille(const SensorHealth *sensor) {
+	if (sensor->attempts == 0) {
+		return 0;
+	}
+	return (sensor->successes * 1000ULL + sensor->attempts / 2) / sensor->attempts;
+}
+
+/*
+ * Writes a "sensors" array with every sensor's state, success rate and failure counters.
+ */
+void sensor_health_write(JsonWriter *json) {
+	json_begin_array(json, "sensors");
+	for (size_t i = 0; i < sensors_count(); i++) {
+		const SensorHealth *sensor = &health[i];
+		json_begin_object(json, NULL);
+		json_uint(json, "pin", sensor->pin);
+		json_string(json, "state", sensor->state == SENSOR_QUARANTINED ? "quarantined" : "healthy");
+		json_tenths(json, "success_pct", _successPermille(sensor));
+		json_uint(json, "attempts", sensor->attempts);
+		json_uint(json, "timeouts", sensor->timeouts);
+		json_uint(json, "checksum_errors", sensor->checksumErrors);
+		json_uint(json, "quarantines", sensor->quarantines);
+		json_uint(json, "skipped", sensor->skipped);
+		json_uint(json, "wasted_ms", sensor->wastedMicros / 1000);
+		json_end_object(json);
+	}
+	json_end_array(json);
+}
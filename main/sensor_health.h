@@ -0,0 +1,50 @@
+#ifndef sensor_health_h
+#define sensor_health_h
+
+/*
+ * Keeps a dead or flaky sensor from stretching every sampling cycle. Each sensor in the registry has
+ * its successes, timeouts and checksum failures counted; after CONFIG_SENSOR_QUARANTINE_FAILURES
+ * failures in a row it is quarantined and only retried every 1, 2, 4, ... cycles, up to
+ * CONFIG_SENSOR_QUARANTINE_MAX_BACKOFF. A single good reading brings it back.
+ *
+ * Backoff is counted in sampling cycles rather than time so that it carries over deep sleep, where the
+ * state lives in RTC memory. Entries are indexed like the registry; use from the sampling stage only.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "json_writer.h"
+
+// Status of a sensor that wasn't read this cycle because it's quarantined
+#define SENSOR_STATUS_QUARANTINED -10
+
+typedef enum SensorState {
+	SENSOR_HEALTHY = 0,
+	SENSOR_QUARANTINED
+} SensorState;
+
+typedef struct SensorHealth {
+	uint8_t pin;                 // so a sensor moved or replaced in the table starts over
+	uint8_t state;
+	uint8_t consecutiveFailures;
+	uint16_t backoffCycles;      // cycles between retries while quarantined
+	uint16_t skipCycles;         // cycles left until the next retry
+	uint32_t attempts;
+	uint32_t successes;
+	uint32_t timeouts;
+	uint32_t checksumErrors;
+	uint32_t quarantines;
+	uint32_t skipped;            // cycles the sensor wasn't read
+	uint64_t wastedMicros;       // spent waiting on reads that failed
+} SensorHealth;
+
+void sensor_health_init();
+bool sensor_health_due(size_t index);
+void sensor_health_record(size_t index, int status, uint32_t elapsedMicros);
+const SensorHealth *sensor_health_get(size_t index);
+void sensor_health_write(JsonWriter *json);
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,196 @@
+#include "sensors.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/gpio.h"
+#include "dht.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#define TABLE_SIZE 256
+// Relative humidity in tenths of a percent can't go past 100%, whatever the offset
+#define HUMIDITY_MAX_TENTHS 1000
+
+static const char *TAG = "sensors";
+
+// Sensors in table order, with their pins alongside so a whole board can be handed to readPins()
+static Sensor sensors[SENSORS_MAX];
+static uint8_t pins[SENSORS_MAX];
+static size_t count;
+static uint8_t zones;
+
+static bool _parseOffset(const char *text, int16_t *tenths) {
+	char *end;
+	float offset = strtof(text, &end);
+	if (end == text || *end != '\0' || fabsf(offset) > 100) {
+		return false;
+	}
+	*tenths = lroundf(offset * 10);
+	return true;
+}
+
+/*
+ * Parses one pin[:zone[:humidity_offset[:temperature_offset]]] entry, modified in place.
+ */
+static bool _parseEntry(char *entry, Sensor *sensor) {
+	char *fields[4] = { NULL };
+	int numFields = 0;
+	// Split by hand; strtok_r() would skip an empty field and read ":1" as pin 1
+	for (char *field = entry; field != NULL; numFields++) {
+		if (numFields == 4 || *field == '\0' || *field == ':') {
+			return false;
+		}
+		fields[numFields] = field;
+		field = strchr(field, ':');
+		if (field != NULL) {
+			*field++ = '\0';
+		}
+	}
+
+	char *end;
+	long pin = strtol(fields[0], &end, 10);
+	if (end == fields[0] || *end != '\0' || pin < 0 || pin >= GPIO_NUM_MAX || !GPIO_IS_VALID_OUTPUT_GPIO(pin)) {
+		return false;
+	}
+	long zone = 0;
+	if (fields[1] != NULL) {
+		zone = strtol(fields[1], &end, 10);
+		if (end == fields[1] || *end != '\0' || zone < 0 || zone >= SENSOR_ZONES_MAX) {
+			return false;
+		}
+	}
+
+	sensor->pin = pin;
+	sensor->zone = zone;
+	sensor->humidityOffsetTenths = 0;
+	sensor->temperatureOffsetTenths = 0;
+	return (fields[2] == NULL || _parseOffset(fields[2], &sensor->humidityOffsetTenths))
+			&& (fields[3] == NULL || _parseOffset(fields[3], &sensor->temperatureOffsetTenths));
+}
+
+/*
+ * Replaces the registry with 'table', or leaves it alone and returns false if any entry is bad.
+ */
+static bool _parseTable(const char *table) {
+	char copy[TABLE_SIZE];
+	Sensor parsed[SENSORS_MAX];
+	size_t parsedCount = 0;
+
+	if (snprintf(copy, sizeof(copy), "%s", table) >= sizeof(copy)) {
+		ESP_LOGE(TAG, "Sensor table is longer than %d characters", TABLE_SIZE - 1);
+		return false;
+	}
+
+	char *save;
+	for (char *entry = strtok_r(copy, ", \t\n", &save); entry != NULL; entry = strtok_r(NULL, ", \t\n", &save)) {
+		if (parsedCount == SENSORS_MAX) {
+			ESP_LOGE(TAG, "More than %d sensors in the table", SENSORS_MAX);
+			return false;
+		}
+		Sensor *sensor = &parsed[parsedCount];
+		if (!_parseEntry(entry, sensor)) {
+			ESP_LOGE(TAG, "Bad sensor table entry %d", (int) parsedCount + 1);
+			return false;
+		}
+		for (size_t i = 0; i < parsedCount; i++) {
+			if (parsed[i].pin == sensor->pin) {
+				ESP_LOGE(TAG, "Pin %d is in the sensor table twice", sensor->pin);
+				return false;
+			}
+		}
+		parsedCount++;
+	}
+	if (parsedCount == 0) {
+		ESP_LOGE(TAG, "The sensor table is empty");
+		return false;
+	}
+
+	count = parsedCount;
+	zones = 0;
+	for (size_t i = 0; i < count; i++) {
+		sensors[i] = parsed[i];
+		pins[i] = parsed[i].pin;
+		if (sensors[i].zone >= zones) {
+			zones = sensors[i].zone + 1;
+		}
+	}
+	return true;
+}
+
+/*
+ * Returns true, with the table in 'table', if one has been stored in NVS.
+ */
+static bool _loadStoredTable(char table[TABLE_SIZE]) {
+	nvs_handle handle;
+	size_t length = TABLE_SIZE;
+
+	if (nvs_open("sensors", NVS_READONLY, &handle) != ESP_OK) {
+		return false;
+	}
+	esp_err_t err = nvs_get_str(handle, "table", table, &length);
+	nvs_close(handle);
+	return err == ESP_OK;
+}
+
+/*
+ * Loads the registry. NVS must be initialised. Falls back to CONFIG_SENSOR_TABLE if the stored table
+ * won't parse, and fails with ESP_ERR_INVALID_ARG only if neither does.
+ */
+esp_err_t sensors_init() {
+	char table[TABLE_SIZE];
+	bool parsed = false;
+
+	if (_loadStoredTable(table)) {
+		parsed = _parseTable(table);
+		if (!parsed) {
+			ESP_LOGW(TAG, "Ignoring the sensor table in NVS");
+		}
+	}
+	if (!parsed && !_parseTable(CONFIG_SENSOR_TABLE)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		ESP_LOGI(TAG, "Sensor %d: pin %d zone %d offsets %+.1f%% %+.1f°C", (int) i, sensors[i].pin, sensors[i].zone,
+				sensors[i].humidityOffsetTenths / 10.0f, sensors[i].temperatureOffsetTenths / 10.0f);
+	}
+	return ESP_OK;
+}
+
+size_t sensors_count() {
+	return count;
+}
+
+const Sensor *sensors_get(size_t index) {
+	return &sensors[index];
+}
+
+const uint8_t *sensors_pins() {
+	return pins;
+}
+
+// One more than the highest zone in the table
+uint8_t sensors_zones() {
+	return zones;
+}
+
+/*
+ * Turns a record of 'sensor' into a calibrated one in its zone, keeping the humidity within 0-100%.
+ * Failed readings only get the zone.
+ */
+void sensors_calibrate(const Sensor *sensor, TelemetryRecord *record) {
+	record->zone = sensor->zone;
+	if (record->status != DHTLIB_OK) {
+		return;
+	}
+	int humidity = record->humidityTenths + sensor->humidityOffsetTenths;
+	if (humidity < 0) {
+		humidity = 0;
+	} else if (humidity > HUMIDITY_MAX_TENTHS) {
+		humidity = HUMIDITY_MAX_TENTHS;
+	}
+	record->humidityTenths = humidity;
+	record->temperatureTenths += sensor->temperatureOffsetTenths;
+}
@@ -0,0 +1,43 @@
+#ifndef sensors_h
+#define sensors_h
+
+/*
+ * The board's sensors, from a table rather than the code. The table is a list of entries separated by
+ * commas or spaces, each
+ *
+ *   pin[:zone[:humidity_offset[:temperature_offset]]]
+ *
+ * e.g. "26:0 27:0:-1.5 25:1 33:1:0:0.3". Zones number from 0 and every zone with a healthy sensor gets
+ * its own aggregate; offsets are added to every reading of that sensor, in % RH and °C.
+ *
+ * sensors_init() takes the table from the "table" string in the "sensors" NVS namespace if there is one,
+ * so a board can be re-described without a rebuild, and from CONFIG_SENSOR_TABLE otherwise. The
+ * registry is read-only after that; index i is the same sensor everywhere (sensors_get(i),
+ * sensors_pins()[i], and any per-sensor state the caller keeps).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "telemetry.h"
+
+#define SENSORS_MAX CONFIG_SENSORS_MAX
+#define SENSOR_ZONES_MAX CONFIG_SENSOR_ZONES_MAX
+
+typedef struct Sensor {
+	uint8_t pin;
+	uint8_t zone;
+	int16_t humidityOffsetTenths;
+	int16_t temperatureOffsetTenths;
+} Sensor;
+
+esp_err_t sensors_init();
+size_t sensors_count();
+const Sensor *sensors_get(size_t index);
+const uint8_t *sensors_pins();
+uint8_t sensors_zones();
+void sensors_calibrate(const Sensor *sensor, TelemetryRecord *record);
+
+#endif
+
+// END OF FILE
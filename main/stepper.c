@@ -1,41 +1,490 @@
-#define LOW 0
-#define HIGH 1
-
-#include <stdint.h>
-#include "driver/gpio.h"
+#include "stepper.h"
+#include <math.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/portmacro.h"
 #include "esp_log.h"
-#include "common.h"
-#include "esp_timer.h"
+#include "metrics.h"
 
 static const char *TAG = "stepper";
 
-int steps[8][4] = {
-	  {LOW, HIGH, HIGH, HIGH},
-	  {LOW, LOW, HIGH, HIGH},
-	  {HIGH, LOW, HIGH, HIGH},
-	  {HIGH, LOW, LOW, HIGH},
-	  {HIGH, HIGH, LOW, HIGH},
-	  {HIGH, HIGH, LOW, LOW},
-	  {HIGH, HIGH, HIGH, LOW},
-	  {LOW, HIGH, HIGH, LOW}
-	};
+// The half-step sequence; coils are energised by LOW
+static const uint8_t halfSteps[8][4] = {
+	{LOW, HIGH, HIGH, HIGH},
+	{LOW, LOW, HIGH, HIGH},
+	{HIGH, LOW, HIGH, HIGH},
+	{HIGH, LOW, LOW, HIGH},
+	{HIGH, HIGH, LOW, HIGH},
+	{HIGH, HIGH, LOW, LOW},
+	{HIGH, HIGH, HIGH, LOW},
+	{LOW, HIGH, HIGH, LOW}
+};
+
+#define MAX_PHASES (4 * STEPPER_MICROSTEPS)
+// Steps due within this much of the tick are taken on it (1/256 µs)
+#define DUE_SLACK 128
+
+// PWM duty per microstep for each coil, the same for every motor
+static DRAM_ATTR uint8_t microDuties[MAX_PHASES][4];
+static bool microDutiesReady = false;
+// Bit N set while PWM channel N is a motor's; motors take them four at a time
+static uint8_t pwmChannelsUsed = 0;
+
+static portMUX_TYPE controllerMux = portMUX_INITIALIZER_UNLOCKED;
+static Stepper *motors = NULL;
+static bool timerReady = false;
+static bool ticking = false;
+// Controller time at the last tick, in 1/256 µs, and how long until the next one was asked for in µs
+static uint32_t now = 0;
+static uint32_t sleeping = 0;
+
+static void IRAM_ATTR _applyPhase(Stepper *motor, PortMasks *masks) {
+	if (motor->config.mode == STEP_MICRO) {
+		for (int coil = 0; coil < 4; coil++) {
+			setPwmDuty(motor->pwmChannel + coil, microDuties[motor->phase][coil]);
+		}
+		return;
+	}
+	const PortMasks *step = &motor->stepMasks[motor->phase];
+	masks->setLow |= step->setLow;
+	masks->clearLow |= step->clearLow;
+	masks->setHigh |= step->setHigh;
+	masks->clearHigh |= step->clearHigh;
+}
+
+static void IRAM_ATTR _beginMotion(Stepper *motor) {
+	const QueuedMotion *move = &motor->queue[motor->queueHead];
+	motor->queueHead = (motor->queueHead + 1) % STEPPER_QUEUE_LENGTH;
+	motor->queueCount--;
+
+	motor->direction = move->direction;
+	motor->total = move->steps;
+	motor->taken = 0;
+	motor->rampSteps = move->rampSteps;
+	motor->interval = move->firstInterval;
+	motor->minInterval = move->minInterval;
+	motor->done = move->done;
+	motor->doneArg = move->arg;
+	motor->due = now + motor->interval;
+	motor->moving = true;
+}
+
+static void IRAM_ATTR _step(Stepper *motor, PortMasks *masks) {
+	if (motor->direction > 0) {
+		motor->phase = motor->phase + 1 < motor->phases ? motor->phase + 1 : 0;
+	} else {
+		motor->phase = motor->phase > 0 ? motor->phase - 1 : motor->phases - 1;
+	}
+	_applyPhase(motor, masks);
+	motor->taken++;
+#if CONFIG_STEPPER_BENCHMARK
+	uint32_t stepMicros = micros();
+	if (motor->taken > 1) {
+		uint32_t elapsed = stepMicros - motor->lastStepMicros;
+		motor->minStepMicros = elapsed < motor->minStepMicros ? elapsed : motor->minStepMicros;
+		motor->maxStepMicros = elapsed > motor->maxStepMicros ? elapsed : motor->maxStepMicros;
+	}
+	motor->lastStepMicros = stepMicros;
+#endif
+
+	if (motor->taken >= motor->total) {
+		motor->moving = false;
+		if (motor->done != NULL) {
+			motor->done(motor->doneArg);
+		}
+		return;
+	}
+
+	uint32_t remaining = motor->total - motor->taken;
+	if (remaining <= motor->rampSteps) {
+		motor->interval += 2 * motor->interval / (4 * remaining - 1);
+	} else if (motor->taken < motor->rampSteps) {
+		motor->interval -= 2 * motor->interval / (4 * motor->taken + 1);
+		if (motor->interval < motor->minInterval) {
+			motor->interval = motor->minInterval;
+		}
+	} else {
+		motor->interval = motor->minInterval;
+	}
+	motor->due += motor->interval;
+}
+
+/*
+ * Step intervals follow D. Austin's "Generate stepper-motor speed profiles in real time": each step
+ * during the ramp takes c(n) = c(n-1) - 2c(n-1)/(4n+1), which needs no floating point in the interrupt.
+ *
+ * One tick: step every motor that's due, start queued moves on idle motors, write all the coils at
+ * once and work out when the next motor is due.
+ */
+static uint32_t IRAM_ATTR _tick(void *arg) {
+	METRIC_BEGIN_CYCLES(started);
+	PortMasks masks = { 0 };
+	uint32_t next = UINT32_MAX;
+	bool stepped = false;
+
+	portENTER_CRITICAL_ISR(&controllerMux);
+	// The timer may have run longer than was asked for, and steps stay on time by what it really ran
+	if (sleeping > 0) {
+		now += intervalTimerLast() << 8;
+	}
+	for (Stepper *motor = motors; motor != NULL; motor = motor->next) {
+		if (!motor->moving && motor->queueCount > 0 && !motor->held) {
+			_beginMotion(motor);
+		} else if (motor->moving && (int32_t) (motor->due - now) <= DUE_SLACK) {
+			_step(motor, &masks);
+			stepped = true;
+			// A move that just finished hands straight over to the next one in the queue
+			if (!motor->moving && motor->queueCount > 0 && !motor->held) {
+				_beginMotion(motor);
+			}
+		}
+		if (motor->moving) {
+			int32_t until = motor->due - now;
+			uint32_t wait = until > 0 ? until : 0;
+			next = wait < next ? wait : next;
+		}
+	}
+	writePort(&masks);
 
-void set_up(int pins[]) {
+	if (next == UINT32_MAX) {
+		ticking = false;
+		sleeping = 0;
+		releaseMaxCpuFrequency();
+	} else {
+		sleeping = (next + 255) >> 8;
+		if (sleeping == 0) {
+			sleeping = 1;
+		}
+	}
+	uint32_t result = sleeping;
+	portEXIT_CRITICAL_ISR(&controllerMux);
+	if (stepped) {
+		METRIC_END_CYCLES(METRIC_STEP, started);
+	}
+	return result;
+}
+
+/*
+ * Called with the controller locked. If the timer is idle, kicks it so the next tick comes straight
+ * away; otherwise new moves start on the next tick anyway.
+ */
+static void _wake() {
+	if (!ticking) {
+		ticking = true;
+		sleeping = 0;
+		holdMaxCpuFrequency();
+		startIntervalTimer(1);
+	}
+}
+
+static void _setLevel(PortMasks *masks, uint8_t pin, uint8_t level) {
+	if (level == HIGH) {
+		masks->setLow |= PIN_MASK_LOW(pin);
+		masks->setHigh |= PIN_MASK_HIGH(pin);
+	} else {
+		masks->clearLow |= PIN_MASK_LOW(pin);
+		masks->clearHigh |= PIN_MASK_HIGH(pin);
+	}
+}
+
+/*
+ * Wave drive is the even rows of the half-step sequence and full step the odd ones. Microstepping
+ * gives coil N a share of cos(angle - N * 90°), clipped at 0, of the current.
+ */
+static void _buildPhases(Stepper *motor) {
+	if (motor->config.mode == STEP_MICRO) {
+		motor->phases = MAX_PHASES;
+		if (!microDutiesReady) {
+			for (int phase = 0; phase < MAX_PHASES; phase++) {
+				float angle = 2 * M_PI * phase / MAX_PHASES;
+				for (int coil = 0; coil < 4; coil++) {
+					float share = cosf(angle - coil * M_PI / 2);
+					uint8_t on = share > 0 ? lroundf(share * PWM_MAX_DUTY) : 0;
+					// Energised by LOW, so the duty is the time the coil is off
+					microDuties[phase][coil] = PWM_MAX_DUTY - on;
+				}
+			}
+			microDutiesReady = true;
+		}
+		return;
+	}
+
+	int first = motor->config.mode == STEP_FULL ? 1 : 0;
+	int stride = motor->config.mode == STEP_HALF ? 1 : 2;
+	motor->phases = 8 / stride;
+	for (int phase = 0; phase < motor->phases; phase++) {
+		PortMasks *masks = &motor->stepMasks[phase];
+		masks->setLow = masks->clearLow = masks->setHigh = masks->clearHigh = 0;
+		for (int coil = 0; coil < 4; coil++) {
+			_setLevel(masks, motor->config.pins[coil], halfSteps[first + phase * stride][coil]);
+		}
+	}
+}
+
+static bool _claimPwmChannels(Stepper *motor) {
+	for (uint8_t first = 0; first + 4 <= PWM_CHANNELS; first += 4) {
+		if ((pwmChannelsUsed & (0xf << first)) == 0) {
+			pwmChannelsUsed |= 0xf << first;
+			motor->pwmChannel = first;
+			motor->pwmReady = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Called before a microstepping motor takes 'config': the pins it's leaving go back to GPIO, and if
+ * it stops microstepping its PWM channels are stopped and freed for another motor.
+ */
+static void _releasePwm(Stepper *motor, const StepperConfig *config) {
+	if (!motor->pwmReady) {
+		return;
+	}
+	bool micro = config->mode == STEP_MICRO;
 	for (int i = 0; i < 4; i++) {
-		ESP_LOGI(TAG, "Setting pin %d (%d) to output", i, pins[i]);
-		pinModeOutput(pins[i]);
+		if (!micro || config->pins[i] != motor->config.pins[i]) {
+			stopPwm(motor->pwmChannel + i, motor->config.pins[i]);
+		}
+	}
+	if (!micro) {
+		pwmChannelsUsed &= ~(0xf << motor->pwmChannel);
+		motor->pwmReady = false;
 	}
 }
 
-void rotate(int pins[]) {
-	ESP_LOGI(TAG, "Starting steps...");
-	for (int i = 0; i < 1000; i++) {
+/*
+ * Adds 'motor' to the controller, or changes its configuration if it's already there (only while it
+ * isn't moving). The step interrupt runs on the core of whoever sets up the first motor.
+ */
+esp_err_t set_up(Stepper *motor, const StepperConfig *config) {
+	if (in_motion(motor)) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!timerReady) {
+		esp_err_t err = initIntervalTimer(_tick, NULL);
+		if (err != ESP_OK) {
+			return err;
+		}
+		timerReady = true;
+	}
+
+	_releasePwm(motor, config);
+	motor->config = *config;
+	for (int i = 0; i < 4; i++) {
+		ESP_LOGI(TAG, "Setting pin %d (%d) to output", i, motor->config.pins[i]);
+		if (motor->config.mode != STEP_MICRO) {
+			pinModeOutput(motor->config.pins[i]);
+			continue;
+		}
+		if (!motor->pwmReady && !_claimPwmChannels(motor)) {
+			return ESP_ERR_NO_MEM;
+		}
+		esp_err_t err = initPwm(motor->pwmChannel + i, motor->config.pins[i]);
+		if (err != ESP_OK) {
+			return err;
+		}
+	}
+	_buildPhases(motor);
+	motor->phase = 0;
+	PortMasks masks = { 0 };
+	_applyPhase(motor, &masks);
+	writePort(&masks);
+
+	if (!motor->registered) {
+		portENTER_CRITICAL(&controllerMux);
+		motor->next = motors;
+		motors = motor;
+		motor->registered = true;
+		portEXIT_CRITICAL(&controllerMux);
+	}
+	return ESP_OK;
+}
+
+uint32_t revolution_steps(const Stepper *motor) {
+	switch (motor->config.mode) {
+	case STEP_HALF:
+		return motor->config.stepsPerRevolution * 2;
+	case STEP_MICRO:
+		return motor->config.stepsPerRevolution * STEPPER_MICROSTEPS;
+	default:
+		return motor->config.stepsPerRevolution;
+	}
+}
+
+/*
+ * Steps per second at the configured rpm.
+ */
+uint32_t step_rate(const Stepper *motor) {
+	return revolution_steps(motor) * motor->config.rpm / 60;
+}
+
+/*
+ * Queues 'move' and returns straight away. It starts on the next tick if the motor is idle and not
+ * held, otherwise once the moves ahead of it are done. 'done' (which may be NULL) is called from the
+ * timer interrupt at the end, so it must be IRAM_ATTR and only use the FromISR APIs.
+ */
+esp_err_t start_motion(Stepper *motor, const Motion *move, MotionDone done, void *arg) {
+	uint32_t maxStepsPerSecond = move->maxStepsPerSecond > 0 ? move->maxStepsPerSecond : step_rate(motor);
+	if (!motor->registered || move->steps == 0 || maxStepsPerSecond == 0 || maxStepsPerSecond > 1000000) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	QueuedMotion queued = {
+		.steps = move->steps,
+		.direction = move->direction < 0 ? -1 : 1,
+		.minInterval = (1000000u << 8) / maxStepsPerSecond,
+		.done = done,
+		.arg = arg
+	};
+	if (move->acceleration == 0) {
+		queued.rampSteps = 0;
+		queued.firstInterval = queued.minInterval;
+	} else {
+		uint64_t rampSteps = (uint64_t) maxStepsPerSecond * maxStepsPerSecond / (2 * move->acceleration);
+		queued.rampSteps = rampSteps < move->steps / 2 ? rampSteps : move->steps / 2;
+		// 0.676 corrects the first step of the approximation
+		queued.firstInterval = (uint32_t) (0.676f * 1000000.0f * sqrtf(2.0f / move->acceleration) * 256.0f);
+		if (queued.firstInterval < queued.minInterval) {
+			queued.firstInterval = queued.minInterval;
+		}
+	}
+
+	esp_err_t result = ESP_OK;
+	portENTER_CRITICAL(&controllerMux);
+	if (motor->queueCount >= STEPPER_QUEUE_LENGTH) {
+		result = ESP_ERR_NO_MEM;
+	} else {
+		motor->queue[(motor->queueHead + motor->queueCount) % STEPPER_QUEUE_LENGTH] = queued;
+		motor->queueCount++;
+		if (!motor->held) {
+			_wake();
+		}
+	}
+	portEXIT_CRITICAL(&controllerMux);
+
+	if (result == ESP_OK) {
+		ESP_LOGI(TAG, "Queued %u steps at up to %u steps/s", move->steps, maxStepsPerSecond);
+	}
+	return result;
+}
+
+/*
+ * Moves queued on held motors wait until release_motion().
+ */
+void hold_motion(Stepper *motors[], int count) {
+	portENTER_CRITICAL(&controllerMux);
+	for (int i = 0; i < count; i++) {
+		motors[i]->held = true;
+	}
+	portEXIT_CRITICAL(&controllerMux);
+}
+
+/*
+ * Idle motors among 'motors' all start their next move on the same tick.
+ */
+void release_motion(Stepper *motors[], int count) {
+	portENTER_CRITICAL(&controllerMux);
+	for (int i = 0; i < count; i++) {
+		motors[i]->held = false;
+	}
+	_wake();
+	portEXIT_CRITICAL(&controllerMux);
+}
+
+/*
+ * Stops 'motors' dead on the same tick, without decelerating or calling the done callbacks, and drops
+ * their queued moves.
+ */
+void stop_motion(Stepper *motors[], int count) {
+	portENTER_CRITICAL(&controllerMux);
+	for (int i = 0; i < count; i++) {
+		motors[i]->moving = false;
+		motors[i]->queueCount = 0;
+	}
+	portEXIT_CRITICAL(&controllerMux);
+}
+
+/*
+ * True while the motor is moving or has moves queued.
+ */
+bool in_motion(const Stepper *motor) {
+	return motor->moving || motor->queueCount > 0;
+}
+
+#if CONFIG_STEPPER_BENCHMARK
+#define BENCHMARK_ROUNDS 1000
+#define BENCHMARK_STEPS 400
+
+static const char *modeNames[] = { "wave", "full step", "half step", "microstep" };
+
+/*
+ * Cycles per half-step for the old path (one digitalWrite per coil, as rotate() used to do, minus
+ * its delays) against the mask table.
+ */
+static void _benchmarkHalfStep(Stepper *motor) {
+	uint32_t started = cycleCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
 		for (int step = 0; step < 8; step++) {
 			for (int pin = 0; pin < 4; pin++) {
-				delayMicroseconds(1000);
-				gpio_set_level(pins[pin], steps[step][pin]);
+				digitalWrite(motor->config.pins[pin], halfSteps[step][pin]);
 			}
 		}
 	}
-	ESP_LOGI(TAG, "...Steps done");
+	uint32_t perPinCycles = cycleCount() - started;
+
+	started = cycleCount();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		for (int step = 0; step < 8; step++) {
+			writePort(&motor->stepMasks[step]);
+		}
+	}
+	uint32_t maskCycles = cycleCount() - started;
+
+	ESP_LOGI(TAG, "Half-step: %u cycles with digitalWrite per coil, %u cycles with the mask table",
+			perPinCycles / (BENCHMARK_ROUNDS * 8), maskCycles / (BENCHMARK_ROUNDS * 8));
+}
+
+/*
+ * For every mode: the step rate the interrupt could keep up with if writing the coils were all it did,
+ * and the spread of the step intervals over a real move at the configured rpm. Logged once at start
+ * up; the motor does turn. Leaves the motor set up as it was.
+ */
+void benchmark_stepper(Stepper *motor) {
+	StepperConfig config = motor->config;
+	StepperConfig modeConfig = config;
+	for (int mode = STEP_WAVE; mode <= STEP_MICRO; mode++) {
+		modeConfig.mode = mode;
+		if (set_up(motor, &modeConfig) != ESP_OK) {
+			ESP_LOGW(TAG, "Couldn't set up %s mode", modeNames[mode]);
+			continue;
+		}
+		if (mode == STEP_HALF) {
+			_benchmarkHalfStep(motor);
+		}
+
+		uint32_t started = micros();
+		for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+			PortMasks masks = { 0 };
+			motor->phase = i % motor->phases;
+			_applyPhase(motor, &masks);
+			writePort(&masks);
+		}
+		uint32_t applyMicros = micros() - started;
+
+		motor->minStepMicros = UINT32_MAX;
+		motor->maxStepMicros = 0;
+		Motion move = { .steps = BENCHMARK_STEPS, .direction = STEPPER_FORWARD };
+		if (start_motion(motor, &move, NULL, NULL) != ESP_OK) {
+			continue;
+		}
+		while (in_motion(motor)) {
+			delay(10);
+		}
+		ESP_LOGI(TAG, "%s: at most %u steps/s, %u steps/s interval %u us measured %u to %u us", modeNames[mode],
+				applyMicros > 0 ? BENCHMARK_ROUNDS * 1000000u / applyMicros : 0, step_rate(motor),
+				1000000 / step_rate(motor), motor->minStepMicros, motor->maxStepMicros);
+	}
+	set_up(motor, &config);
 }
+#endif
@@ -5,8 +5,121 @@
 #ifndef stepper_h
 #define stepper_h
 
-void set_up(int pins[]);
-void rotate(int pins[]);
+/*
+ * Any number of steppers driven from one hardware timer interrupt. Each tick steps every motor that is
+ * due and writes all their coils in a single GPIO mask write, then sleeps until the next motor is due.
+ * A motor is a fixed struct owned by the caller, with a short queue of moves it works through in turn.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "common.h"
+
+#define STEPPER_FORWARD 1
+#define STEPPER_REVERSE -1
+
+// Microsteps per full step in STEP_MICRO mode
+#define STEPPER_MICROSTEPS 8
+// Moves a motor can have waiting behind the current one
+#define STEPPER_QUEUE_LENGTH 4
+
+/*
+ * How the coils are driven. Wave drive energises one coil at a time (least current), full step two
+ * (most torque), half step alternates between the two and microstepping shares the current between
+ * neighbouring coils with PWM for the smoothest motion. A "step" below is one step of the chosen mode.
+ * Microstepping takes four of the PWM channels, so at most two motors can use it at once; a motor set
+ * up in another mode gives them back.
+ */
+typedef enum StepMode {
+	STEP_WAVE,
+	STEP_FULL,
+	STEP_HALF,
+	STEP_MICRO
+} StepMode;
+
+typedef struct StepperConfig {
+	uint8_t pins[4];             // coils in the order they're energised
+	StepMode mode;
+	uint32_t stepsPerRevolution; // full steps, including any gearbox
+	uint32_t rpm;                // default speed of a move
+} StepperConfig;
+
+/*
+ * A move of 'steps' steps. The motor speeds up at 'acceleration' steps/s² until it reaches
+ * 'maxStepsPerSecond' (0 for the configured rpm), and slows down the same way to stop on the last step
+ * (a trapezoidal profile, or a triangular one if the move is too short to reach full speed). An
+ * acceleration of 0 runs the whole move at full speed.
+ */
+typedef struct Motion {
+	uint32_t steps;
+	int8_t direction;
+	uint32_t maxStepsPerSecond;
+	uint32_t acceleration;
+} Motion;
+
+// Called from the step interrupt once the last step of a move is out
+typedef void (*MotionDone)(void *arg);
+
+// A Motion worked out into step intervals, ready for the interrupt
+typedef struct QueuedMotion {
+	uint32_t steps;
+	int8_t direction;
+	uint32_t rampSteps;
+	uint32_t firstInterval;
+	uint32_t minInterval;
+	MotionDone done;
+	void *arg;
+} QueuedMotion;
+
+/*
+ * One motor. Must outlive the controller (i.e. static) and is only touched through the functions
+ * below. Step intervals and due times are in 1/256 µs.
+ */
+typedef struct Stepper {
+	StepperConfig config;
+	PortMasks stepMasks[8];
+	uint8_t phases;
+	uint8_t phase;
+	bool pwmReady;
+	uint8_t pwmChannel;
+	bool registered;
+	bool held;
+
+	bool moving;
+	int8_t direction;
+	uint32_t total;
+	uint32_t taken;
+	uint32_t rampSteps;
+	uint32_t interval;
+	uint32_t minInterval;
+	uint32_t due;
+	MotionDone done;
+	void *doneArg;
+
+	QueuedMotion queue[STEPPER_QUEUE_LENGTH];
+	uint8_t queueHead;
+	uint8_t queueCount;
+
+#if CONFIG_STEPPER_BENCHMARK
+	uint32_t lastStepMicros;
+	uint32_t minStepMicros;
+	uint32_t maxStepMicros;
+#endif
+	struct Stepper *next;
+} Stepper;
+
+esp_err_t set_up(Stepper *motor, const StepperConfig *config);
+uint32_t revolution_steps(const Stepper *motor);
+uint32_t step_rate(const Stepper *motor);
+esp_err_t start_motion(Stepper *motor, const Motion *motion, MotionDone done, void *arg);
+void hold_motion(Stepper *motors[], int count);
+void release_motion(Stepper *motors[], int count);
+void stop_motion(Stepper *motors[], int count);
+bool in_motion(const Stepper *motor);
+#if CONFIG_STEPPER_BENCHMARK
+void benchmark_stepper(Stepper *motor);
+#endif
 
 #endif
 
@@ -0,0 +1,212 @@
+#include "telemetry.h"
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_ARRAY    4
+
+#define TELEMETRY_FIELDS 7
+
+typedef struct CborBuffer {
+	uint8_t *data;
+	size_t size;
+	size_t length;
+	bool overflow;
+} CborBuffer;
+
+/*
+ * Writes a CBOR head (major type + argument) using the shortest encoding, as the spec requires.
+ */
+static void _putHead(CborBuffer *cbor, uint8_t major, uint64_t argument) {
+	uint8_t bytes;
+	uint8_t info;
+
+	if (argument < 24) {
+		bytes = 0;
+		info = argument;
+	} else if (argument <= UINT8_MAX) {
+		bytes = 1;
+		info = 24;
+	} else if (argument <= UINT16_MAX) {
+		bytes = 2;
+		info = 25;
+	} else if (argument <= UINT32_MAX) {
+		bytes = 4;
+		info = 26;
+	} else {
+		bytes = 8;
+		info = 27;
+	}
+
+	if (cbor->length + 1 + bytes > cbor->size) {
+		cbor->overflow = true;
+		return;
+	}
+	cbor->data[cbor->length++] = (major << 5) | info;
+	while (bytes--) {
+		cbor->data[cbor->length++] = argument >> (bytes * 8);
+	}
+}
+
+static void _putInt(CborBuffer *cbor, int64_t value) {
+	if (value < 0) {
+		_putHead(cbor, CBOR_NEGATIVE, (uint64_t) (-1 - value));
+	} else {
+		_putHead(cbor, CBOR_UNSIGNED, (uint64_t) value);
+	}
+}
+
+static void _putRecord(CborBuffer *cbor, const TelemetryRecord *record) {
+	_putHead(cbor, CBOR_ARRAY, TELEMETRY_FIELDS);
+	_putInt(cbor, TELEMETRY_VERSION);
+	_putInt(cbor, record->pin);
+	_putInt(cbor, record->zone);
+	_putInt(cbor, record->status);
+	_putInt(cbor, record->epochMillis);
+	_putInt(cbor, record->humidityTenths);
+	_putInt(cbor, record->temperatureTenths);
+}
+
+/*
+ * Returns the number of bytes written, or 0 if the record doesn't fit in 'size' bytes.
+ */
+size_t telemetry_encode(const TelemetryRecord *record, uint8_t *buffer, size_t size) {
+	CborBuffer cbor = { .data = buffer, .size = size, .length = 0, .overflow = false };
+
+	_putRecord(&cbor, record);
+
+	return cbor.overflow ? 0 : cbor.length;
+}
+
+/*
+ * Encodes 'count' records as a CBOR array of records. Returns 0 if they don't all fit.
+ */
+size_t telemetry_encode_batch(const TelemetryRecord records[], size_t count, uint8_t *buffer, size_t size) {
+	CborBuffer cbor = { .data = buffer, .size = size, .length = 0, .overflow = false };
+
+	_putHead(&cbor, CBOR_ARRAY, count);
+	for (size_t i = 0; i < count; i++) {
+		_putRecord(&cbor, &records[i]);
+	}
+
+	return cbor.overflow ? 0 : cbor.length;
+}
+
+static bool _getHead(const uint8_t *buffer, size_t length, size_t *offset, uint8_t *major, uint64_t *argument) {
+	if (*offset >= length) {
+		return false;
+	}
+
+	uint8_t initial = buffer[(*offset)++];
+	uint8_t info = initial & 0x1F;
+	uint8_t bytes;
+
+	*major = initial >> 5;
+	if (info < 24) {
+		*argument = info;
+		return true;
+	}
+
+	switch (info) {
+	case 24:
+		bytes = 1;
+		break;
+	case 25:
+		bytes = 2;
+		break;
+	case 26:
+		bytes = 4;
+		break;
+	case 27:
+		bytes = 8;
+		break;
+	default:
+		return false;
+	}
+
+	if (*offset + bytes > length) {
+		return false;
+	}
+	*argument = 0;
+	while (bytes--) {
+		*argument = (*argument << 8) | buffer[(*offset)++];
+	}
+	return true;
+}
+
+static bool _getInt(const uint8_t *buffer, size_t length, size_t *offset, int64_t min, int64_t max, int64_t *value) {
+	uint8_t major;
+	uint64_t argument;
+
+	if (!_getHead(buffer, length, offset, &major, &argument) || argument > INT64_MAX) {
+		return false;
+	}
+
+	if (major == CBOR_UNSIGNED) {
+		*value = (int64_t) argument;
+	} else if (major == CBOR_NEGATIVE) {
+		*value = -1 - (int64_t) argument;
+	} else {
+		return false;
+	}
+	return *value >= min && *value <= max;
+}
+
+static bool _getRecord(const uint8_t *buffer, size_t length, size_t *offset, TelemetryRecord *record) {
+	uint8_t major;
+	uint64_t fields;
+	int64_t version, pin, zone, status, epochMillis, humidity, temperature;
+
+	if (!_getHead(buffer, length, offset, &major, &fields) || major != CBOR_ARRAY || fields != TELEMETRY_FIELDS) {
+		return false;
+	}
+
+	if (!_getInt(buffer, length, offset, TELEMETRY_VERSION, TELEMETRY_VERSION, &version)
+			|| !_getInt(buffer, length, offset, 0, UINT8_MAX, &pin)
+			|| !_getInt(buffer, length, offset, 0, UINT8_MAX, &zone)
+			|| !_getInt(buffer, length, offset, INT8_MIN, INT8_MAX, &status)
+			|| !_getInt(buffer, length, offset, INT64_MIN, INT64_MAX, &epochMillis)
+			|| !_getInt(buffer, length, offset, INT16_MIN, INT16_MAX, &humidity)
+			|| !_getInt(buffer, length, offset, INT16_MIN, INT16_MAX, &temperature)) {
+		return false;
+	}
+
+	record->pin = pin;
+	record->zone = zone;
+	record->status = status;
+	record->epochMillis = epochMillis;
+	record->humidityTenths = humidity;
+	record->temperatureTenths = temperature;
+	return true;
+}
+
+/*
+ * Parses a record produced by telemetry_encode. Returns false on anything malformed, truncated,
+ * out of range or from an unknown version.
+ */
+bool telemetry_decode(const uint8_t *buffer, size_t length, TelemetryRecord *record) {
+	size_t offset = 0;
+
+	return _getRecord(buffer, length, &offset, record) && offset == length;
+}
+
+/*
+ * Parses a batch produced by telemetry_encode_batch into at most 'max' records.
+ */
+bool telemetry_decode_batch(const uint8_t *buffer, size_t length, TelemetryRecord records[], size_t max, size_t *count) {
+	size_t offset = 0;
+	uint8_t major;
+	uint64_t entries;
+
+	if (!_getHead(buffer, length, &offset, &major, &entries) || major != CBOR_ARRAY || entries > max) {
+		return false;
+	}
+
+	for (size_t i = 0; i < entries; i++) {
+		if (!_getRecord(buffer, length, &offset, &records[i])) {
+			return false;
+		}
+	}
+
+	*count = entries;
+	return offset == length;
+}
@@ -0,0 +1,44 @@
+#ifndef telemetry_h
+#define telemetry_h
+
+/*
+ * Compact binary encoding of a single reading, used instead of the JSON humidity/temperature pair
+ * when CONFIG_PAYLOAD_FORMAT_CBOR is set. A record is a CBOR array, typically under 20 bytes:
+ *
+ *   [version, pin, zone, status, epoch_ms, h10, t10]
+ *
+ * h10 and t10 are the humidity and temperature in tenths. A zone's aggregate has
+ * TELEMETRY_ZONE_AGGREGATE for its pin. A batch (CONFIG_PUBLISH_MODE_BATCHED) is a CBOR array of
+ * records.
+ *
+ * This file and telemetry.c only depend on the C library, so the decoder can be built into host-side
+ * tools unchanged.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 2
+// Not a GPIO; the 'pin' of a record that aggregates every sensor in its zone
+#define TELEMETRY_ZONE_AGGREGATE 255
+#define TELEMETRY_MAX_RECORD_SIZE 32
+
+// Ordered largest first so the struct packs into 16 bytes; it's also the store-and-forward record
+typedef struct TelemetryRecord {
+	int64_t epochMillis;
+	int16_t humidityTenths;
+	int16_t temperatureTenths;
+	uint8_t pin;
+	uint8_t zone;
+	int8_t status;
+} TelemetryRecord;
+
+size_t telemetry_encode(const TelemetryRecord *record, uint8_t *buffer, size_t size);
+bool telemetry_decode(const uint8_t *buffer, size_t length, TelemetryRecord *record);
+size_t telemetry_encode_batch(const TelemetryRecord records[], size_t count, uint8_t *buffer, size_t size);
+bool telemetry_decode_batch(const uint8_t *buffer, size_t length, TelemetryRecord records[], size_t max, size_t *count);
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,155 @@
+#include "timestamp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/portmacro.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/apps/sntp.h"
+
+static const char *TAG = "timestamp";
+
+// Anything before this means the clock hasn't been set yet
+#define EARLIEST_VALID_EPOCH 1546300800 // 2019-01-01T00:00:00Z
+
+static portMUX_TYPE offsetMux = portMUX_INITIALIZER_UNLOCKED;
+// Epoch microseconds at esp_timer 0
+static int64_t epochOffsetMicros = 0;
+static volatile bool synced = false;
+
+/*
+ * Sets the time zone and, if the clock is already set (e.g. after deep sleep), captures it straight away.
+ */
+void timestamp_init() {
+#if !CONFIG_TIMESTAMP_UTC
+	// Set timezone to Eastern Standard Time and print local time
+	setenv("TZ", "EST5EDT,M3.2.0/2,M11.1.0", 1);
+	tzset();
+#endif
+	timestamp_update();
+}
+
+/*
+ * Starts SNTP in the background; timestamp_update() notices once it has set the clock.
+ */
+void timestamp_start_sync() {
+	ESP_LOGI(TAG, "Initializing SNTP");
+	if (sntp_enabled()) {
+		sntp_stop();
+	}
+	sntp_setoperatingmode(SNTP_OPMODE_POLL);
+	sntp_setservername(0, "ca.pool.ntp.org");
+	sntp_init();
+}
+
+/*
+ * Captures the offset between the system clock and esp_timer again, if the clock has been set. Call it
+ * every so often; it's cheap. Returns whether timestamps are now wall-clock time.
+ */
+bool timestamp_update() {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	int64_t monotonic = esp_timer_get_time();
+	if (now.tv_sec < EARLIEST_VALID_EPOCH) {
+		return synced;
+	}
+
+	int64_t offset = (int64_t) now.tv_sec * 1000000 + now.tv_usec - monotonic;
+	portENTER_CRITICAL(&offsetMux);
+	epochOffsetMicros = offset;
+	portEXIT_CRITICAL(&offsetMux);
+	if (!synced) {
+		ESP_LOGI(TAG, "Clock is set");
+		synced = true;
+	}
+	return true;
+}
+
+bool timestamp_synced() {
+	return synced;
+}
+
+/*
+ * Milliseconds since the epoch, or since boot while the clock hasn't been set (check timestamp_synced()).
+ */
+int64_t timestamp_now() {
+	int64_t monotonic = esp_timer_get_time();
+	portENTER_CRITICAL(&offsetMux);
+	int64_t offset = epochOffsetMicros;
+	portEXIT_CRITICAL(&offsetMux);
+	return (offset + monotonic) / 1000;
+}
+
+static void _formatMinute(TimestampFormatter *formatter, time_t seconds) {
+	struct tm fields;
+#if CONFIG_TIMESTAMP_UTC
+	gmtime_r(&seconds, &fields);
+	strcpy(formatter->zone, "Z");
+#else
+	localtime_r(&seconds, &fields);
+	strftime(formatter->zone, sizeof(formatter->zone), "%Z", &fields);
+#endif
+	formatter->prefixLength = strftime(formatter->prefix, sizeof(formatter->prefix), "%FT%H:%M:", &fields);
+	formatter->zoneLength = strlen(formatter->zone);
+}
+
+/*
+ * Writes 'epochMillis' as "%FT%T%Z" (local time) or "%FT%TZ" (CONFIG_TIMESTAMP_UTC) into 'buffer' and
+ * returns its length, or 0 if it doesn't fit. Time zone rules change on the hour at most, so a minute's
+ * prefix stays right for the whole minute.
+ */
+size_t timestamp_format(TimestampFormatter *formatter, int64_t epochMillis, char *buffer, size_t size) {
+	time_t seconds = epochMillis / 1000;
+	int64_t minute = seconds / 60;
+	if (formatter->prefixLength == 0 || minute != formatter->minute) {
+		_formatMinute(formatter, minute * 60);
+		formatter->minute = minute;
+	}
+
+	size_t length = formatter->prefixLength + 2 + formatter->zoneLength;
+	if (length + 1 > size) {
+		return 0;
+	}
+	int second = seconds % 60;
+	char *cursor = buffer;
+	memcpy(cursor, formatter->prefix, formatter->prefixLength);
+	cursor += formatter->prefixLength;
+	*cursor++ = '0' + second / 10;
+	*cursor++ = '0' + second % 10;
+	memcpy(cursor, formatter->zone, formatter->zoneLength + 1);
+	return length;
+}
+
+#if CONFIG_TIMESTAMP_BENCHMARK
+#define BENCHMARK_ROUNDS 10000
+
+/*
+ * Nanoseconds per stamped and formatted timestamp, the old way (time(), localtime_r() and strftime()
+ * every time) against timestamp_now() plus timestamp_format(). Logged once at start up.
+ */
+void benchmark_timestamps() {
+	char text[TIMESTAMP_TEXT_SIZE];
+	struct tm fields;
+	time_t now;
+
+	int64_t started = esp_timer_get_time();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		time(&now);
+		localtime_r(&now, &fields);
+		strftime(text, sizeof(text), "%FT%T%Z", &fields);
+	}
+	int64_t oldMicros = esp_timer_get_time() - started;
+
+	TimestampFormatter formatter = { 0 };
+	started = esp_timer_get_time();
+	for (int i = 0; i < BENCHMARK_ROUNDS; i++) {
+		timestamp_format(&formatter, timestamp_now(), text, sizeof(text));
+	}
+	int64_t newMicros = esp_timer_get_time() - started;
+
+	ESP_LOGI(TAG, "Timestamps: %lld ns each with localtime_r/strftime, %lld ns with the cached offset and formatter",
+			oldMicros * 1000 / BENCHMARK_ROUNDS, newMicros * 1000 / BENCHMARK_ROUNDS);
+}
+#endif
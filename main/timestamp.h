@@ -0,0 +1,44 @@
+#ifndef timestamp_h
+#define timestamp_h
+
+/*
+ * Wall-clock timestamps without a syscall and a time zone lookup per reading. Once SNTP has set the
+ * clock, the offset between the epoch and esp_timer's monotonic microseconds is captured, and from then
+ * on a timestamp is one esp_timer_get_time() plus that offset. The offset is refreshed periodically to
+ * pick up SNTP's corrections. Nothing here ever waits for the clock to be set.
+ *
+ * Formatting reuses the date, hour and minute worked out for the previous timestamp whenever the minute
+ * hasn't changed, so normally only the seconds are written.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// "2019-05-04T12:34:56EDT" plus room for a longer zone name
+#define TIMESTAMP_TEXT_SIZE 32
+
+/*
+ * Each task formatting timestamps keeps its own.
+ */
+typedef struct TimestampFormatter {
+	int64_t minute;
+	char prefix[TIMESTAMP_TEXT_SIZE]; // up to and including the minutes: "2019-05-04T12:34:"
+	size_t prefixLength;
+	char zone[8];
+	size_t zoneLength;
+} TimestampFormatter;
+
+void timestamp_init();
+void timestamp_start_sync();
+bool timestamp_update();
+bool timestamp_synced();
+int64_t timestamp_now();
+size_t timestamp_format(TimestampFormatter *formatter, int64_t epochMillis, char *buffer, size_t size);
+#if CONFIG_TIMESTAMP_BENCHMARK
+void benchmark_timestamps();
+#endif
+
+#endif
+
+// END OF FILE
@@ -0,0 +1,142 @@
+#include "wifi.h"
+#include <string.h>
+#include "freertos/event_groups.h"
+#include "esp_attr.h"
+#include "esp_event_loop.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "lwip/err.h"
+
+/*set the ssid and password via "make menuconfig"*/
+#define DEFAULT_SSID CONFIG_WIFI_SSID
+#define DEFAULT_PWD CONFIG_WIFI_PASSWORD
+
+#define DEFAULT_LISTEN_INTERVAL CONFIG_WIFI_LISTEN_INTERVAL
+
+#if CONFIG_POWER_SAVE_MIN_MODEM
+#define DEFAULT_PS_MODE WIFI_PS_MIN_MODEM
+#elif CONFIG_POWER_SAVE_MAX_MODEM
+#define DEFAULT_PS_MODE WIFI_PS_MAX_MODEM
+#elif CONFIG_POWER_SAVE_NONE
+#define DEFAULT_PS_MODE WIFI_PS_NONE
+#else
+#define DEFAULT_PS_MODE WIFI_PS_NONE
+#endif /*CONFIG_POWER_SAVE_MODEM*/
+
+static const char *TAG = "wifi";
+static EventGroupHandle_t wifi_event_group;
+const static int CONNECTED_BIT = BIT0;
+
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+/*
+ * Kept in RTC memory across deep sleep so a wake can skip the scan and DHCP.
+ */
+typedef struct ConnectionCache {
+	bool apCached;
+	uint8_t bssid[6];
+	uint8_t channel;
+	bool ipCached;
+	tcpip_adapter_ip_info_t ip;
+	tcpip_adapter_dns_info_t dns;
+} ConnectionCache;
+
+static RTC_DATA_ATTR ConnectionCache cache;
+#endif
+
+static esp_err_t event_handler(void *ctx, system_event_t *event) {
+	switch (event->event_id) {
+	case SYSTEM_EVENT_STA_START:
+		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_START");
+		ESP_ERROR_CHECK(esp_wifi_connect());
+		break;
+	case SYSTEM_EVENT_STA_GOT_IP:
+		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_GOT_IP");
+		ESP_LOGI(TAG, "got IP:%s\n", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
+		xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
+		break;
+	case SYSTEM_EVENT_STA_DISCONNECTED:
+		ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED");
+		ESP_ERROR_CHECK(esp_wifi_connect());
+		xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
+		break;
+	default:
+		break;
+	}
+	return ESP_OK;
+}
+
+/*init wifi as sta and set power save mode, returns false if it didn't connect within 'timeout' */
+bool wifi_connect(TickType_t timeout) {
+	tcpip_adapter_init();
+	wifi_event_group = xEventGroupCreate();
+	ESP_ERROR_CHECK(esp_event_loop_init(event_handler, NULL));
+
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+	wifi_config_t wifi_config = {
+			.sta = {
+					.ssid = DEFAULT_SSID,
+					.password =	DEFAULT_PWD,
+					.listen_interval = DEFAULT_LISTEN_INTERVAL,
+			},
+	};
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+	// Go straight to the access point and reuse the lease from the previous wake
+	if (cache.apCached) {
+		ESP_LOGI(TAG, "Reconnecting to the cached access point on channel %d", cache.channel);
+		wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+		wifi_config.sta.channel = cache.channel;
+		wifi_config.sta.bssid_set = true;
+		memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+	}
+	if (cache.ipCached) {
+		ESP_LOGI(TAG, "Reusing cached IP %s", ip4addr_ntoa(&cache.ip.ip));
+		tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+		tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &cache.ip);
+		tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &cache.dns);
+	}
+#endif
+	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+
+	ESP_LOGI(TAG, "start the Wi-Fi SSID:[%s]", CONFIG_WIFI_SSID);
+	ESP_ERROR_CHECK(esp_wifi_start());
+
+	ESP_LOGI(TAG, "Waiting for wifi");
+	EventBits_t bits = xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, false, true, timeout);
+	if ((bits & CONNECTED_BIT) == 0) {
+		return false;
+	}
+
+	ESP_LOGI(TAG, "esp_wifi_set_ps().");
+	esp_wifi_set_ps(DEFAULT_PS_MODE);
+	return true;
+}
+
+void wifi_stop() {
+	esp_wifi_stop();
+}
+
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+/*
+ * Remembers the access point and lease so the next wake can skip the scan and DHCP.
+ */
+void wifi_cache_connection() {
+	wifi_ap_record_t ap;
+	if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+		memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+		cache.channel = ap.primary;
+		cache.apCached = true;
+	}
+	if (!cache.ipCached && tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &cache.ip) == ESP_OK
+			&& tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &cache.dns) == ESP_OK) {
+		cache.ipCached = true;
+	}
+}
+
+void wifi_forget_cache() {
+	cache.apCached = false;
+	cache.ipCached = false;
+}
+#endif
@@ -0,0 +1,24 @@
+#ifndef wifi_h
+#define wifi_h
+
+/*
+ * The station connection, in the power save mode set in menuconfig. Device only: everything that
+ * builds off-device gets to the network through the MQTT client (publish.h) instead.
+ *
+ * In deep sleep mode the access point and lease are kept in RTC memory, so a wake can skip the scan
+ * and DHCP; wifi_forget_cache() makes the next connection do both again.
+ */
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+bool wifi_connect(TickType_t timeout);
+void wifi_stop();
+#if CONFIG_SAMPLING_MODE_DEEP_SLEEP
+void wifi_cache_connection();
+void wifi_forget_cache();
+#endif
+
+#endif
+
+// END OF FILE